@@ -1,5 +1,6 @@
 #include "addressing.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include <string_view>
@@ -7,6 +8,8 @@
 #include "absl/log/log.h"
 #include "absl/strings/str_format.h"
 
+#include "hack.h"
+
 std::string DestinationString(uint16_t destination) {
   std::string result;
   if (destination & Destination::kA) {
@@ -23,72 +26,171 @@ std::string DestinationString(uint16_t destination) {
 
 Address::Address(char value_register) : value_register_(value_register) {}
 
+std::string Address::AddressingAssembly(uint16_t destination) const {
+  HackProgram program;
+  LowerAddressing(destination, &program);
+  return program.ToAssembly();
+}
+
 char Address::value_register() const { return value_register_; }
 
+void Address::LowerLoad(HackProgram *program) const {
+  LowerAddressing(Destination::kA, program);
+  program->AppendCompute(Destination::kD, value_register_ == 'A'
+                                              ? Computation::kA
+                                              : Computation::kM);
+}
+
 PointerAddressedAddress::PointerAddressedAddress(std::string_view pointer,
                                                  uint16_t index)
     : Address('M'), pointer_(pointer), index_(index) {}
 
-std::string PointerAddressedAddress::AddressingAssembly(
-    uint16_t destination) const {
-  return absl::StrFormat(
-      "@%u\n"
-      "D=A\n"
-      "@%s\n"
-      "%s=D+M\n",
-      index_, pointer_, DestinationString(destination));
+void PointerAddressedAddress::LowerAddressing(uint16_t destination,
+                                              HackProgram *program) const {
+  if (OffsetCost() < kIndexedCost) {
+    LowerOffsetAddressing(destination, program);
+    return;
+  }
+  program->AppendAddress(index_);
+  program->AppendCompute(Destination::kD, Computation::kA);
+  program->AppendAddress(pointer_);
+  program->AppendCompute(destination, Computation::kDPlusM);
+}
+
+void PointerAddressedAddress::LowerOffsetAddressing(
+    uint16_t destination, HackProgram *program) const {
+  program->AppendAddress(pointer_);
+  if (index_ == 0) {
+    program->AppendCompute(destination, Computation::kM);
+    return;
+  }
+  if (index_ == 1) {
+    program->AppendCompute(destination, Computation::kMPlusOne);
+    return;
+  }
+  program->AppendCompute(Destination::kA, Computation::kMPlusOne);
+  for (int i = 2; i < index_; ++i) {
+    program->AppendCompute(Destination::kA, Computation::kAPlusOne);
+  }
+  program->AppendCompute(destination, Computation::kAPlusOne);
+}
+
+int PointerAddressedAddress::OffsetCost() const {
+  return index_ == 0 ? 2 : index_ + 1;
+}
+
+int PointerAddressedAddress::AddressingCost() const {
+  return std::min(OffsetCost(), kIndexedCost);
 }
 
+uint16_t PointerAddressedAddress::index() const { return index_; }
+
 ArgumentAddress::ArgumentAddress(uint16_t index)
     : PointerAddressedAddress("ARG", index) {}
+std::string_view ArgumentAddress::segment() const { return "argument"; }
+
 LocalAddress::LocalAddress(uint16_t index)
     : PointerAddressedAddress("LCL", index) {}
+std::string_view LocalAddress::segment() const { return "local"; }
+
 ThisAddress::ThisAddress(uint16_t index)
     : PointerAddressedAddress("THIS", index) {}
+std::string_view ThisAddress::segment() const { return "this"; }
+
 ThatAddress::ThatAddress(uint16_t index)
     : PointerAddressedAddress("THAT", index) {}
+std::string_view ThatAddress::segment() const { return "that"; }
 
-StaticAddress::StaticAddress(std::string_view class_name, uint16_t index)
-    : Address('M'), class_name_(class_name), index_(index) {}
+SymbolAddress::SymbolAddress(std::string_view symbol)
+    : Address('M'), symbol_(symbol) {}
 
-std::string StaticAddress::AddressingAssembly(uint16_t destination) const {
-  std::string result = absl::StrFormat("@%s.%u\n", class_name_, index_);
+void SymbolAddress::LowerAddressing(uint16_t destination,
+                                    HackProgram *program) const {
+  program->AppendAddress(symbol_);
   destination = destination & ~Destination::kA;
   if (destination) {
-    absl::StrAppendFormat(&result, "%s=A\n", DestinationString(destination));
+    program->AppendCompute(destination, Computation::kA);
   }
-  return result;
 }
 
+std::string_view SymbolAddress::segment() const { return "static"; }
+
+const std::string &SymbolAddress::symbol() const { return symbol_; }
+
+StaticAddress::StaticAddress(std::string_view class_name, uint16_t index)
+    : SymbolAddress(absl::StrFormat("%s.%u", class_name, index)) {}
+
 DirectlyAddressedAddress::DirectlyAddressedAddress(uint16_t address,
                                                    char value_register)
     : Address(value_register), address_(address) {}
 
-std::string DirectlyAddressedAddress::AddressingAssembly(
-    uint16_t destination) const {
-  std::string result = absl::StrFormat("@%u\n", address_);
+void DirectlyAddressedAddress::LowerAddressing(uint16_t destination,
+                                               HackProgram *program) const {
+  program->AppendAddress(address_);
   destination = destination & ~Destination::kA;
   if (destination) {
-    absl::StrAppendFormat(&result, "%s=A\n", DestinationString(destination));
+    program->AppendCompute(destination, Computation::kA);
   }
-  return result;
 }
 
-ConstantAddress::ConstantAddress(uint16_t index)
-    : DirectlyAddressedAddress(index, 'A') {}
+ConstantAddress::ConstantAddress(uint16_t value)
+    : DirectlyAddressedAddress(value, 'A'), value_(value) {}
+
+void ConstantAddress::LowerLoad(HackProgram *program) const {
+  Computation computation;
+  if (ImmediateComputation(&computation)) {
+    program->AppendCompute(Destination::kD, computation);
+    return;
+  }
+  if (value_ < 1 << 15) {
+    Address::LowerLoad(program);
+    return;
+  }
+  // A-instructions only hold 15 bits, so load the complement instead.
+  program->AppendAddress(static_cast<uint16_t>(~value_));
+  program->AppendCompute(Destination::kD, Computation::kNotA);
+}
+
+bool ConstantAddress::ImmediateComputation(Computation *computation) const {
+  switch (value_) {
+    case 0:
+      *computation = Computation::kZero;
+      return true;
+    case 1:
+      *computation = Computation::kOne;
+      return true;
+    case 0xFFFF:
+      *computation = Computation::kMinusOne;
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::string_view ConstantAddress::segment() const { return "constant"; }
+
+uint16_t ConstantAddress::value() const { return value_; }
 
 PointerAddress::PointerAddress(uint16_t index)
-    : DirectlyAddressedAddress(3 + index, 'M') {
+    : DirectlyAddressedAddress(3 + index, 'M'), index_(index) {
   if (index >= 2) {
     LOG(WARNING) << "Index out of range: " << index
                  << " (pointer segment is 2 words long)";
   }
 }
 
+std::string_view PointerAddress::segment() const { return "pointer"; }
+
+uint16_t PointerAddress::index() const { return index_; }
+
 TempAddress::TempAddress(uint16_t index)
-    : DirectlyAddressedAddress(5 + index, 'M') {
+    : DirectlyAddressedAddress(5 + index, 'M'), index_(index) {
   if (index >= 8) {
     LOG(WARNING) << "Index out of range: " << index
                  << " (temp segment is 8 words long)";
   }
 }
+
+std::string_view TempAddress::segment() const { return "temp"; }
+
+uint16_t TempAddress::index() const { return index_; }
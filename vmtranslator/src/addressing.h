@@ -5,11 +5,7 @@
 #include <string>
 #include <string_view>
 
-enum Destination {
-  kA = 4,
-  kD = 2,
-  kM = 1,
-};
+#include "hack.h"
 
 std::string DestinationString(uint16_t destination);
 
@@ -17,21 +13,56 @@ class Address {
  public:
   Address(char value_register);
 
+  virtual ~Address() = default;
+
+  // Appends instructions that store the address of the value to be accessed in
+  // registers specified by `destination`.
+  virtual void LowerAddressing(uint16_t destination,
+                               HackProgram *program) const = 0;
+
   // Assembly code that stores the address of the value to be accessed in
   // registers specified by `destination`.
-  virtual std::string AddressingAssembly(uint16_t destination) const = 0;
+  std::string AddressingAssembly(uint16_t destination) const;
+
+  // Appends instructions that load the value to be accessed into D.
+  virtual void LowerLoad(HackProgram *program) const;
 
   // The register where the value to be accessed is stored.
   char value_register() const;
 
+  // The name of the memory segment in VM code, such as "local".
+  virtual std::string_view segment() const = 0;
+
  private:
   char value_register_;
 };
 
+// A value at `index` past the address in the register `pointer`. There are two
+// ways to compute its address, and `LowerAddressing()` appends the one with
+// fewer instructions: adding the index to the pointer (`@index`, `D=A`,
+// `@pointer`, `D+M`), or counting up from the pointer (`M`, `M+1`, then one
+// `A+1` per index above 1), which also leaves D intact.
 class PointerAddressedAddress : public Address {
  public:
+  // Number of instructions that add the index to the pointer.
+  static constexpr int kIndexedCost = 4;
+
   PointerAddressedAddress(std::string_view pointer, uint16_t index);
-  std::string AddressingAssembly(uint16_t destination) const;
+  void LowerAddressing(uint16_t destination,
+                       HackProgram *program) const override;
+
+  // Appends instructions that store the address in registers specified by
+  // `destination` by counting up from the pointer. D is left intact unless it
+  // is part of `destination`.
+  void LowerOffsetAddressing(uint16_t destination, HackProgram *program) const;
+
+  // Number of instructions appended by `LowerOffsetAddressing()`.
+  int OffsetCost() const;
+
+  // Number of instructions appended by `LowerAddressing()`.
+  int AddressingCost() const;
+
+  uint16_t index() const;
 
  private:
   std::string pointer_;
@@ -41,37 +72,53 @@ class PointerAddressedAddress : public Address {
 class ArgumentAddress : public PointerAddressedAddress {
  public:
   ArgumentAddress(uint16_t index);
+  std::string_view segment() const override;
 };
 
 class LocalAddress : public PointerAddressedAddress {
  public:
   LocalAddress(uint16_t index);
+  std::string_view segment() const override;
 };
 
 class ThisAddress : public PointerAddressedAddress {
  public:
   ThisAddress(uint16_t index);
+  std::string_view segment() const override;
 };
 
 class ThatAddress : public PointerAddressedAddress {
  public:
   ThatAddress(uint16_t index);
+  std::string_view segment() const override;
 };
 
-class StaticAddress : public Address {
+// A variable the assembler allocates in RAM for `symbol`.
+class SymbolAddress : public Address {
  public:
-  StaticAddress(std::string_view class_name, uint16_t index);
-  std::string AddressingAssembly(uint16_t destination) const override;
+  SymbolAddress(std::string_view symbol);
+  void LowerAddressing(uint16_t destination,
+                       HackProgram *program) const override;
+  // Variables other than statics, such as static frames, are accessed like
+  // statics.
+  std::string_view segment() const override;
+
+  const std::string &symbol() const;
 
  private:
-  std::string class_name_;
-  uint16_t index_;
+  std::string symbol_;
+};
+
+class StaticAddress : public SymbolAddress {
+ public:
+  StaticAddress(std::string_view class_name, uint16_t index);
 };
 
 class DirectlyAddressedAddress : public Address {
  public:
   DirectlyAddressedAddress(uint16_t address, char value_register);
-  std::string AddressingAssembly(uint16_t destination) const override;
+  void LowerAddressing(uint16_t destination,
+                       HackProgram *program) const override;
 
  private:
   uint16_t address_;
@@ -79,17 +126,43 @@ class DirectlyAddressedAddress : public Address {
 
 class ConstantAddress : public DirectlyAddressedAddress {
  public:
-  ConstantAddress(uint16_t index);
+  // `value` may be any 16-bit word, such as the result of constant folding,
+  // but only values below 32768 can be addressed with `LowerAddressing()`.
+  ConstantAddress(uint16_t value);
+  void LowerLoad(HackProgram *program) const override;
+  std::string_view segment() const override;
+
+  // Stores in `computation` the computation producing the value without
+  // reading any register, which exists for 0, 1 and -1. Returns false for other
+  // values.
+  bool ImmediateComputation(Computation *computation) const;
+
+  uint16_t value() const;
+
+ private:
+  uint16_t value_;
 };
 
 class PointerAddress : public DirectlyAddressedAddress {
  public:
   PointerAddress(uint16_t index);
+  std::string_view segment() const override;
+
+  uint16_t index() const;
+
+ private:
+  uint16_t index_;
 };
 
 class TempAddress : public DirectlyAddressedAddress {
  public:
   TempAddress(uint16_t index);
+  std::string_view segment() const override;
+
+  uint16_t index() const;
+
+ private:
+  uint16_t index_;
 };
 
 #endif  // NAND2TETRIS_VMTRANSLATOR_ADDRESSING_H_
@@ -1,5 +1,9 @@
 #include "addressing.h"
 
+#include <cstdint>
+#include <string>
+#include <utility>
+
 #include "absl/strings/str_format.h"
 #include "gtest/gtest.h"
 
@@ -16,9 +20,9 @@ TEST(DestinationTest, DestinationString) {
 }
 
 TEST(AddressingTest, ArgumentAddress) {
-  ArgumentAddress address(2);
+  ArgumentAddress address(5);
   EXPECT_EQ(address.AddressingAssembly(Destination::kA),
-            "@2\n"
+            "@5\n"
             "D=A\n"
             "@ARG\n"
             "A=D+M\n");
@@ -26,9 +30,9 @@ TEST(AddressingTest, ArgumentAddress) {
 }
 
 TEST(AddressingTest, LocalAddress) {
-  LocalAddress address(2);
+  LocalAddress address(5);
   EXPECT_EQ(address.AddressingAssembly(Destination::kA),
-            "@2\n"
+            "@5\n"
             "D=A\n"
             "@LCL\n"
             "A=D+M\n");
@@ -36,9 +40,9 @@ TEST(AddressingTest, LocalAddress) {
 }
 
 TEST(AddressingTest, ThisAddress) {
-  ThisAddress address(2);
+  ThisAddress address(5);
   EXPECT_EQ(address.AddressingAssembly(Destination::kA),
-            "@2\n"
+            "@5\n"
             "D=A\n"
             "@THIS\n"
             "A=D+M\n");
@@ -46,15 +50,52 @@ TEST(AddressingTest, ThisAddress) {
 }
 
 TEST(AddressingTest, ThatAddress) {
-  ThatAddress address(2);
+  ThatAddress address(5);
   EXPECT_EQ(address.AddressingAssembly(Destination::kA),
-            "@2\n"
+            "@5\n"
             "D=A\n"
             "@THAT\n"
             "A=D+M\n");
   EXPECT_EQ(address.value_register(), 'M');
 }
 
+TEST(AddressingTest, PointerAddressedCostModel) {
+  struct {
+    uint16_t index;
+    std::string assembly;
+    int cost;
+  } const cases[] = {
+      {0, "@LCL\nA=M\n", 2},
+      {1, "@LCL\nA=M+1\n", 2},
+      {2, "@LCL\nA=M+1\nA=A+1\n", 3},
+      {3, "@3\nD=A\n@LCL\nA=D+M\n", 4},
+      {9, "@9\nD=A\n@LCL\nA=D+M\n", 4},
+  };
+  for (const auto &c : cases) {
+    SCOPED_TRACE(c.index);
+    LocalAddress address(c.index);
+    EXPECT_EQ(address.AddressingAssembly(Destination::kA), c.assembly);
+    EXPECT_EQ(address.AddressingCost(), c.cost);
+  }
+  EXPECT_EQ(LocalAddress(0).AddressingAssembly(Destination::kD),
+            "@LCL\n"
+            "D=M\n");
+  EXPECT_EQ(LocalAddress(2).AddressingAssembly(Destination::kD),
+            "@LCL\n"
+            "A=M+1\n"
+            "D=A+1\n");
+
+  // Counting up leaves D intact at any index.
+  HackProgram program;
+  LocalAddress(3).LowerOffsetAddressing(Destination::kA, &program);
+  EXPECT_EQ(program.ToAssembly(),
+            "@LCL\n"
+            "A=M+1\n"
+            "A=A+1\n"
+            "A=A+1\n");
+  EXPECT_EQ(LocalAddress(3).OffsetCost(), 4);
+}
+
 TEST(AddressingTest, StaticAddress) {
   StaticAddress address("Foo", 2);
   EXPECT_EQ(address.AddressingAssembly(Destination::kA), "@Foo.2\n");
@@ -62,6 +103,13 @@ TEST(AddressingTest, StaticAddress) {
             "@Foo.2\n"
             "D=A\n");
   EXPECT_EQ(address.value_register(), 'M');
+  EXPECT_EQ(address.symbol(), "Foo.2");
+}
+
+TEST(AddressingTest, SymbolAddress) {
+  SymbolAddress address("$FRAME.3");
+  EXPECT_EQ(address.AddressingAssembly(Destination::kA), "@$FRAME.3\n");
+  EXPECT_EQ(address.value_register(), 'M');
 }
 
 TEST(AddressingTest, ConstantAddress) {
@@ -71,6 +119,30 @@ TEST(AddressingTest, ConstantAddress) {
             "@2\n"
             "D=A\n");
   EXPECT_EQ(address.value_register(), 'A');
+  EXPECT_EQ(address.value(), 2);
+}
+
+TEST(AddressingTest, ConstantAddressLoad) {
+  HackProgram program;
+  ConstantAddress(2).LowerLoad(&program);
+  EXPECT_EQ(program.ToAssembly(),
+            "@2\n"
+            "D=A\n");
+
+  for (auto [value, assembly] :
+       {std::pair<uint16_t, std::string>{0, "D=0\n"},
+        {1, "D=1\n"},
+        {static_cast<uint16_t>(-1), "D=-1\n"}}) {
+    HackProgram immediate;
+    ConstantAddress(value).LowerLoad(&immediate);
+    EXPECT_EQ(immediate.ToAssembly(), assembly);
+  }
+
+  HackProgram negative;
+  ConstantAddress(static_cast<uint16_t>(-3)).LowerLoad(&negative);
+  EXPECT_EQ(negative.ToAssembly(),
+            "@2\n"
+            "D=!A\n");
 }
 
 TEST(AddressingTest, PointerAddress) {
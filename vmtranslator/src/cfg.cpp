@@ -0,0 +1,346 @@
+#include "cfg.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "commands.h"
+
+bool StackEffect(const Command *command, int *pops, int *pushes) {
+  *pops = 0;
+  *pushes = 0;
+  if (dynamic_cast<const PushCommand *>(command)) {
+    *pushes = 1;
+  } else if (dynamic_cast<const PopCommand *>(command) ||
+             dynamic_cast<const IfGotoCommand *>(command)) {
+    *pops = 1;
+  } else if (dynamic_cast<const BinaryArithmeticCommand *>(command) ||
+             dynamic_cast<const BinaryComparisonCommand *>(command) ||
+             dynamic_cast<const SharedBinaryCommand *>(command) ||
+             dynamic_cast<const PokeCommand *>(command)) {
+    *pops = 2;
+    *pushes = 1;
+  } else if (dynamic_cast<const UnaryArithmeticCommand *>(command) ||
+             dynamic_cast<const ConstantArithmeticCommand *>(command) ||
+             dynamic_cast<const PeekCommand *>(command)) {
+    *pops = 1;
+    *pushes = 1;
+  } else if (dynamic_cast<const CompareJumpCommand *>(command)) {
+    *pops = 2;
+  } else if (auto *call = dynamic_cast<const CallCommand *>(command)) {
+    *pops = call->argument_count();
+    *pushes = 1;
+  } else if (auto *call = dynamic_cast<const SharedCallCommand *>(command)) {
+    *pops = call->argument_count();
+    *pushes = 1;
+  } else if (auto *call = dynamic_cast<const StaticCallCommand *>(command)) {
+    *pops = call->frame().arguments.size();
+    *pushes = 1;
+  } else if (auto *call = dynamic_cast<const TailCallCommand *>(command)) {
+    *pops = call->argument_count();
+  } else if (!dynamic_cast<const CommentCommand *>(command) &&
+             !dynamic_cast<const LabelCommand *>(command) &&
+             !dynamic_cast<const FunctionCommand *>(command) &&
+             !dynamic_cast<const StaticFunctionCommand *>(command) &&
+             !dynamic_cast<const GotoCommand *>(command) &&
+             !dynamic_cast<const LoadJumpCommand *>(command) &&
+             !dynamic_cast<const MoveCommand *>(command) &&
+             !dynamic_cast<const ReturnCommand *>(command) &&
+             !dynamic_cast<const SharedReturnCommand *>(command) &&
+             !dynamic_cast<const StaticReturnCommand *>(command)) {
+    return false;
+  }
+  return true;
+}
+
+ControlTransfer ControlTransferOf(const Command *command, std::string *label) {
+  if (auto *jump = dynamic_cast<const GotoCommand *>(command)) {
+    *label = jump->label();
+    return ControlTransfer::kJump;
+  }
+  if (auto *jump = dynamic_cast<const IfGotoCommand *>(command)) {
+    *label = jump->label();
+    return ControlTransfer::kBranch;
+  }
+  if (auto *jump = dynamic_cast<const CompareJumpCommand *>(command)) {
+    *label = jump->label();
+    return ControlTransfer::kBranch;
+  }
+  if (auto *jump = dynamic_cast<const LoadJumpCommand *>(command)) {
+    *label = jump->label();
+    return ControlTransfer::kBranch;
+  }
+  if (auto *shared = dynamic_cast<const SharedBinaryCommand *>(command);
+      shared && !shared->zero_label().empty()) {
+    *label = shared->zero_label();
+    return ControlTransfer::kBranch;
+  }
+  if (dynamic_cast<const ReturnCommand *>(command) ||
+      dynamic_cast<const SharedReturnCommand *>(command) ||
+      dynamic_cast<const StaticReturnCommand *>(command) ||
+      dynamic_cast<const TailCallCommand *>(command)) {
+    return ControlTransfer::kExit;
+  }
+  return ControlTransfer::kNone;
+}
+
+namespace {
+
+bool IsCall(const Command *command) {
+  return dynamic_cast<const CallCommand *>(command) ||
+         dynamic_cast<const SharedCallCommand *>(command) ||
+         dynamic_cast<const StaticCallCommand *>(command);
+}
+
+}  // namespace
+
+ControlFlowGraph::ControlFlowGraph(const CommandList &commands, size_t begin,
+                                   size_t end)
+    : commands_(&commands), begin_(begin), end_(end) {
+  std::string label;
+  for (size_t i = begin; i < end; ++i) {
+    const Command *command = commands[i].get();
+    auto *label_command = dynamic_cast<const LabelCommand *>(command);
+    if (blocks_.empty() || (label_command && blocks_.back().begin != i)) {
+      blocks_.push_back({i, i, {}, {}});
+    }
+    if (label_command) {
+      label_blocks_.emplace(label_command->label(), blocks_.size() - 1);
+    }
+    blocks_.back().end = i + 1;
+    if ((ControlTransferOf(command, &label) != ControlTransfer::kNone ||
+         IsCall(command)) &&
+        i + 1 < end) {
+      blocks_.push_back({i + 1, i + 1, {}, {}});
+    }
+  }
+
+  auto add_edge = [&](int from, int to) {
+    std::vector<int> &successors = blocks_[from].successors;
+    if (std::find(successors.begin(), successors.end(), to) ==
+        successors.end()) {
+      successors.push_back(to);
+      blocks_[to].predecessors.push_back(from);
+    }
+  };
+  for (int block = 0; block < static_cast<int>(blocks_.size()); ++block) {
+    const Command *last = commands[blocks_[block].end - 1].get();
+    ControlTransfer transfer = ControlTransferOf(last, &label);
+    if (transfer == ControlTransfer::kNone ||
+        transfer == ControlTransfer::kBranch) {
+      if (block + 1 < static_cast<int>(blocks_.size())) {
+        add_edge(block, block + 1);
+      }
+    }
+    if (transfer == ControlTransfer::kBranch ||
+        transfer == ControlTransfer::kJump) {
+      int target = LabelBlock(label);
+      if (target >= 0) {
+        add_edge(block, target);
+      }
+    }
+  }
+}
+
+const CommandList &ControlFlowGraph::commands() const { return *commands_; }
+
+size_t ControlFlowGraph::begin() const { return begin_; }
+
+size_t ControlFlowGraph::end() const { return end_; }
+
+const std::vector<BasicBlock> &ControlFlowGraph::blocks() const {
+  return blocks_;
+}
+
+int ControlFlowGraph::LabelBlock(std::string_view label) const {
+  auto found = label_blocks_.find(std::string(label));
+  return found == label_blocks_.end() ? -1 : found->second;
+}
+
+int ControlFlowGraph::BlockOf(size_t index) const {
+  auto found = std::upper_bound(
+      blocks_.begin(), blocks_.end(), index,
+      [](size_t index, const BasicBlock &block) { return index < block.end; });
+  return found - blocks_.begin();
+}
+
+std::vector<int> ControlFlowGraph::ReversePostorder() const {
+  std::vector<int> postorder;
+  if (blocks_.empty()) {
+    return postorder;
+  }
+  std::vector<bool> visited(blocks_.size());
+  // Blocks on the path from the entry, with the index of the next successor
+  // to visit.
+  std::vector<std::pair<int, size_t>> path = {{0, 0}};
+  visited[0] = true;
+  while (!path.empty()) {
+    auto &[block, next] = path.back();
+    if (next < blocks_[block].successors.size()) {
+      int successor = blocks_[block].successors[next++];
+      if (!visited[successor]) {
+        visited[successor] = true;
+        path.push_back({successor, 0});
+      }
+      continue;
+    }
+    postorder.push_back(block);
+    path.pop_back();
+  }
+  return std::vector<int>(postorder.rbegin(), postorder.rend());
+}
+
+std::vector<ControlFlowGraph> BuildControlFlowGraphs(
+    const CommandList &commands) {
+  std::vector<ControlFlowGraph> graphs;
+  size_t begin = 0;
+  for (size_t i = 0; i <= commands.size(); ++i) {
+    if (i == commands.size() ||
+        (i > begin && (dynamic_cast<FunctionCommand *>(commands[i].get()) ||
+                       dynamic_cast<StaticFunctionCommand *>(
+                           commands[i].get())))) {
+      if (i > begin) {
+        graphs.emplace_back(commands, begin, i);
+      }
+      begin = i;
+    }
+  }
+  return graphs;
+}
+
+namespace {
+
+// The blocks dominating the end of each block, as a set of block indices.
+class DominatorProblem {
+ public:
+  using Value = std::vector<bool>;
+
+  explicit DominatorProblem(size_t block_count) : block_count_(block_count) {}
+
+  Value Boundary() const { return Value(block_count_, false); }
+  Value Top() const { return Value(block_count_, true); }
+  Value Meet(const Value &a, const Value &b) const {
+    Value result(block_count_);
+    for (size_t i = 0; i < block_count_; ++i) {
+      result[i] = a[i] && b[i];
+    }
+    return result;
+  }
+  Value Transfer(const ControlFlowGraph &, int block, Value value) const {
+    value[block] = true;
+    return value;
+  }
+
+ private:
+  size_t block_count_;
+};
+
+}  // namespace
+
+std::vector<std::vector<bool>> Dominators(const ControlFlowGraph &graph) {
+  return SolveForward(graph, DominatorProblem(graph.blocks().size())).out;
+}
+
+std::vector<Loop> FindLoops(const ControlFlowGraph &graph) {
+  const std::vector<BasicBlock> &blocks = graph.blocks();
+  std::vector<std::vector<bool>> dominators = Dominators(graph);
+  std::vector<int> order = graph.ReversePostorder();
+  std::vector<bool> reachable(blocks.size());
+  for (int block : order) {
+    reachable[block] = true;
+  }
+  std::vector<Loop> loops;
+  std::unordered_map<int, size_t> header_loops;
+  for (int block : order) {
+    for (int header : blocks[block].successors) {
+      if (!dominators[block][header]) {
+        continue;
+      }
+      auto [found, inserted] = header_loops.emplace(header, loops.size());
+      if (inserted) {
+        loops.push_back({header, std::vector<bool>(blocks.size()), 1});
+        loops.back().blocks[header] = true;
+      }
+      Loop &loop = loops[found->second];
+      // Walks back from the end of the back edge until the header.
+      std::vector<int> pending = {block};
+      while (!pending.empty()) {
+        int member = pending.back();
+        pending.pop_back();
+        if (!reachable[member] || loop.blocks[member]) {
+          continue;
+        }
+        loop.blocks[member] = true;
+        ++loop.size;
+        pending.insert(pending.end(), blocks[member].predecessors.begin(),
+                       blocks[member].predecessors.end());
+      }
+    }
+  }
+  std::stable_sort(
+      loops.begin(), loops.end(),
+      [](const Loop &a, const Loop &b) { return a.size < b.size; });
+  return loops;
+}
+
+namespace {
+
+// The stack depth at the start of the blocks: `kUnreached` until a path is
+// found, the depth if it is the same on all paths, or `kUnknownDepth`.
+class StackDepthProblem {
+ public:
+  using Value = int;
+  static constexpr int kUnreached = -2;
+
+  Value Boundary() const { return 0; }
+  Value Top() const { return kUnreached; }
+  Value Meet(Value a, Value b) const {
+    if (a == kUnreached) {
+      return b;
+    }
+    if (b == kUnreached) {
+      return a;
+    }
+    return a == b ? a : kUnknownDepth;
+  }
+  Value Transfer(const ControlFlowGraph &graph, int block, Value depth) const {
+    const BasicBlock &basic_block = graph.blocks()[block];
+    for (size_t i = basic_block.begin; i < basic_block.end; ++i) {
+      depth = Apply(graph.commands()[i].get(), depth);
+    }
+    return depth;
+  }
+
+  // Returns the depth after `command` given the depth before it.
+  static Value Apply(const Command *command, Value depth) {
+    int pops;
+    int pushes;
+    if (depth < 0 || !StackEffect(command, &pops, &pushes) || depth < pops) {
+      return depth == kUnreached ? kUnreached : kUnknownDepth;
+    }
+    return depth - pops + pushes;
+  }
+};
+
+}  // namespace
+
+std::vector<int> StackDepths(const ControlFlowGraph &graph) {
+  DataflowResult<int> result = SolveForward(graph, StackDepthProblem());
+  std::vector<int> depths;
+  depths.reserve(graph.end() - graph.begin());
+  for (int block = 0; block < static_cast<int>(graph.blocks().size());
+       ++block) {
+    int depth = result.in[block];
+    const BasicBlock &basic_block = graph.blocks()[block];
+    for (size_t i = basic_block.begin; i < basic_block.end; ++i) {
+      depths.push_back(depth == StackDepthProblem::kUnreached ? kUnknownDepth
+                                                              : depth);
+      depth = StackDepthProblem::Apply(graph.commands()[i].get(), depth);
+    }
+  }
+  return depths;
+}
@@ -0,0 +1,202 @@
+#ifndef NAND2TETRIS_VMTRANSLATOR_CFG_H_
+#define NAND2TETRIS_VMTRANSLATOR_CFG_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "commands.h"
+
+// Stores in `pops` and `pushes` the number of values `command` pops from the
+// working stack of a function and then pushes onto it. Labels, function
+// entries, jumps and returns neither pop nor push. Returns false for commands
+// whose effect is unknown.
+bool StackEffect(const Command *command, int *pops, int *pushes);
+
+// How control leaves a command.
+enum class ControlTransfer {
+  // Continues with the next command.
+  kNone,
+  // Continues with the next command or jumps to a label.
+  kBranch,
+  // Always jumps to a label.
+  kJump,
+  // Leaves the function.
+  kExit,
+};
+
+// Returns how control leaves `command`, storing the label jumped to, if any,
+// in `label`.
+ControlTransfer ControlTransferOf(const Command *command, std::string *label);
+
+// A maximal sequence of commands that is only entered at its first command and
+// only left after its last one.
+struct BasicBlock {
+  // The commands of the block are [begin, end) of the commands the graph is
+  // built from.
+  size_t begin = 0;
+  size_t end = 0;
+  std::vector<int> successors;
+  std::vector<int> predecessors;
+};
+
+// The basic blocks of a function, or of the code before the first function,
+// with block 0 as the entry. Blocks end after jumps, calls and returns, and
+// before labels. A jump to a label outside the commands has no edge, like a
+// return. The graph refers to the commands it is built from, which must
+// outlive it.
+class ControlFlowGraph {
+ public:
+  // Builds the graph of [begin, end) of `commands`, which only contains a
+  // `function` command at `begin`, if at all.
+  ControlFlowGraph(const CommandList &commands, size_t begin, size_t end);
+
+  const CommandList &commands() const;
+  size_t begin() const;
+  size_t end() const;
+  const std::vector<BasicBlock> &blocks() const;
+
+  // The block starting with `label`, or -1 if there is none.
+  int LabelBlock(std::string_view label) const;
+  // The block containing the command at `index` of `commands()`.
+  int BlockOf(size_t index) const;
+
+  // The blocks reachable from the entry, in reverse postorder, so that every
+  // block comes before its successors except along back edges.
+  std::vector<int> ReversePostorder() const;
+
+ private:
+  const CommandList *commands_;
+  size_t begin_;
+  size_t end_;
+  std::vector<BasicBlock> blocks_;
+  std::unordered_map<std::string, int> label_blocks_;
+};
+
+// Splits `commands` at `function` commands and builds the graph of each part.
+std::vector<ControlFlowGraph> BuildControlFlowGraphs(
+    const CommandList &commands);
+
+// The result of a dataflow analysis: the values at the start and the end of
+// each block.
+template <typename Value>
+struct DataflowResult {
+  std::vector<Value> in;
+  std::vector<Value> out;
+};
+
+// Solves a dataflow problem over the blocks reachable from the entry by
+// iterating to a fixed point. `Problem` defines a lattice of `Value`s, which
+// must support `==`, and how blocks transform them:
+//
+//   using Value = ...;
+//   // The value at the start of the entry for forward problems, or at the end
+//   // of blocks without successors for backward problems.
+//   Value Boundary() const;
+//   // The value the other blocks start with, the top of the lattice.
+//   Value Top() const;
+//   // Combines the values flowing in along several edges.
+//   Value Meet(const Value &a, const Value &b) const;
+//   // The value after `block` given the value before it, in the direction of
+//   // the analysis.
+//   Value Transfer(const ControlFlowGraph &graph, int block,
+//                  const Value &value) const;
+//
+// Unreachable blocks keep `Top()`.
+template <typename Problem>
+DataflowResult<typename Problem::Value> SolveForward(
+    const ControlFlowGraph &graph, const Problem &problem);
+template <typename Problem>
+DataflowResult<typename Problem::Value> SolveBackward(
+    const ControlFlowGraph &graph, const Problem &problem);
+
+// Returns for each block whether each block dominates it, that is, is on every
+// path from the entry to it. Blocks dominate themselves, and unreachable blocks
+// are dominated by all blocks.
+std::vector<std::vector<bool>> Dominators(const ControlFlowGraph &graph);
+
+// A natural loop: the header and the blocks that reach a back edge to it, a
+// jump to the header from a block it dominates, without passing through it.
+struct Loop {
+  int header = 0;
+  // Whether each block of the graph is part of the loop, including the header.
+  std::vector<bool> blocks;
+  int size = 0;
+};
+
+// Returns the natural loops of `graph`, with the loops of back edges to the
+// same header merged, ordered by size so that inner loops come before the
+// loops containing them.
+std::vector<Loop> FindLoops(const ControlFlowGraph &graph);
+
+// Returned by `StackDepths()` for commands whose stack depth is not the same
+// on every path, depends on a command of unknown effect, or which are
+// unreachable.
+constexpr int kUnknownDepth = -1;
+
+// Returns the number of values on the working stack of the function before
+// each command of [begin, end) of `graph.commands()`, computed by a forward
+// analysis. Popping more values than the function pushed also makes the depth
+// unknown.
+std::vector<int> StackDepths(const ControlFlowGraph &graph);
+
+// Implementation details.
+
+namespace cfg_internal {
+
+template <typename Problem, bool kForward>
+DataflowResult<typename Problem::Value> Solve(const ControlFlowGraph &graph,
+                                              const Problem &problem) {
+  using Value = typename Problem::Value;
+  const std::vector<BasicBlock> &blocks = graph.blocks();
+  DataflowResult<Value> result{
+      std::vector<Value>(blocks.size(), problem.Top()),
+      std::vector<Value>(blocks.size(), problem.Top())};
+  std::vector<int> order = graph.ReversePostorder();
+  if (!kForward) {
+    std::reverse(order.begin(), order.end());
+  }
+  // Values flow from `source` to `sink` of each block.
+  std::vector<Value> &source = kForward ? result.in : result.out;
+  std::vector<Value> &sink = kForward ? result.out : result.in;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int block : order) {
+      const std::vector<int> &edges =
+          kForward ? blocks[block].predecessors : blocks[block].successors;
+      bool boundary = kForward ? block == 0 : edges.empty();
+      Value value = boundary ? problem.Boundary() : problem.Top();
+      for (int other : edges) {
+        value = problem.Meet(value, sink[other]);
+      }
+      Value transferred = problem.Transfer(graph, block, value);
+      source[block] = std::move(value);
+      if (!(transferred == sink[block])) {
+        sink[block] = std::move(transferred);
+        changed = true;
+      }
+    }
+  }
+  return result;
+}
+
+}  // namespace cfg_internal
+
+template <typename Problem>
+DataflowResult<typename Problem::Value> SolveForward(
+    const ControlFlowGraph &graph, const Problem &problem) {
+  return cfg_internal::Solve<Problem, /*kForward=*/true>(graph, problem);
+}
+
+template <typename Problem>
+DataflowResult<typename Problem::Value> SolveBackward(
+    const ControlFlowGraph &graph, const Problem &problem) {
+  return cfg_internal::Solve<Problem, /*kForward=*/false>(graph, problem);
+}
+
+#endif  // NAND2TETRIS_VMTRANSLATOR_CFG_H_
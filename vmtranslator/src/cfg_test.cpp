@@ -0,0 +1,212 @@
+#include "cfg.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "addressing.h"
+#include "commands.h"
+#include "parser.h"
+
+namespace {
+
+CommandList Parse(VmFile vm_file) {
+  CommandList commands;
+  while (vm_file.command()) {
+    commands.push_back(vm_file.TakeCommand());
+    vm_file.Advance();
+  }
+  return commands;
+}
+
+CommandList ParseTestProgram(std::string_view path) {
+  return Parse(VmFile(std::string(TEST_PROGRAMS_DIR) + std::string(path)));
+}
+
+CommandList ParseSource(std::string_view source) {
+  return Parse(VmFile("Foo.vm", VmSegment{source, 0}));
+}
+
+// The index of the first label command for `label`.
+size_t LabelIndex(const CommandList &commands, std::string_view label) {
+  for (size_t i = 0; i < commands.size(); ++i) {
+    auto *command = dynamic_cast<const LabelCommand *>(commands[i].get());
+    if (command && command->label() == label) {
+      return i;
+    }
+  }
+  return commands.size();
+}
+
+// The locals read before they are written again, as a bit set.
+class LiveLocalsProblem {
+ public:
+  using Value = uint32_t;
+
+  Value Boundary() const { return 0; }
+  Value Top() const { return 0; }
+  Value Meet(Value a, Value b) const { return a | b; }
+  Value Transfer(const ControlFlowGraph &graph, int block, Value live) const {
+    const BasicBlock &basic_block = graph.blocks()[block];
+    for (size_t i = basic_block.end; i-- > basic_block.begin;) {
+      const Command *command = graph.commands()[i].get();
+      if (auto *pop = dynamic_cast<const PopCommand *>(command)) {
+        if (auto *local = dynamic_cast<const LocalAddress *>(&pop->address())) {
+          live &= ~(1u << local->index());
+        }
+      } else if (auto *push = dynamic_cast<const PushCommand *>(command)) {
+        if (auto *local =
+                dynamic_cast<const LocalAddress *>(&push->address())) {
+          live |= 1u << local->index();
+        }
+      }
+    }
+    return live;
+  }
+};
+
+}  // namespace
+
+TEST(ControlFlowGraphTest, BasicLoop) {
+  CommandList commands =
+      ParseTestProgram("ProgramFlow/BasicLoop/BasicLoop.vm");
+  std::vector<ControlFlowGraph> graphs = BuildControlFlowGraphs(commands);
+  ASSERT_EQ(graphs.size(), 1);
+  const ControlFlowGraph &graph = graphs[0];
+
+  // The initialization, the loop ending with `if-goto LOOP`, and the result.
+  const std::vector<BasicBlock> &blocks = graph.blocks();
+  ASSERT_EQ(blocks.size(), 3);
+  size_t loop = LabelIndex(commands, "BasicLoop.GLOBAL$LOOP");
+  EXPECT_EQ(blocks[1].begin, loop);
+  EXPECT_EQ(graph.LabelBlock("BasicLoop.GLOBAL$LOOP"), 1);
+  EXPECT_EQ(blocks[0].successors, std::vector<int>{1});
+  EXPECT_EQ(blocks[1].successors, (std::vector<int>{2, 1}));
+  EXPECT_EQ(blocks[1].predecessors, (std::vector<int>{0, 1}));
+  EXPECT_TRUE(blocks[2].successors.empty());
+  EXPECT_EQ(graph.BlockOf(blocks[2].begin), 2);
+  EXPECT_EQ(graph.ReversePostorder(), (std::vector<int>{0, 1, 2}));
+
+  std::vector<int> depths = StackDepths(graph);
+  ASSERT_EQ(depths.size(), commands.size());
+  EXPECT_EQ(depths[loop], 0);
+  // Before `if-goto LOOP`, which pops the condition.
+  EXPECT_EQ(depths[blocks[1].end - 1], 1);
+  EXPECT_EQ(depths[blocks[2].begin], 0);
+}
+
+TEST(ControlFlowGraphTest, FibonacciSeries) {
+  CommandList commands =
+      ParseTestProgram("ProgramFlow/FibonacciSeries/FibonacciSeries.vm");
+  std::vector<ControlFlowGraph> graphs = BuildControlFlowGraphs(commands);
+  ASSERT_EQ(graphs.size(), 1);
+  const ControlFlowGraph &graph = graphs[0];
+
+  int loop = graph.LabelBlock("FibonacciSeries.GLOBAL$LOOP");
+  int compute = graph.LabelBlock("FibonacciSeries.GLOBAL$COMPUTE_ELEMENT");
+  int end = graph.LabelBlock("FibonacciSeries.GLOBAL$END");
+  ASSERT_GE(loop, 0);
+  ASSERT_GE(compute, 0);
+  ASSERT_GE(end, 0);
+  // `if-goto COMPUTE_ELEMENT` falls through to `goto END`.
+  EXPECT_EQ(graph.blocks()[loop].successors,
+            (std::vector<int>{loop + 1, compute}));
+  EXPECT_EQ(graph.blocks()[loop + 1].successors, std::vector<int>{end});
+  EXPECT_EQ(graph.blocks()[compute].successors, std::vector<int>{loop});
+
+  std::vector<int> depths = StackDepths(graph);
+  for (int block : {loop, compute, end}) {
+    EXPECT_EQ(depths[graph.blocks()[block].begin], 0);
+  }
+  for (int depth : depths) {
+    EXPECT_GE(depth, 0);
+  }
+}
+
+TEST(ControlFlowGraphTest, SplitsFunctionsAndCalls) {
+  CommandList commands = ParseSource(
+      "function Foo.f 0\n"
+      "  push constant 1\n"
+      "  call Foo.g 1\n"
+      "  push constant 2\n"
+      "  return\n"
+      "  push constant 3\n"
+      "function Foo.g 0\n"
+      "  push argument 0\n"
+      "  if-goto ONE\n"
+      "  push constant 1\n"
+      "label ONE\n"
+      "  return\n");
+  std::vector<ControlFlowGraph> graphs = BuildControlFlowGraphs(commands);
+  ASSERT_EQ(graphs.size(), 2);
+  EXPECT_EQ(graphs[0].begin(), 0);
+  EXPECT_EQ(graphs[0].end(), 6);
+  EXPECT_EQ(graphs[1].begin(), 6);
+
+  // The call ends a block, and nothing reaches the code after `return`.
+  const std::vector<BasicBlock> &blocks = graphs[0].blocks();
+  ASSERT_EQ(blocks.size(), 3);
+  EXPECT_EQ(blocks[0].end, 3);
+  EXPECT_EQ(blocks[0].successors, std::vector<int>{1});
+  EXPECT_TRUE(blocks[1].successors.empty());
+  EXPECT_TRUE(blocks[2].predecessors.empty());
+  EXPECT_EQ(graphs[0].ReversePostorder(), (std::vector<int>{0, 1}));
+  EXPECT_EQ(StackDepths(graphs[0]),
+            (std::vector<int>{0, 0, 1, 1, 2, kUnknownDepth}));
+
+  // `ONE` is reached with 0 or 1 values on the stack.
+  std::vector<int> depths = StackDepths(graphs[1]);
+  EXPECT_EQ(depths, (std::vector<int>{0, 0, 1, 0, kUnknownDepth,
+                                      kUnknownDepth}));
+}
+
+TEST(ControlFlowGraphTest, NestedLoops) {
+  CommandList commands = ParseSource(
+      "function Foo.f 0\n"
+      "label OUTER\n"
+      "  push argument 0\n"
+      "  if-goto END\n"
+      "label INNER\n"
+      "  push argument 1\n"
+      "  if-goto INNER\n"
+      "  goto OUTER\n"
+      "label END\n"
+      "  push constant 0\n"
+      "  return\n");
+  ControlFlowGraph graph(commands, 0, commands.size());
+  ASSERT_EQ(graph.blocks().size(), 5);
+
+  std::vector<std::vector<bool>> dominators = Dominators(graph);
+  EXPECT_EQ(dominators[3], (std::vector<bool>{true, true, true, true, false}));
+  EXPECT_EQ(dominators[4], (std::vector<bool>{true, true, false, false, true}));
+
+  // The inner loop comes first.
+  std::vector<Loop> loops = FindLoops(graph);
+  ASSERT_EQ(loops.size(), 2);
+  EXPECT_EQ(loops[0].header, 2);
+  EXPECT_EQ(loops[0].size, 1);
+  EXPECT_EQ(loops[0].blocks,
+            (std::vector<bool>{false, false, true, false, false}));
+  EXPECT_EQ(loops[1].header, 1);
+  EXPECT_EQ(loops[1].size, 3);
+  EXPECT_EQ(loops[1].blocks,
+            (std::vector<bool>{false, true, true, true, false}));
+}
+
+TEST(DataflowTest, LiveLocalsInBasicLoop) {
+  CommandList commands =
+      ParseTestProgram("ProgramFlow/BasicLoop/BasicLoop.vm");
+  ControlFlowGraph graph(commands, 0, commands.size());
+  DataflowResult<uint32_t> live = SolveBackward(graph, LiveLocalsProblem());
+  // `pop local 0` before the loop kills the value the loop and the result
+  // read.
+  EXPECT_EQ(live.in[0], 0);
+  EXPECT_EQ(live.out[0], 1);
+  EXPECT_EQ(live.in[1], 1);
+  EXPECT_EQ(live.out[1], 1);
+  EXPECT_EQ(live.in[2], 1);
+  EXPECT_EQ(live.out[2], 0);
+}
@@ -0,0 +1,727 @@
+// Generated by the superoptimizer from the semantics of each VM command.
+// Do not edit; run `superoptimizer --output=src/command_templates.cpp`
+// instead.
+
+#include "command_templates.h"
+
+#include <vector>
+
+#include "hack.h"
+
+const std::vector<CommandTemplate> &CommandTemplates() {
+  static const auto *templates = new std::vector<CommandTemplate>{
+      // add: @SP AM=M-1 D=M A=A-1 M=D+M
+      {"add", "", IndexClass::kNone,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kAMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kM},
+       }},
+      // sub: @SP AM=M-1 D=M A=A-1 M=M-D
+      {"sub", "", IndexClass::kNone,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kAMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusD,
+            Destination::kM},
+       }},
+      // and: @SP AM=M-1 D=M A=A-1 M=D&M
+      {"and", "", IndexClass::kNone,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kAMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kDAndM,
+            Destination::kM},
+       }},
+      // or: @SP AM=M-1 D=M A=A-1 M=D|M
+      {"or", "", IndexClass::kNone,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kAMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kDOrM,
+            Destination::kM},
+       }},
+      // neg: @SP A=M-1 M=-M
+      {"neg", "", IndexClass::kNone,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kNegM,
+            Destination::kM},
+       }},
+      // not: @SP A=M-1 M=!M
+      {"not", "", IndexClass::kNone,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kNotM,
+            Destination::kM},
+       }},
+      // push constant 0: @SP A=M AM=0 M=M+1
+      {"push", "constant", IndexClass::kZero,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kZero,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+       }},
+      // push constant 1: @SP M=M+1 A=M-1 M=1
+      {"push", "constant", IndexClass::kOne,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kOne,
+            Destination::kM},
+       }},
+      // push constant n: @n D=A @SP M=M+1 A=M-1 M=D
+      {"push", "constant", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kA,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push local 0: @LCL A=M D=M @SP M=M+1 A=M-1 M=D
+      {"push", "local", IndexClass::kZero,
+       {
+           {TemplateInstruction::kRegister, "LCL", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push local 1: @LCL A=M+1 D=M @SP M=M+1 A=M-1 M=D
+      {"push", "local", IndexClass::kOne,
+       {
+           {TemplateInstruction::kRegister, "LCL", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push local 2: @LCL D=M+1 A=D+1 D=M @SP M=M+1 A=M-1 M=D
+      {"push", "local", IndexClass::kTwo,
+       {
+           {TemplateInstruction::kRegister, "LCL", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push local n: @n D=A @LCL A=D+M D=M @SP M=M+1 A=M-1 M=D
+      {"push", "local", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kA,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "LCL", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop local 0: @SP AM=M-1 D=M @LCL A=M M=D
+      {"pop", "local", IndexClass::kZero,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "LCL", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop local 1: @SP AM=M-1 D=M @LCL A=M+1 M=D
+      {"pop", "local", IndexClass::kOne,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "LCL", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop local 2: @SP AM=M-1 D=M @LCL A=M+1 A=A+1 M=D
+      {"pop", "local", IndexClass::kTwo,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "LCL", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kAPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop local n: @n D=A @LCL D=D+M @SP AM=M-1 D=D+M A=D-M M=D-A
+      {"pop", "local", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kA,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "LCL", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kDMinusM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kDMinusA,
+            Destination::kM},
+       }},
+      // push argument 0: @ARG A=M D=M @SP M=M+1 A=M-1 M=D
+      {"push", "argument", IndexClass::kZero,
+       {
+           {TemplateInstruction::kRegister, "ARG", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push argument 1: @ARG A=M+1 D=M @SP M=M+1 A=M-1 M=D
+      {"push", "argument", IndexClass::kOne,
+       {
+           {TemplateInstruction::kRegister, "ARG", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push argument 2: @ARG D=M+1 A=D+1 D=M @SP M=M+1 A=M-1 M=D
+      {"push", "argument", IndexClass::kTwo,
+       {
+           {TemplateInstruction::kRegister, "ARG", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push argument n: @n D=A @ARG A=D+M D=M @SP M=M+1 A=M-1 M=D
+      {"push", "argument", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kA,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "ARG", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop argument 0: @SP AM=M-1 D=M @ARG A=M M=D
+      {"pop", "argument", IndexClass::kZero,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "ARG", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop argument 1: @SP AM=M-1 D=M @ARG A=M+1 M=D
+      {"pop", "argument", IndexClass::kOne,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "ARG", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop argument 2: @SP AM=M-1 D=M @ARG A=M+1 A=A+1 M=D
+      {"pop", "argument", IndexClass::kTwo,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "ARG", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kAPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop argument n: @n D=A @ARG D=D+M @SP AM=M-1 D=D+M A=D-M M=D-A
+      {"pop", "argument", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kA,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "ARG", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kDMinusM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kDMinusA,
+            Destination::kM},
+       }},
+      // push this 0: @THIS A=M D=M @SP M=M+1 A=M-1 M=D
+      {"push", "this", IndexClass::kZero,
+       {
+           {TemplateInstruction::kRegister, "THIS", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push this 1: @THIS A=M+1 D=M @SP M=M+1 A=M-1 M=D
+      {"push", "this", IndexClass::kOne,
+       {
+           {TemplateInstruction::kRegister, "THIS", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push this 2: @THIS D=M+1 A=D+1 D=M @SP M=M+1 A=M-1 M=D
+      {"push", "this", IndexClass::kTwo,
+       {
+           {TemplateInstruction::kRegister, "THIS", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push this n: @n D=A @THIS A=D+M D=M @SP M=M+1 A=M-1 M=D
+      {"push", "this", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kA,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THIS", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop this 0: @SP AM=M-1 D=M @THIS A=M M=D
+      {"pop", "this", IndexClass::kZero,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THIS", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop this 1: @SP AM=M-1 D=M @THIS A=M+1 M=D
+      {"pop", "this", IndexClass::kOne,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THIS", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop this 2: @SP AM=M-1 D=M @THIS A=M+1 A=A+1 M=D
+      {"pop", "this", IndexClass::kTwo,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THIS", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kAPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop this n: @n D=A @THIS D=D+M @SP AM=M-1 D=D+M A=D-M M=D-A
+      {"pop", "this", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kA,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THIS", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kDMinusM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kDMinusA,
+            Destination::kM},
+       }},
+      // push that 0: @THAT A=M D=M @SP M=M+1 A=M-1 M=D
+      {"push", "that", IndexClass::kZero,
+       {
+           {TemplateInstruction::kRegister, "THAT", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push that 1: @THAT A=M+1 D=M @SP M=M+1 A=M-1 M=D
+      {"push", "that", IndexClass::kOne,
+       {
+           {TemplateInstruction::kRegister, "THAT", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push that 2: @THAT D=M+1 A=D+1 D=M @SP M=M+1 A=M-1 M=D
+      {"push", "that", IndexClass::kTwo,
+       {
+           {TemplateInstruction::kRegister, "THAT", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push that n: @n D=A @THAT A=D+M D=M @SP M=M+1 A=M-1 M=D
+      {"push", "that", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kA,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THAT", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop that 0: @SP AM=M-1 D=M @THAT A=M M=D
+      {"pop", "that", IndexClass::kZero,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THAT", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop that 1: @SP AM=M-1 D=M @THAT A=M+1 M=D
+      {"pop", "that", IndexClass::kOne,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THAT", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop that 2: @SP AM=M-1 D=M @THAT A=M+1 A=A+1 M=D
+      {"pop", "that", IndexClass::kTwo,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THAT", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kAPlusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop that n: @n D=A @THAT D=D+M @SP AM=M-1 D=D+M A=D-M M=D-A
+      {"pop", "that", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kA,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "THAT", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kDPlusM,
+            Destination::kD},
+           {TemplateInstruction::kCompute, {}, Computation::kDMinusM,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kDMinusA,
+            Destination::kM},
+       }},
+      // push static n: @n D=M @SP M=M+1 A=M-1 M=D
+      {"push", "static", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop static n: @SP AM=M-1 D=M @n M=D
+      {"pop", "static", IndexClass::kAny,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push temp n: @n D=M @SP M=M+1 A=M-1 M=D
+      {"push", "temp", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop temp n: @SP AM=M-1 D=M @n M=D
+      {"pop", "temp", IndexClass::kAny,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // push pointer n: @n D=M @SP M=M+1 A=M-1 M=D
+      {"push", "pointer", IndexClass::kAny,
+       {
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMPlusOne,
+            Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+      // pop pointer n: @SP AM=M-1 D=M @n M=D
+      {"pop", "pointer", IndexClass::kAny,
+       {
+           {TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kMMinusOne,
+            Destination::kA | Destination::kM},
+           {TemplateInstruction::kCompute, {}, Computation::kM,
+            Destination::kD},
+           {TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           {TemplateInstruction::kCompute, {}, Computation::kD,
+            Destination::kM},
+       }},
+  };
+  return *templates;
+}
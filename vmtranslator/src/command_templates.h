@@ -0,0 +1,55 @@
+#ifndef NAND2TETRIS_VMTRANSLATOR_COMMAND_TEMPLATES_H_
+#define NAND2TETRIS_VMTRANSLATOR_COMMAND_TEMPLATES_H_
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "hack.h"
+
+// The indexes a template applies to. Small indexes of pointer-addressed
+// segments can be reached by counting up from the pointer, and constants 0 and
+// 1 are produced by a single computation, so they have templates of their own.
+enum class IndexClass : uint8_t {
+  // Commands without an index, such as `add`.
+  kNone,
+  kZero,
+  kOne,
+  kTwo,
+  // Any index without a template of its own, which is the parameter.
+  kAny,
+};
+
+// An instruction of a template.
+struct TemplateInstruction {
+  enum Kind : uint8_t {
+    kRegister,   // @symbol, where the symbol is SP, LCL, ARG, THIS or THAT
+    kParameter,  // @parameter
+    kCompute,    // dest=comp
+  };
+
+  Kind kind;
+  // Empty unless `kind` is `kRegister`.
+  std::string_view symbol;
+  // `Computation::kZero` and 0 unless `kind` is `kCompute`.
+  Computation computation;
+  uint8_t destination;  // Bitmask of `Destination`.
+};
+
+// The instructions lowering a VM command with a memory segment and index class
+// when the stack is not cached, leaving A and D undefined. The parameter is
+// the constant of `constant`, the index of pointer-addressed segments and the
+// address of `static`, `temp` and `pointer`.
+struct CommandTemplate {
+  std::string_view command;
+  // Empty for arithmetic commands.
+  std::string_view segment;
+  IndexClass index_class;
+  std::vector<TemplateInstruction> instructions;
+};
+
+// The templates found by the superoptimizer, in `command_templates.cpp`, which
+// it generates.
+const std::vector<CommandTemplate> &CommandTemplates();
+
+#endif  // NAND2TETRIS_VMTRANSLATOR_COMMAND_TEMPLATES_H_
@@ -1,275 +1,1535 @@
 #include "commands.h"
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <set>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
 
 #include "addressing.h"
+#include "command_templates.h"
+#include "hack.h"
+
+namespace {
+
+// Whether commands are lowered by `Command::InstructionCount()` on this thread,
+// so that `SharedRoutines` must not record their calls.
+thread_local bool measuring = false;
+
+}  // namespace
+
+std::string Command::ToAssembly() const {
+  HackProgram program;
+  Lower(&program);
+  return program.ToAssembly();
+}
+
+size_t Command::InstructionCount() const {
+  HackProgram program;
+  measuring = true;
+  Lower(&program);
+  measuring = false;
+  return program.InstructionCount();
+}
+
+void Command::LowerCached(StackState *stack, HackProgram *program) const {
+  LowerFlush(stack, program);
+  Lower(program);
+}
 
 std::ostream &operator<<(std::ostream &os, const Command &command) {
   return os << command.ToAssembly();
 }
 
-BinaryArithmeticCommand::BinaryArithmeticCommand(std::string_view write_command)
-    : write_command_(write_command) {}
-
-std::string BinaryArithmeticCommand::ToAssembly() const {
-  return absl::StrFormat(
-      "@SP\n"
-      "AM=M-1\n"
-      "D=M\n"
-      "A=A-1\n"
-      "%s\n",
-      write_command_);
-}
-
-AddCommand::AddCommand() : BinaryArithmeticCommand("M=D+M") {}
-SubCommand::SubCommand() : BinaryArithmeticCommand("M=M-D") {}
-AndCommand::AndCommand() : BinaryArithmeticCommand("M=D&M") {}
-OrCommand::OrCommand() : BinaryArithmeticCommand("M=D|M") {}
-
-UnaryArithmeticCommand::UnaryArithmeticCommand(std::string_view write_command)
-    : write_command_(write_command) {}
-
-std::string UnaryArithmeticCommand::ToAssembly() const {
-  return absl::StrFormat(
-      "@SP\n"
-      "A=M-1\n"
-      "%s\n",
-      write_command_);
-}
-
-NegCommand::NegCommand() : UnaryArithmeticCommand("M=-M") {}
-NotCommand::NotCommand() : UnaryArithmeticCommand("M=!M") {}
-
-std::string BinaryComparisonCommand::ToAssembly() const {
-  return absl::StrFormat(
-      "@SP\n"
-      "AM=M-1\n"
-      "D=M\n"
-      "A=A-1\n"
-      "D=M-D\n"
-      "@%s\n"
-      "D;%s\n"
-      "@SP\n"
-      "A=M-1\n"
-      "M=-1\n"
-      "@%s\n"
-      "0;JMP\n"
-      "(%s)\n"
-      "@SP\n"
-      "A=M-1\n"
-      "M=0\n"
-      "(%s)\n",
-      else_label_, jump_condition_, end_label_, else_label_, end_label_);
-}
-
-BinaryComparisonCommand::BinaryComparisonCommand(
-    std::string_view jump_condition, std::string_view else_label,
-    std::string_view end_label)
+namespace {
+
+using TemplateKey = std::tuple<std::string_view, std::string_view, IndexClass>;
+
+IndexClass IndexClassOf(uint16_t index) {
+  switch (index) {
+    case 0:
+      return IndexClass::kZero;
+    case 1:
+      return IndexClass::kOne;
+    case 2:
+      return IndexClass::kTwo;
+    default:
+      return IndexClass::kAny;
+  }
+}
+
+// Returns the template for `command` on `address`, which is null for
+// arithmetic commands, or nullptr if there is none.
+const CommandTemplate *FindTemplate(std::string_view command,
+                                    const Address *address) {
+  static const auto *templates = [] {
+    auto *templates =
+        new absl::flat_hash_map<TemplateKey, const CommandTemplate *>();
+    for (const CommandTemplate &command_template : CommandTemplates()) {
+      templates->emplace(TemplateKey(command_template.command,
+                                     command_template.segment,
+                                     command_template.index_class),
+                         &command_template);
+    }
+    return templates;
+  }();
+  if (!address) {
+    auto found = templates->find(TemplateKey(command, "", IndexClass::kNone));
+    return found != templates->end() ? found->second : nullptr;
+  }
+  IndexClass index_class = IndexClass::kAny;
+  if (auto *pointer_addressed =
+          dynamic_cast<const PointerAddressedAddress *>(address)) {
+    index_class = IndexClassOf(pointer_addressed->index());
+  } else if (auto *constant = dynamic_cast<const ConstantAddress *>(address)) {
+    if (constant->value() >= 1 << 15) {
+      return nullptr;
+    }
+    index_class = IndexClassOf(constant->value());
+  }
+  auto found =
+      templates->find(TemplateKey(command, address->segment(), index_class));
+  if (found == templates->end()) {
+    found = templates->find(
+        TemplateKey(command, address->segment(), IndexClass::kAny));
+  }
+  return found != templates->end() ? found->second : nullptr;
+}
+
+// Appends the instructions of `command_template`, with the index or address of
+// `address` as the parameter.
+void LowerTemplate(const CommandTemplate &command_template,
+                   const Address *address, HackProgram *program) {
+  for (const TemplateInstruction &instruction :
+       command_template.instructions) {
+    switch (instruction.kind) {
+      case TemplateInstruction::kRegister:
+        program->AppendAddress(instruction.symbol);
+        break;
+      case TemplateInstruction::kParameter:
+        if (auto *pointer_addressed =
+                dynamic_cast<const PointerAddressedAddress *>(address)) {
+          program->AppendAddress(pointer_addressed->index());
+        } else {
+          address->LowerAddressing(Destination::kA, program);
+        }
+        break;
+      case TemplateInstruction::kCompute:
+        program->AppendCompute(instruction.destination,
+                               instruction.computation);
+        break;
+    }
+  }
+}
+
+// Appends the template for the arithmetic `command`, if any, and returns
+// whether there is one.
+bool LowerArithmeticTemplate(std::string_view command, HackProgram *program) {
+  const CommandTemplate *command_template = FindTemplate(command, nullptr);
+  if (!command_template) {
+    return false;
+  }
+  LowerTemplate(*command_template, nullptr, program);
+  return true;
+}
+
+// Appends instructions storing the address in SP plus `slot`, which is -1, 0
+// or 1, in A.
+void LowerSlotAddress(int slot, HackProgram *program) {
+  program->AppendAddress("SP");
+  if (slot < 0) {
+    program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+  } else if (slot > 0) {
+    program->AppendCompute(Destination::kA, Computation::kMPlusOne);
+  } else {
+    program->AppendCompute(Destination::kA, Computation::kM);
+  }
+}
+
+// Appends instructions writing the top of the stack from D to RAM and adding
+// the offset of `stack` to SP, which is as cheap as a plain spill when the
+// offset is 0.
+void LowerSpillAndSync(StackState *stack, HackProgram *program) {
+  program->AppendAddress("SP");
+  for (; stack->offset >= 0; --stack->offset) {
+    program->AppendCompute(Destination::kM, Computation::kMPlusOne);
+  }
+  program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+  program->AppendCompute(Destination::kM, Computation::kD);
+  stack->offset = 0;
+  stack->top_in_d = false;
+}
+
+// Appends instructions writing the top of the stack from D to RAM. The first
+// two values are stored above SP without updating it.
+void LowerSpill(StackState *stack, HackProgram *program) {
+  if (stack->offset > 1) {
+    LowerSpillAndSync(stack, program);
+    return;
+  }
+  LowerSlotAddress(stack->offset, program);
+  program->AppendCompute(Destination::kM, Computation::kD);
+  ++stack->offset;
+  stack->top_in_d = false;
+}
+
+// Appends instructions adding the offset of `stack` to SP. D is left intact.
+void LowerSync(StackState *stack, HackProgram *program) {
+  if (stack->offset == 0) {
+    return;
+  }
+  program->AppendAddress("SP");
+  for (; stack->offset > 0; --stack->offset) {
+    program->AppendCompute(Destination::kM, Computation::kMPlusOne);
+  }
+}
+
+// Appends instructions popping the value on the top of the stack in RAM,
+// leaving its address in A.
+void LowerPopSlot(StackState *stack, HackProgram *program) {
+  if (stack->offset > 0) {
+    --stack->offset;
+    LowerSlotAddress(stack->offset, program);
+    return;
+  }
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA | Destination::kM,
+                         Computation::kMMinusOne);
+}
+
+// Appends instructions storing the address of the value on the top of the
+// stack in RAM in A.
+void LowerTopSlot(StackState *stack, HackProgram *program) {
+  LowerSlotAddress(stack->offset - 1, program);
+}
+
+// Appends instructions popping the value on the top of the stack into the
+// pointer-addressed `destination`. Of counting up to its address, which keeps
+// the value in D, and computing the address in D and exchanging it with the
+// value through their sum (`D=D+M`, `A=D-M`, `M=D-A`), the one with fewer
+// instructions is chosen. Neither needs R15.
+void LowerPopPointerAddressed(const PointerAddressedAddress &destination,
+                              StackState *stack, HackProgram *program) {
+  int offset_cost = destination.OffsetCost();
+  int sum_cost = destination.AddressingCost();
+  if (stack->top_in_d) {
+    stack->top_in_d = false;
+    // `M=D`, or `@R13`, `M=D` and `@R13` with the exchange.
+    if (offset_cost + 1 <= sum_cost + 6) {
+      destination.LowerOffsetAddressing(Destination::kA, program);
+      program->AppendCompute(Destination::kM, Computation::kD);
+      return;
+    }
+    program->AppendAddress("R13");
+    program->AppendCompute(Destination::kM, Computation::kD);
+    destination.LowerAddressing(Destination::kD, program);
+    program->AppendAddress("R13");
+  } else {
+    // `D=M` and `M=D`, or the exchange, besides popping the slot.
+    if (offset_cost + 2 <= sum_cost + 3) {
+      LowerPopSlot(stack, program);
+      program->AppendCompute(Destination::kD, Computation::kM);
+      destination.LowerOffsetAddressing(Destination::kA, program);
+      program->AppendCompute(Destination::kM, Computation::kD);
+      return;
+    }
+    destination.LowerAddressing(Destination::kD, program);
+    LowerPopSlot(stack, program);
+  }
+  program->AppendCompute(Destination::kD, Computation::kDPlusM);
+  program->AppendCompute(Destination::kA, Computation::kDMinusM);
+  program->AppendCompute(Destination::kM, Computation::kDMinusA);
+}
+
+}  // namespace
+
+void LowerFlush(StackState *stack, HackProgram *program) {
+  if (stack->top_in_d) {
+    LowerSpillAndSync(stack, program);
+  } else {
+    LowerSync(stack, program);
+  }
+}
+
+void LowerCommands(const CommandList &commands, bool cache_stack,
+                   HackProgram *program) {
+  if (!cache_stack) {
+    for (const std::unique_ptr<Command> &command : commands) {
+      command->Lower(program);
+    }
+    return;
+  }
+  StackState stack;
+  for (const std::unique_ptr<Command> &command : commands) {
+    command->LowerCached(&stack, program);
+  }
+  LowerFlush(&stack, program);
+}
+
+namespace {
+
+// Stores in `on_d` the computation applying `computation`, which only reads M,
+// to D instead. Returns false if there is no such computation.
+bool ComputationOnD(Computation computation, Computation *on_d) {
+  switch (computation) {
+    case Computation::kZero:
+    case Computation::kOne:
+    case Computation::kMinusOne:
+      *on_d = computation;
+      return true;
+    case Computation::kM:
+      *on_d = Computation::kD;
+      return true;
+    case Computation::kNotM:
+      *on_d = Computation::kNotD;
+      return true;
+    case Computation::kNegM:
+      *on_d = Computation::kNegD;
+      return true;
+    case Computation::kMPlusOne:
+      *on_d = Computation::kDPlusOne;
+      return true;
+    case Computation::kMMinusOne:
+      *on_d = Computation::kDMinusOne;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Stores in `on_constant` the computation applying `computation`, which reads
+// the top of the stack from D and the second operand from M, to the second
+// operand in D and a constant in A. Returns false if there is no such
+// computation.
+bool ComputationOnConstant(Computation computation, Computation *on_constant) {
+  switch (computation) {
+    case Computation::kDPlusM:
+      *on_constant = Computation::kDPlusA;
+      return true;
+    case Computation::kMMinusD:
+      *on_constant = Computation::kDMinusA;
+      return true;
+    case Computation::kDAndM:
+      *on_constant = Computation::kDAndA;
+      return true;
+    case Computation::kDOrM:
+      *on_constant = Computation::kDOrA;
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+BinaryArithmeticCommand::BinaryArithmeticCommand(
+    Computation write_computation, std::string_view command)
+    : write_computation_(write_computation), command_(command) {}
+
+void BinaryArithmeticCommand::Lower(HackProgram *program) const {
+  if (LowerArithmeticTemplate(command_, program)) {
+    return;
+  }
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA | Destination::kM,
+                         Computation::kMMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kA, Computation::kAMinusOne);
+  program->AppendCompute(Destination::kM, write_computation_);
+}
+
+void BinaryArithmeticCommand::LowerCached(StackState *stack,
+                                          HackProgram *program) const {
+  if (!stack->top_in_d) {
+    LowerPopSlot(stack, program);
+    program->AppendCompute(Destination::kD, Computation::kM);
+  }
+  LowerPopSlot(stack, program);
+  program->AppendCompute(Destination::kD, write_computation_);
+  stack->top_in_d = true;
+}
+
+Computation BinaryArithmeticCommand::write_computation() const {
+  return write_computation_;
+}
+
+std::string_view BinaryArithmeticCommand::command() const {
+  return command_;
+}
+
+AddCommand::AddCommand()
+    : BinaryArithmeticCommand(Computation::kDPlusM, "add") {}
+SubCommand::SubCommand()
+    : BinaryArithmeticCommand(Computation::kMMinusD, "sub") {}
+AndCommand::AndCommand()
+    : BinaryArithmeticCommand(Computation::kDAndM, "and") {}
+OrCommand::OrCommand() : BinaryArithmeticCommand(Computation::kDOrM, "or") {}
+
+UnaryArithmeticCommand::UnaryArithmeticCommand(Computation write_computation,
+                                               std::string_view command)
+    : write_computation_(write_computation), command_(command) {}
+
+void UnaryArithmeticCommand::Lower(HackProgram *program) const {
+  if (LowerArithmeticTemplate(command_, program)) {
+    return;
+  }
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+  program->AppendCompute(Destination::kM, write_computation_);
+}
+
+void UnaryArithmeticCommand::LowerCached(StackState *stack,
+                                         HackProgram *program) const {
+  Computation on_d;
+  if (stack->top_in_d && ComputationOnD(write_computation_, &on_d)) {
+    program->AppendCompute(Destination::kD, on_d);
+    return;
+  }
+  if (stack->top_in_d) {
+    LowerSpill(stack, program);
+  }
+  LowerTopSlot(stack, program);
+  program->AppendCompute(Destination::kM, write_computation_);
+}
+
+Computation UnaryArithmeticCommand::write_computation() const {
+  return write_computation_;
+}
+
+std::string_view UnaryArithmeticCommand::command() const {
+  return command_;
+}
+
+NegCommand::NegCommand() : UnaryArithmeticCommand(Computation::kNegM, "neg") {}
+NotCommand::NotCommand() : UnaryArithmeticCommand(Computation::kNotM, "not") {}
+
+void BinaryComparisonCommand::Lower(HackProgram *program) const {
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA | Destination::kM,
+                         Computation::kMMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kA, Computation::kAMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kMMinusD);
+  program->AppendAddress(else_label_);
+  program->AppendCompute(0, Computation::kD, jump_condition_);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+  program->AppendCompute(Destination::kM, Computation::kMinusOne);
+  program->AppendAddress(end_label_);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+  program->AppendLabel(else_label_);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+  program->AppendCompute(Destination::kM, Computation::kZero);
+  program->AppendLabel(end_label_);
+}
+
+void BinaryComparisonCommand::LowerCached(StackState *stack,
+                                          HackProgram *program) const {
+  if (!stack->top_in_d) {
+    LowerPopSlot(stack, program);
+    program->AppendCompute(Destination::kD, Computation::kM);
+  }
+  LowerPopSlot(stack, program);
+  program->AppendCompute(Destination::kD, Computation::kMMinusD);
+  program->AppendAddress(else_label_);
+  program->AppendCompute(0, Computation::kD, jump_condition_);
+  program->AppendCompute(Destination::kD, Computation::kMinusOne);
+  program->AppendAddress(end_label_);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+  program->AppendLabel(else_label_);
+  program->AppendCompute(Destination::kD, Computation::kZero);
+  program->AppendLabel(end_label_);
+  stack->top_in_d = true;
+}
+
+BinaryComparisonCommand::BinaryComparisonCommand(Jump jump_condition,
+                                                 std::string_view else_label,
+                                                 std::string_view end_label)
     : jump_condition_(jump_condition),
       else_label_(else_label),
       end_label_(end_label) {}
 
+Jump BinaryComparisonCommand::jump_condition() const {
+  return jump_condition_;
+}
+
+const std::string &BinaryComparisonCommand::else_label() const {
+  return else_label_;
+}
+
+const std::string &BinaryComparisonCommand::end_label() const {
+  return end_label_;
+}
+
 EqCommand::EqCommand(std::string_view label)
-    : BinaryComparisonCommand("JNE", absl::StrCat(label, "$eq_else"),
+    : BinaryComparisonCommand(Jump::kJne, absl::StrCat(label, "$eq_else"),
                               absl::StrCat(label, "$eq_end")) {}
 GtCommand::GtCommand(std::string_view label)
-    : BinaryComparisonCommand("JLE", absl::StrCat(label, "$gt_else"),
+    : BinaryComparisonCommand(Jump::kJle, absl::StrCat(label, "$gt_else"),
                               absl::StrCat(label, "$gt_end")) {}
 LtCommand::LtCommand(std::string_view label)
-    : BinaryComparisonCommand("JGE", absl::StrCat(label, "$lt_else"),
+    : BinaryComparisonCommand(Jump::kJge, absl::StrCat(label, "$lt_else"),
                               absl::StrCat(label, "$lt_end")) {}
 
 PushCommand::PushCommand(std::unique_ptr<Address> address)
     : address_(std::move(address)) {}
 
-std::string PushCommand::ToAssembly() const {
-  return absl::StrFormat(
-      "%s"
-      "D=%c\n"
-      "@SP\n"
-      "A=M\n"
-      "M=D\n"
-      "@SP\n"
-      "M=M+1\n",
-      address_->AddressingAssembly(Destination::kA),
-      address_->value_register());
+void PushCommand::Lower(HackProgram *program) const {
+  if (const CommandTemplate *command_template =
+          FindTemplate("push", address_.get())) {
+    LowerTemplate(*command_template, address_.get(), program);
+    return;
+  }
+  auto *constant = dynamic_cast<ConstantAddress *>(address_.get());
+  Computation computation;
+  if (constant && constant->ImmediateComputation(&computation)) {
+    program->AppendAddress("SP");
+    program->AppendCompute(Destination::kM, Computation::kMPlusOne);
+    program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+    program->AppendCompute(Destination::kM, computation);
+    return;
+  }
+  address_->LowerLoad(program);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kD);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kM, Computation::kMPlusOne);
+}
+
+void PushCommand::LowerCached(StackState *stack, HackProgram *program) const {
+  if (stack->top_in_d) {
+    LowerSpill(stack, program);
+  }
+  address_->LowerLoad(program);
+  stack->top_in_d = true;
+}
+
+const Address &PushCommand::address() const { return *address_; }
+
+std::unique_ptr<Address> PushCommand::TakeAddress() {
+  return std::move(address_);
 }
 
 PopCommand::PopCommand(std::unique_ptr<Address> address)
     : address_(std::move(address)) {}
 
-std::string PopCommand::ToAssembly() const {
-  if (dynamic_cast<PointerAddressedAddress *>(address_.get())) {
-    return absl::StrFormat(
-        "%s"
-        "@R15\n"
-        "M=D\n"
-        "@SP\n"
-        "AM=M-1\n"
-        "D=M\n"
-        "@R15\n"
-        "A=M\n"
-        "M=D\n",
-        address_->AddressingAssembly(Destination::kD));
-  }
-  return absl::StrFormat(
-      "@SP\n"
-      "AM=M-1\n"
-      "D=M\n"
-      "%s"
-      "M=D\n",
-      address_->AddressingAssembly(Destination::kA));
+void PopCommand::Lower(HackProgram *program) const {
+  StackState stack;
+  HackProgram cached;
+  LowerCached(&stack, &cached);
+  // Counting up to indexes without a template of their own can be shorter than
+  // the template for any index.
+  const CommandTemplate *command_template = FindTemplate("pop", address_.get());
+  if (command_template &&
+      command_template->instructions.size() <= cached.InstructionCount()) {
+    LowerTemplate(*command_template, address_.get(), program);
+    return;
+  }
+  program->Append(cached);
+}
+
+void PopCommand::LowerCached(StackState *stack, HackProgram *program) const {
+  if (auto *pointer_addressed =
+          dynamic_cast<PointerAddressedAddress *>(address_.get())) {
+    LowerPopPointerAddressed(*pointer_addressed, stack, program);
+    return;
+  }
+  if (!stack->top_in_d) {
+    LowerPopSlot(stack, program);
+    program->AppendCompute(Destination::kD, Computation::kM);
+  }
+  stack->top_in_d = false;
+  address_->LowerAddressing(Destination::kA, program);
+  program->AppendCompute(Destination::kM, Computation::kD);
+}
+
+const Address &PopCommand::address() const { return *address_; }
+
+std::unique_ptr<Address> PopCommand::TakeAddress() {
+  return std::move(address_);
 }
 
 LabelCommand::LabelCommand(std::string_view label) : label_(label) {}
 
-std::string LabelCommand::ToAssembly() const {
-  return absl::StrFormat("(%s)\n", label_);
+void LabelCommand::Lower(HackProgram *program) const {
+  program->AppendLabel(label_);
 }
 
+const std::string &LabelCommand::label() const { return label_; }
+
 GotoCommand::GotoCommand(std::string_view label) : label_(label) {}
 
-std::string GotoCommand::ToAssembly() const {
-  return absl::StrFormat(
-      "@%s\n"
-      "0;JMP\n",
-      label_);
+void GotoCommand::Lower(HackProgram *program) const {
+  program->AppendAddress(label_);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
 }
 
+const std::string &GotoCommand::label() const { return label_; }
+
 IfGotoCommand::IfGotoCommand(std::string_view label) : label_(label) {}
 
-std::string IfGotoCommand::ToAssembly() const {
-  return absl::StrFormat(
-      "@SP\n"
-      "AM=M-1\n"
-      "D=M\n"
-      "@%s\n"
-      "D;JNE\n",
-      label_);
+void IfGotoCommand::Lower(HackProgram *program) const {
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA | Destination::kM,
+                         Computation::kMMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress(label_);
+  program->AppendCompute(0, Computation::kD, Jump::kJne);
+}
+
+void IfGotoCommand::LowerCached(StackState *stack,
+                                HackProgram *program) const {
+  if (!stack->top_in_d) {
+    LowerPopSlot(stack, program);
+    program->AppendCompute(Destination::kD, Computation::kM);
+  }
+  stack->top_in_d = false;
+  LowerSync(stack, program);
+  program->AppendAddress(label_);
+  program->AppendCompute(0, Computation::kD, Jump::kJne);
 }
 
+const std::string &IfGotoCommand::label() const { return label_; }
+
+namespace {
+
+// The pointers a call saves after the return address in `frame`, in order.
+std::vector<std::string_view> SavedPointers(FrameLayout frame) {
+  if (frame == FrameLayout::kLight) {
+    return {"LCL", "ARG"};
+  }
+  return {"LCL", "ARG", "THIS", "THAT"};
+}
+
+// The number of values a call saves on the stack in `frame`.
+int FrameSize(FrameLayout frame) { return 1 + SavedPointers(frame).size(); }
+
+// Appends instructions pushing the pointers saved in `frame` after the return
+// address, which is already on the top of the stack but not counted in SP, and
+// pointing SP and D past them.
+void LowerSavePointers(FrameLayout frame, HackProgram *program) {
+  for (std::string_view pointer : SavedPointers(frame)) {
+    program->AppendAddress(pointer);
+    program->AppendCompute(Destination::kD, Computation::kM);
+    program->AppendAddress("SP");
+    program->AppendCompute(Destination::kA | Destination::kM,
+                           Computation::kMPlusOne);
+    program->AppendCompute(Destination::kM, Computation::kD);
+  }
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kD | Destination::kM,
+                         Computation::kMPlusOne);
+}
+
+}  // namespace
+
 CallCommand::CallCommand(std::string_view function, int argument_count,
-                         std::string_view return_label)
+                         std::string_view return_label, FrameLayout frame)
     : function_(function),
       argument_count_(argument_count),
-      return_label_(return_label) {}
-
-std::string CallCommand::ToAssembly() const {
-  std::string assembly = absl::StrFormat(
-      "@%s\n"
-      "D=A\n"
-      "@SP\n"
-      "A=M\n"
-      "M=D\n",
-      return_label_);
-  for (std::string_view pointer : {"LCL", "ARG", "THIS", "THAT"}) {
-    absl::StrAppend(&assembly, "@", pointer,
-                    "\n"
-                    "D=M\n"
-                    "@SP\n"
-                    "AM=M+1\n"
-                    "M=D\n");
-  }
-  absl::StrAppend(&assembly,
-                  "@SP\n"
-                  "MD=M+1\n");
-
-  absl::StrAppendFormat(&assembly,
-                        // ARG = SP - 5 - argument_count
-                        "@%d\n"
-                        "D=D-A\n"
-                        "@ARG\n"
-                        "M=D\n"
-                        // LCL = SP
-                        "@SP\n"
-                        "D=M\n"
-                        "@LCL\n"
-                        "M=D\n"
-                        // goto function
-                        "@%s\n"
-                        "0;JMP\n"
-                        "(%s)\n",
-                        5 + argument_count_, function_, return_label_);
-  return assembly;
+      return_label_(return_label),
+      frame_(frame) {}
+
+const std::string &CallCommand::function() const { return function_; }
+
+int CallCommand::argument_count() const { return argument_count_; }
+
+const std::string &CallCommand::return_label() const { return return_label_; }
+
+FrameLayout CallCommand::frame() const { return frame_; }
+
+void CallCommand::Lower(HackProgram *program) const {
+  program->AppendAddress(return_label_);
+  program->AppendCompute(Destination::kD, Computation::kA);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kD);
+  LowerSavePointers(frame_, program);
+
+  // ARG = SP - frame size - argument_count
+  program->AppendAddress(FrameSize(frame_) + argument_count_);
+  program->AppendCompute(Destination::kD, Computation::kDMinusA);
+  program->AppendAddress("ARG");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  // LCL = SP
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("LCL");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  // goto function
+  program->AppendAddress(function_);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+  program->AppendLabel(return_label_);
 }
 
 FunctionCommand::FunctionCommand(std::string_view identifier,
-                                 int variable_count)
-    : identifier_(identifier), variable_count_(variable_count) {}
+                                 int variable_count,
+                                 LocalInitialization initialization,
+                                 SharedRoutines *routines)
+    : identifier_(identifier),
+      variable_count_(variable_count),
+      initialization_(initialization),
+      routines_(routines) {}
+
+const std::string &FunctionCommand::identifier() const { return identifier_; }
 
-std::string FunctionCommand::ToAssembly() const {
-  std::string assembly = absl::StrFormat("(%s)\n", identifier_);
+int FunctionCommand::variable_count() const { return variable_count_; }
+
+LocalInitialization FunctionCommand::initialization() const {
+  return initialization_;
+}
+
+void FunctionCommand::Lower(HackProgram *program) const {
+  program->AppendLabel(identifier_);
   if (variable_count_ == 0) {
-    return assembly;
+    return;
+  }
+
+  // VM labels cannot contain `$`, so this never clashes with one.
+  std::string label = absl::StrCat(identifier_, "$$ZERO_LOCALS");
+  switch (initialization_) {
+    case LocalInitialization::kLooped:
+      ConstantAddress(variable_count_).LowerLoad(program);
+      program->AppendLabel(label);
+      program->AppendAddress("SP");
+      program->AppendCompute(Destination::kA | Destination::kM,
+                             Computation::kMPlusOne);
+      program->AppendCompute(Destination::kA, Computation::kAMinusOne);
+      program->AppendCompute(Destination::kM, Computation::kZero);
+      program->AppendAddress(label);
+      program->AppendCompute(Destination::kD, Computation::kDMinusOne,
+                             Jump::kJgt);
+      return;
+    case LocalInitialization::kShared:
+      routines_->UseZeroLocals(variable_count_);
+      program->AppendAddress(label);
+      program->AppendCompute(Destination::kD, Computation::kA);
+      program->AppendAddress(SharedRoutines::ZeroLocalsLabel(variable_count_));
+      program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+      program->AppendLabel(label);
+      return;
+    case LocalInitialization::kUnrolled:
+      break;
   }
 
-  absl::StrAppend(&assembly,
-                  "@SP\n"
-                  "A=M\n"
-                  "M=0\n");
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kZero);
   for (int i = 0; i < variable_count_ - 1; ++i) {
-    absl::StrAppend(&assembly,
-                    "@SP\n"
-                    "AM=M+1\n"
-                    "M=0\n");
-  }
-  absl::StrAppend(&assembly,
-                  "@SP\n"
-                  "M=M+1\n");
-  return assembly;
-}
-
-std::string ReturnCommand::ToAssembly() const {
-  return "@5\n"
-         "D=A\n"
-         "@LCL\n"
-         "A=M-D\n"
-         "D=M\n"
-         "@R15\n"
-         "M=D\n"
-         "@SP\n"
-         "A=M-1\n"
-         "D=M\n"
-         "@ARG\n"
-         "A=M\n"
-         "M=D\n"
-         "@ARG\n"
-         "D=M+1\n"
-         "@SP\n"
-         "M=D\n"
-         "@LCL\n"
-         "A=M-1\n"
-         "D=M\n"
-         "@THAT\n"
-         "M=D\n"
-         "@2\n"
-         "D=A\n"
-         "@LCL\n"
-         "A=M-D\n"
-         "D=M\n"
-         "@THIS\n"
-         "M=D\n"
-         "@3\n"
-         "D=A\n"
-         "@LCL\n"
-         "A=M-D\n"
-         "D=M\n"
-         "@ARG\n"
-         "M=D\n"
-         "@4\n"
-         "D=A\n"
-         "@LCL\n"
-         "A=M-D\n"
-         "D=M\n"
-         "@LCL\n"
-         "M=D\n"
-         "@R15\n"
-         "A=M\n"
-         "0;JMP\n";
+    program->AppendAddress("SP");
+    program->AppendCompute(Destination::kA | Destination::kM,
+                           Computation::kMPlusOne);
+    program->AppendCompute(Destination::kM, Computation::kZero);
+  }
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kM, Computation::kMPlusOne);
 }
+
+namespace {
+
+// Appends instructions returning from the current function, which was called
+// with `frame`.
+void LowerReturn(FrameLayout frame, HackProgram *program) {
+  // R15 = *(LCL - frame size), the return address
+  int frame_size = FrameSize(frame);
+  program->AppendAddress(frame_size);
+  program->AppendCompute(Destination::kD, Computation::kA);
+  program->AppendAddress("LCL");
+  program->AppendCompute(Destination::kA, Computation::kMMinusD);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  // *ARG = pop()
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("ARG");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kD);
+  // SP = ARG + 1
+  program->AppendAddress("ARG");
+  program->AppendCompute(Destination::kD, Computation::kMPlusOne);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  // Restore the saved pointers from *(LCL - 1), *(LCL - 2) and so on, LCL last
+  std::vector<std::string_view> pointers = SavedPointers(frame);
+  for (int offset = 1; offset < frame_size; ++offset) {
+    if (offset == 1) {
+      program->AppendAddress("LCL");
+      program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+    } else {
+      program->AppendAddress(offset);
+      program->AppendCompute(Destination::kD, Computation::kA);
+      program->AppendAddress("LCL");
+      program->AppendCompute(Destination::kA, Computation::kMMinusD);
+    }
+    program->AppendCompute(Destination::kD, Computation::kM);
+    program->AppendAddress(pointers[frame_size - 1 - offset]);
+    program->AppendCompute(Destination::kM, Computation::kD);
+  }
+  // goto R15
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+}
+
+}  // namespace
+
+ReturnCommand::ReturnCommand(FrameLayout frame) : frame_(frame) {}
+
+void ReturnCommand::Lower(HackProgram *program) const {
+  LowerReturn(frame_, program);
+}
+
+FrameLayout ReturnCommand::frame() const { return frame_; }
+
+MoveCommand::MoveCommand(std::unique_ptr<Address> source,
+                         std::unique_ptr<Address> destination)
+    : source_(std::move(source)), destination_(std::move(destination)) {}
+
+void MoveCommand::Lower(HackProgram *program) const {
+  auto *constant = dynamic_cast<ConstantAddress *>(source_.get());
+  Computation computation;
+  if (constant && constant->ImmediateComputation(&computation)) {
+    destination_->LowerAddressing(Destination::kA, program);
+    program->AppendCompute(Destination::kM, computation);
+    return;
+  }
+  auto *pointer_addressed =
+      dynamic_cast<PointerAddressedAddress *>(destination_.get());
+  // Counting up to the address after loading the value only adds `M=D`, while
+  // computing it first and keeping it in R15 adds 5 instructions.
+  if (pointer_addressed && pointer_addressed->OffsetCost() + 1 <=
+                               pointer_addressed->AddressingCost() + 5) {
+    source_->LowerLoad(program);
+    pointer_addressed->LowerOffsetAddressing(Destination::kA, program);
+    program->AppendCompute(Destination::kM, Computation::kD);
+    return;
+  }
+  if (pointer_addressed) {
+    // Computing the destination address needs D, so keep it in R15.
+    destination_->LowerAddressing(Destination::kD, program);
+    program->AppendAddress("R15");
+    program->AppendCompute(Destination::kM, Computation::kD);
+    source_->LowerLoad(program);
+    program->AppendAddress("R15");
+    program->AppendCompute(Destination::kA, Computation::kM);
+    program->AppendCompute(Destination::kM, Computation::kD);
+    return;
+  }
+  source_->LowerLoad(program);
+  destination_->LowerAddressing(Destination::kA, program);
+  program->AppendCompute(Destination::kM, Computation::kD);
+}
+
+void MoveCommand::LowerCached(StackState *stack, HackProgram *program) const {
+  // The stack itself is not used, so it does not need to be flushed.
+  if (stack->top_in_d) {
+    LowerSpill(stack, program);
+  }
+  Lower(program);
+}
+
+ConstantArithmeticCommand::ConstantArithmeticCommand(
+    Computation write_computation, uint16_t constant)
+    : write_computation_(write_computation), constant_(constant) {}
+
+void ConstantArithmeticCommand::Lower(HackProgram *program) const {
+  ConstantAddress(constant_).LowerLoad(program);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+  program->AppendCompute(Destination::kM, write_computation_);
+}
+
+void ConstantArithmeticCommand::LowerCached(StackState *stack,
+                                            HackProgram *program) const {
+  Computation on_constant;
+  if (stack->top_in_d && constant_ < 1 << 15 &&
+      ComputationOnConstant(write_computation_, &on_constant)) {
+    program->AppendAddress(constant_);
+    program->AppendCompute(Destination::kD, on_constant);
+    return;
+  }
+  if (stack->top_in_d) {
+    LowerSpill(stack, program);
+  }
+  ConstantAddress(constant_).LowerLoad(program);
+  LowerTopSlot(stack, program);
+  program->AppendCompute(Destination::kM, write_computation_);
+}
+
+CompareJumpCommand::CompareJumpCommand(Jump jump_condition,
+                                       std::string_view label)
+    : jump_condition_(jump_condition), label_(label) {}
+
+void CompareJumpCommand::Lower(HackProgram *program) const {
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA | Destination::kM,
+                         Computation::kMMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kA, Computation::kAMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kMMinusD);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kM, Computation::kMMinusOne);
+  program->AppendAddress(label_);
+  program->AppendCompute(0, Computation::kD, jump_condition_);
+}
+
+void CompareJumpCommand::LowerCached(StackState *stack,
+                                     HackProgram *program) const {
+  if (!stack->top_in_d) {
+    LowerPopSlot(stack, program);
+    program->AppendCompute(Destination::kD, Computation::kM);
+  }
+  LowerPopSlot(stack, program);
+  program->AppendCompute(Destination::kD, Computation::kMMinusD);
+  stack->top_in_d = false;
+  LowerSync(stack, program);
+  program->AppendAddress(label_);
+  program->AppendCompute(0, Computation::kD, jump_condition_);
+}
+
+const std::string &CompareJumpCommand::label() const { return label_; }
+
+LoadJumpCommand::LoadJumpCommand(std::unique_ptr<Address> source,
+                                 std::string_view label)
+    : source_(std::move(source)), label_(label) {}
+
+void LoadJumpCommand::Lower(HackProgram *program) const {
+  source_->LowerLoad(program);
+  program->AppendAddress(label_);
+  program->AppendCompute(0, Computation::kD, Jump::kJne);
+}
+
+const std::string &LoadJumpCommand::label() const { return label_; }
+
+std::string_view SharedRoutines::Label(Routine routine) {
+  switch (routine) {
+    case kEq:
+      return "$EQ";
+    case kGt:
+      return "$GT";
+    case kLt:
+      return "$LT";
+    case kCall:
+      return "$CALL";
+    case kReturn:
+      return "$RETURN";
+    case kLightCall:
+      return "$LIGHT_CALL";
+    case kLightReturn:
+      return "$LIGHT_RETURN";
+    case kMultiply:
+      return "$MULTIPLY";
+    case kDivide:
+      return "$DIVIDE";
+    case kZeroLocals:
+      return "$ZERO_LOCALS";
+    case kRoutineCount:
+      break;
+  }
+  return "";
+}
+
+SharedRoutines::Routine SharedRoutines::CallRoutine(FrameLayout frame) {
+  return frame == FrameLayout::kLight ? kLightCall : kCall;
+}
+
+SharedRoutines::Routine SharedRoutines::ReturnRoutine(FrameLayout frame) {
+  return frame == FrameLayout::kLight ? kLightReturn : kReturn;
+}
+
+std::string SharedRoutines::CallLabel(FrameLayout frame, int argument_count) {
+  return absl::StrCat(Label(CallRoutine(frame)), argument_count);
+}
+
+std::string SharedRoutines::ZeroLocalsLabel(int variable_count) {
+  return absl::StrCat(Label(kZeroLocals), variable_count);
+}
+
+void SharedRoutines::Use(Routine routine) {
+  if (measuring) {
+    return;
+  }
+  used_[routine].store(true, std::memory_order_relaxed);
+}
+
+void SharedRoutines::UseCall(FrameLayout frame, int argument_count) {
+  if (measuring) {
+    return;
+  }
+  Use(CallRoutine(frame));
+  absl::MutexLock lock(&mutex_);
+  argument_counts_[static_cast<int>(frame)].insert(argument_count);
+}
+
+void SharedRoutines::UseZeroLocals(int variable_count) {
+  if (measuring) {
+    return;
+  }
+  Use(kZeroLocals);
+  absl::MutexLock lock(&mutex_);
+  variable_counts_.insert(variable_count);
+}
+
+namespace {
+
+constexpr std::string_view kCompareTrueLabel = "$COMPARE_TRUE";
+constexpr std::string_view kCompareFalseLabel = "$COMPARE_FALSE";
+
+// Appends a routine comparing the value on the top of the stack, which it pops,
+// with the value in R13, and returning to the address in D with the result in
+// D. Unless `falls_through` is set, it ends with a jump to the code returning
+// false.
+void LowerComparisonRoutine(std::string_view label, Jump true_condition,
+                            bool falls_through, HackProgram *program) {
+  program->AppendLabel(label);
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA | Destination::kM,
+                         Computation::kMMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("R13");
+  program->AppendCompute(Destination::kD, Computation::kDMinusM);
+  program->AppendAddress(kCompareTrueLabel);
+  program->AppendCompute(0, Computation::kD, true_condition);
+  if (!falls_through) {
+    program->AppendAddress(kCompareFalseLabel);
+    program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+  }
+}
+
+// Appends the code shared by the comparison routines, returning `result` in D.
+void LowerComparisonReturn(std::string_view label, Computation result,
+                           HackProgram *program) {
+  program->AppendLabel(label);
+  program->AppendCompute(Destination::kD, result);
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+}
+
+// Appends the entry to the call routine for `frame` for functions of
+// `argument_count` arguments, which stores the return address from D on the
+// stack and the argument count in R14. Unless `falls_through` is set, it ends
+// with a jump to the call routine.
+void LowerCallEntry(FrameLayout frame, int argument_count, bool falls_through,
+                    HackProgram *program) {
+  program->AppendLabel(SharedRoutines::CallLabel(frame, argument_count));
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kD);
+  ConstantAddress(argument_count).LowerLoad(program);
+  program->AppendAddress("R14");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  if (!falls_through) {
+    program->AppendAddress(
+        SharedRoutines::Label(SharedRoutines::CallRoutine(frame)));
+    program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+  }
+}
+
+// Appends the call routine for `frame`, which saves the frame of the caller
+// after the return address already on the stack, sets up the frame of the
+// function called with the number of arguments in R14, and jumps to the
+// function at the address in R13.
+void LowerCallRoutine(FrameLayout frame, HackProgram *program) {
+  program->AppendLabel(
+      SharedRoutines::Label(SharedRoutines::CallRoutine(frame)));
+  LowerSavePointers(frame, program);
+  // LCL = SP
+  program->AppendAddress("LCL");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  // ARG = SP - frame size - R14
+  program->AppendAddress(FrameSize(frame));
+  program->AppendCompute(Destination::kD, Computation::kDMinusA);
+  program->AppendAddress("R14");
+  program->AppendCompute(Destination::kD, Computation::kDMinusM);
+  program->AppendAddress("ARG");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  // goto R13
+  program->AppendAddress("R13");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+}
+
+// Appends the address of the word `offset` words above the one SP points to.
+void LowerFreeSlotAddress(int offset, HackProgram *program) {
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA,
+                         offset > 0 ? Computation::kMPlusOne : Computation::kM);
+  for (int i = 1; i < offset; ++i) {
+    program->AppendCompute(Destination::kA, Computation::kAPlusOne);
+  }
+}
+
+// Appends the multiplication routine, which pops x from the stack and returns
+// x * y, for y in R13, in D. It adds x shifted left for each of the 16 bits of
+// y, keeping the product and the mask of the current bit in the free words at
+// SP and above.
+void LowerMultiplyRoutine(HackProgram *program) {
+  program->AppendLabel(SharedRoutines::Label(SharedRoutines::kMultiply));
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  // R14 = x, popped; product = 0; mask = 1
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA | Destination::kM,
+                         Computation::kMMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kZero);
+  program->AppendAddress("R14");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  LowerFreeSlotAddress(1, program);
+  program->AppendCompute(Destination::kM, Computation::kOne);
+  program->AppendLabel("$MULTIPLY_LOOP");
+  // if (y & mask) product += R14
+  program->AppendAddress("R13");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  LowerFreeSlotAddress(1, program);
+  program->AppendCompute(Destination::kD, Computation::kDAndM);
+  program->AppendAddress("$MULTIPLY_NEXT");
+  program->AppendCompute(0, Computation::kD, Jump::kJeq);
+  program->AppendAddress("R14");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  LowerFreeSlotAddress(0, program);
+  program->AppendCompute(Destination::kM, Computation::kDPlusM);
+  program->AppendLabel("$MULTIPLY_NEXT");
+  // R14 += R14; mask += mask until it overflows after the last bit
+  program->AppendAddress("R14");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kDPlusM);
+  LowerFreeSlotAddress(1, program);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kM | Destination::kD,
+                         Computation::kDPlusM);
+  program->AppendAddress("$MULTIPLY_LOOP");
+  program->AppendCompute(0, Computation::kD, Jump::kJne);
+  LowerFreeSlotAddress(0, program);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+}
+
+// Appends the division routine, which pops x from the stack and returns x / y,
+// for y in R13 other than 0, in D, rounded towards zero like `Math.divide`. It
+// divides the magnitudes by shifting the 16 bits of x into the remainder in
+// R15 and subtracting |y| whenever it fits, keeping the quotient, the sign of
+// the result, the mask counting the bits and the return address in the free
+// words at SP and above.
+void LowerDivideRoutine(HackProgram *program) {
+  program->AppendLabel(SharedRoutines::Label(SharedRoutines::kDivide));
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  // R14 = x, popped; sign = 0
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA | Destination::kM,
+                         Computation::kMMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("R14");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  LowerFreeSlotAddress(1, program);
+  program->AppendCompute(Destination::kM, Computation::kZero);
+  // Take the magnitudes of both operands, flipping the sign for each negative
+  // one.
+  for (std::string_view operand : {"R14", "R13"}) {
+    std::string positive = absl::StrCat("$DIVIDE_", operand, "_POSITIVE");
+    program->AppendAddress(operand);
+    program->AppendCompute(Destination::kD, Computation::kM);
+    program->AppendAddress(positive);
+    program->AppendCompute(0, Computation::kD, Jump::kJge);
+    program->AppendAddress(operand);
+    program->AppendCompute(Destination::kM, Computation::kNegM);
+    LowerFreeSlotAddress(1, program);
+    program->AppendCompute(Destination::kM, Computation::kNotM);
+    program->AppendLabel(positive);
+  }
+  // Move the return address out of R15, which holds the remainder.
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kZero);
+  LowerFreeSlotAddress(3, program);
+  program->AppendCompute(Destination::kM, Computation::kD);
+  LowerFreeSlotAddress(2, program);
+  program->AppendCompute(Destination::kM, Computation::kOne);
+  LowerFreeSlotAddress(0, program);
+  program->AppendCompute(Destination::kM, Computation::kZero);
+  program->AppendLabel("$DIVIDE_LOOP");
+  // Shift the top bit of R14 into the remainder and the quotient left.
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kDPlusM);
+  program->AppendAddress("R14");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kDPlusM);
+  program->AppendAddress("$DIVIDE_SHIFTED");
+  program->AppendCompute(0, Computation::kD, Jump::kJge);
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kM, Computation::kMPlusOne);
+  program->AppendLabel("$DIVIDE_SHIFTED");
+  LowerFreeSlotAddress(0, program);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kDPlusM);
+  // The remainder is at least |y| if it is 32768 or more, as unsigned words,
+  // or if the difference is not negative. The difference also comes out
+  // negative for |y| = 32768 and any smaller remainder.
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("$DIVIDE_SUBTRACT");
+  program->AppendCompute(0, Computation::kD, Jump::kJlt);
+  program->AppendAddress("R13");
+  program->AppendCompute(Destination::kD, Computation::kDMinusM);
+  program->AppendAddress("$DIVIDE_NEXT");
+  program->AppendCompute(0, Computation::kD, Jump::kJlt);
+  program->AppendLabel("$DIVIDE_SUBTRACT");
+  program->AppendAddress("R13");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("R15");
+  program->AppendCompute(Destination::kM, Computation::kMMinusD);
+  LowerFreeSlotAddress(0, program);
+  program->AppendCompute(Destination::kM, Computation::kMPlusOne);
+  program->AppendLabel("$DIVIDE_NEXT");
+  LowerFreeSlotAddress(2, program);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kM | Destination::kD,
+                         Computation::kDPlusM);
+  program->AppendAddress("$DIVIDE_LOOP");
+  program->AppendCompute(0, Computation::kD, Jump::kJne);
+  // Apply the sign and return.
+  LowerFreeSlotAddress(1, program);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("$DIVIDE_RETURN");
+  program->AppendCompute(0, Computation::kD, Jump::kJeq);
+  LowerFreeSlotAddress(0, program);
+  program->AppendCompute(Destination::kM, Computation::kNegM);
+  program->AppendLabel("$DIVIDE_RETURN");
+  LowerFreeSlotAddress(0, program);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  LowerFreeSlotAddress(3, program);
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+}
+
+// Appends the routine setting locals to 0. Entered at the label for n of
+// `variable_counts`, it pushes n zeros and returns to the address in D.
+void LowerZeroLocalsRoutine(const std::set<int> &variable_counts,
+                            HackProgram *program) {
+  for (int i = *variable_counts.rbegin(); i > 0; --i) {
+    if (variable_counts.count(i)) {
+      program->AppendLabel(SharedRoutines::ZeroLocalsLabel(i));
+    }
+    program->AppendAddress("SP");
+    program->AppendCompute(Destination::kM, Computation::kMPlusOne);
+    program->AppendCompute(Destination::kA, Computation::kMMinusOne);
+    program->AppendCompute(Destination::kM, Computation::kZero);
+  }
+  program->AppendCompute(Destination::kA, Computation::kD);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+}
+
+}  // namespace
+
+void SharedRoutines::Lower(HackProgram *program) const {
+  constexpr Jump kTrueConditions[] = {Jump::kJeq, Jump::kJgt, Jump::kJlt};
+  std::vector<Routine> comparisons;
+  for (Routine routine : {kEq, kGt, kLt}) {
+    if (used_[routine].load(std::memory_order_relaxed)) {
+      comparisons.push_back(routine);
+    }
+  }
+  for (Routine routine : comparisons) {
+    LowerComparisonRoutine(Label(routine), kTrueConditions[routine],
+                           /*falls_through=*/routine == comparisons.back(),
+                           program);
+  }
+  if (!comparisons.empty()) {
+    LowerComparisonReturn(kCompareFalseLabel, Computation::kZero, program);
+    LowerComparisonReturn(kCompareTrueLabel, Computation::kMinusOne, program);
+  }
+  if (used_[kMultiply].load(std::memory_order_relaxed)) {
+    LowerMultiplyRoutine(program);
+  }
+  if (used_[kDivide].load(std::memory_order_relaxed)) {
+    LowerDivideRoutine(program);
+  }
+  if (used_[kZeroLocals].load(std::memory_order_relaxed)) {
+    absl::MutexLock lock(&mutex_);
+    LowerZeroLocalsRoutine(variable_counts_, program);
+  }
+
+  for (FrameLayout frame : {FrameLayout::kStandard, FrameLayout::kLight}) {
+    if (used_[CallRoutine(frame)].load(std::memory_order_relaxed)) {
+      absl::MutexLock lock(&mutex_);
+      const std::set<int> &argument_counts =
+          argument_counts_[static_cast<int>(frame)];
+      for (int argument_count : argument_counts) {
+        LowerCallEntry(frame, argument_count,
+                       /*falls_through=*/argument_count ==
+                           *argument_counts.rbegin(),
+                       program);
+      }
+      LowerCallRoutine(frame, program);
+    }
+    if (used_[ReturnRoutine(frame)].load(std::memory_order_relaxed)) {
+      program->AppendLabel(Label(ReturnRoutine(frame)));
+      LowerReturn(frame, program);
+    }
+  }
+}
+
+SharedBinaryCommand::SharedBinaryCommand(SharedRoutines::Routine routine,
+                                         std::string_view return_label,
+                                         SharedRoutines *routines,
+                                         std::string_view zero_label)
+    : routine_(routine),
+      return_label_(return_label),
+      routines_(routines),
+      zero_label_(zero_label) {}
+
+void SharedBinaryCommand::Lower(HackProgram *program) const {
+  StackState stack;
+  LowerCached(&stack, program);
+  LowerFlush(&stack, program);
+}
+
+void SharedBinaryCommand::LowerCached(StackState *stack,
+                                      HackProgram *program) const {
+  routines_->Use(routine_);
+  if (!stack->top_in_d) {
+    LowerPopSlot(stack, program);
+    program->AppendCompute(Destination::kD, Computation::kM);
+  }
+  // The routine pops the first operand from the stack itself.
+  LowerSync(stack, program);
+  if (!zero_label_.empty()) {
+    program->AppendAddress(zero_label_);
+    program->AppendCompute(0, Computation::kD, Jump::kJeq);
+  }
+  program->AppendAddress("R13");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  program->AppendAddress(return_label_);
+  program->AppendCompute(Destination::kD, Computation::kA);
+  program->AppendAddress(SharedRoutines::Label(routine_));
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+  program->AppendLabel(return_label_);
+  stack->top_in_d = true;
+}
+
+SharedRoutines::Routine SharedBinaryCommand::routine() const {
+  return routine_;
+}
+
+const std::string &SharedBinaryCommand::return_label() const {
+  return return_label_;
+}
+
+SharedRoutines *SharedBinaryCommand::routines() const { return routines_; }
+
+const std::string &SharedBinaryCommand::zero_label() const {
+  return zero_label_;
+}
+
+void PeekCommand::Lower(HackProgram *program) const {
+  StackState stack;
+  LowerCached(&stack, program);
+  LowerFlush(&stack, program);
+}
+
+void PeekCommand::LowerCached(StackState *stack, HackProgram *program) const {
+  if (!stack->top_in_d) {
+    LowerPopSlot(stack, program);
+    program->AppendCompute(Destination::kD, Computation::kM);
+  }
+  program->AppendCompute(Destination::kA, Computation::kD);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  stack->top_in_d = true;
+}
+
+void PokeCommand::Lower(HackProgram *program) const {
+  StackState stack;
+  LowerCached(&stack, program);
+  LowerFlush(&stack, program);
+}
+
+void PokeCommand::LowerCached(StackState *stack, HackProgram *program) const {
+  if (!stack->top_in_d) {
+    LowerPopSlot(stack, program);
+    program->AppendCompute(Destination::kD, Computation::kM);
+  }
+  // Addressing the slot of the address keeps the value in D.
+  LowerPopSlot(stack, program);
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kD);
+  program->AppendCompute(Destination::kD, Computation::kZero);
+  stack->top_in_d = true;
+}
+
+SharedCallCommand::SharedCallCommand(std::string_view function,
+                                     int argument_count,
+                                     std::string_view return_label,
+                                     FrameLayout frame,
+                                     SharedRoutines *routines)
+    : function_(function),
+      argument_count_(argument_count),
+      return_label_(return_label),
+      frame_(frame),
+      routines_(routines) {}
+
+void SharedCallCommand::Lower(HackProgram *program) const {
+  routines_->UseCall(frame_, argument_count_);
+  program->AppendAddress(function_);
+  program->AppendCompute(Destination::kD, Computation::kA);
+  program->AppendAddress("R13");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  program->AppendAddress(return_label_);
+  program->AppendCompute(Destination::kD, Computation::kA);
+  program->AppendAddress(SharedRoutines::CallLabel(frame_, argument_count_));
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+  program->AppendLabel(return_label_);
+}
+
+int SharedCallCommand::argument_count() const { return argument_count_; }
+
+SharedReturnCommand::SharedReturnCommand(FrameLayout frame,
+                                         SharedRoutines *routines)
+    : frame_(frame), routines_(routines) {}
+
+void SharedReturnCommand::Lower(HackProgram *program) const {
+  SharedRoutines::Routine routine = SharedRoutines::ReturnRoutine(frame_);
+  routines_->Use(routine);
+  program->AppendAddress(SharedRoutines::Label(routine));
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+}
+
+StaticCallCommand::StaticCallCommand(std::string_view function,
+                                     std::string_view return_label,
+                                     StaticFrame frame)
+    : function_(function),
+      return_label_(return_label),
+      frame_(std::move(frame)) {}
+
+void StaticCallCommand::Lower(HackProgram *program) const {
+  StackState stack;
+  LowerCached(&stack, program);
+}
+
+void StaticCallCommand::LowerCached(StackState *stack,
+                                    HackProgram *program) const {
+  // The last argument is on the top of the stack.
+  for (auto argument = frame_.arguments.rbegin();
+       argument != frame_.arguments.rend(); ++argument) {
+    if (!stack->top_in_d) {
+      LowerPopSlot(stack, program);
+      program->AppendCompute(Destination::kD, Computation::kM);
+    }
+    stack->top_in_d = false;
+    program->AppendAddress(*argument);
+    program->AppendCompute(Destination::kM, Computation::kD);
+  }
+  LowerFlush(stack, program);
+  program->AppendAddress(return_label_);
+  program->AppendCompute(Destination::kD, Computation::kA);
+  program->AppendAddress(frame_.return_address);
+  program->AppendCompute(Destination::kM, Computation::kD);
+  program->AppendAddress(function_);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+  program->AppendLabel(return_label_);
+}
+
+const StaticFrame &StaticCallCommand::frame() const { return frame_; }
+
+StaticFunctionCommand::StaticFunctionCommand(std::string_view identifier,
+                                             StaticFrame frame)
+    : identifier_(identifier), frame_(std::move(frame)) {}
+
+void StaticFunctionCommand::Lower(HackProgram *program) const {
+  program->AppendLabel(identifier_);
+  if (!frame_.saved_pointers.empty()) {
+    int i = 0;
+    for (std::string_view pointer : {"THIS", "THAT"}) {
+      program->AppendAddress(pointer);
+      program->AppendCompute(Destination::kD, Computation::kM);
+      program->AppendAddress(frame_.saved_pointers[i++]);
+      program->AppendCompute(Destination::kM, Computation::kD);
+    }
+  }
+  for (const std::string &local : frame_.locals) {
+    program->AppendAddress(local);
+    program->AppendCompute(Destination::kM, Computation::kZero);
+  }
+}
+
+const std::string &StaticFunctionCommand::identifier() const {
+  return identifier_;
+}
+
+StaticReturnCommand::StaticReturnCommand(StaticFrame frame)
+    : frame_(std::move(frame)) {}
+
+void StaticReturnCommand::Lower(HackProgram *program) const {
+  if (!frame_.saved_pointers.empty()) {
+    int i = 0;
+    for (std::string_view pointer : {"THIS", "THAT"}) {
+      program->AppendAddress(frame_.saved_pointers[i++]);
+      program->AppendCompute(Destination::kD, Computation::kM);
+      program->AppendAddress(pointer);
+      program->AppendCompute(Destination::kM, Computation::kD);
+    }
+  }
+  program->AppendAddress(frame_.return_address);
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+}
+
+TailCallCommand::TailCallCommand(std::string_view function,
+                                 int argument_count)
+    : function_(function), argument_count_(argument_count) {}
+
+void TailCallCommand::Lower(HackProgram *program) const {
+  StackState stack;
+  LowerCached(&stack, program);
+}
+
+void TailCallCommand::LowerCached(StackState *stack,
+                                  HackProgram *program) const {
+  // The arguments lie above LCL, so popping them into the arguments of the
+  // caller never overwrites one that is still to be moved.
+  for (int i = argument_count_ - 1; i >= 0; --i) {
+    PopCommand(std::make_unique<ArgumentAddress>(i))
+        .LowerCached(stack, program);
+  }
+  // Anything left on the stack of the caller is discarded.
+  *stack = StackState();
+  program->AppendAddress("LCL");
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kM, Computation::kD);
+  program->AppendAddress(function_);
+  program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+}
+
+int TailCallCommand::argument_count() const { return argument_count_; }
+
+CommentCommand::CommentCommand(std::string_view comment) : comment_(comment) {}
+
+void CommentCommand::Lower(HackProgram *program) const {
+  program->AppendComment(comment_);
+}
+
+void CommentCommand::LowerCached(StackState *, HackProgram *program) const {
+  Lower(program);
+}
+
+const std::string &CommentCommand::comment() const { return comment_; }
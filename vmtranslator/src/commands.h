@@ -1,26 +1,144 @@
 #ifndef NAND2TETRIS_VMTRANSLATOR_COMMANDS_H_
 #define NAND2TETRIS_VMTRANSLATOR_COMMANDS_H_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <set>
 #include <string>
 #include <string_view>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
 
 #include "addressing.h"
+#include "hack.h"
+
+// The state of the stack while lowering commands with stack caching. Within a
+// basic block, the top of the stack is kept in D and the other values are
+// addressed relative to SP, which is only written back when needed.
+struct StackState {
+  // Whether the value on the top of the stack is in D instead of RAM.
+  bool top_in_d = false;
+  // The number of values in RAM at and above the address in SP, which SP has
+  // not been advanced past yet.
+  int offset = 0;
+};
 
 class Command {
  public:
-  virtual std::string ToAssembly() const = 0;
+  virtual ~Command() = default;
+
+  // Appends the Hack instructions implementing this command to `program`.
+  virtual void Lower(HackProgram *program) const = 0;
+
+  // Appends the Hack instructions implementing this command given the state of
+  // the stack, and updates it. The default implementation flushes the stack
+  // and calls `Lower()`.
+  virtual void LowerCached(StackState *stack, HackProgram *program) const;
+
+  std::string ToAssembly() const;
+  // Returns the number of instructions `Lower()` appends, without recording
+  // the shared routines they call, so that commands about to be removed can be
+  // measured.
+  size_t InstructionCount() const;
 };
 std::ostream &operator<<(std::ostream &os, const Command &command);
 
+using CommandList = std::vector<std::unique_ptr<Command>>;
+
+// Appends instructions writing the top of the stack to RAM and the stack
+// pointer to SP, so that the stack is as `Lower()` expects it.
+void LowerFlush(StackState *stack, HackProgram *program);
+
+// Appends the instructions of `commands` to `program`. If `cache_stack` is set,
+// commands are lowered with `LowerCached()`, and the stack is only flushed
+// before commands that need it, such as labels, jumps, calls and returns, and
+// at the end.
+void LowerCommands(const CommandList &commands, bool cache_stack,
+                   HackProgram *program);
+
+// The values a call saves on the stack before the frame of the callee, which
+// its return restores.
+enum class FrameLayout : uint8_t {
+  // The return address, LCL, ARG, THIS and THAT.
+  kStandard,
+  // The return address, LCL and ARG, for callees that never change THIS or
+  // THAT.
+  kLight,
+};
+
+// Subroutines that the sites of some commands call instead of inlining their
+// code, which are appended once at the end of the program. Only the routines
+// used while lowering are appended.
+class SharedRoutines {
+ public:
+  enum Routine {
+    kEq,
+    kGt,
+    kLt,
+    kCall,
+    kReturn,
+    kLightCall,
+    kLightReturn,
+    kMultiply,
+    kDivide,
+    kZeroLocals,
+    kRoutineCount,
+  };
+
+  // The label at the start of `routine`.
+  static std::string_view Label(Routine routine);
+  // The call and return routines for `frame`.
+  static Routine CallRoutine(FrameLayout frame);
+  static Routine ReturnRoutine(FrameLayout frame);
+  // The label of the entry to the call routine for `frame` for functions of
+  // `argument_count` arguments.
+  static std::string CallLabel(FrameLayout frame, int argument_count);
+  // The label of the entry to the routine setting `variable_count` locals to 0.
+  static std::string ZeroLocalsLabel(int variable_count);
+
+  // Records that `routine` is called. May be called from multiple threads.
+  void Use(Routine routine);
+  // Records that a function of `argument_count` arguments is called through
+  // the call routine for `frame`. May be called from multiple threads.
+  void UseCall(FrameLayout frame, int argument_count);
+  // Records that a function of `variable_count` locals sets them to 0 through
+  // the shared routine. May be called from multiple threads.
+  void UseZeroLocals(int variable_count);
+
+  // Appends the routines that have been used.
+  void Lower(HackProgram *program) const;
+
+ private:
+  std::atomic<bool> used_[kRoutineCount] = {};
+  mutable absl::Mutex mutex_;
+  // The argument counts called through the call routine of each frame layout.
+  std::set<int> argument_counts_[2] ABSL_GUARDED_BY(mutex_);
+  // The local counts set to 0 through the shared routine.
+  std::set<int> variable_counts_ ABSL_GUARDED_BY(mutex_);
+};
+
 class BinaryArithmeticCommand : public Command {
  public:
-  BinaryArithmeticCommand(std::string_view write_command);
-  std::string ToAssembly() const override;
+  // `command` names the template of the superoptimizer that `Lower()`
+  // appends, if any.
+  BinaryArithmeticCommand(Computation write_computation,
+                          std::string_view command = "");
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  // The computation of the result from the second operand in M and the top of
+  // the stack in D.
+  Computation write_computation() const;
+  std::string_view command() const;
 
  private:
-  std::string write_command_;
+  Computation write_computation_;
+  std::string_view command_;
 };
 
 class AddCommand : public BinaryArithmeticCommand {
@@ -45,11 +163,20 @@ class OrCommand : public BinaryArithmeticCommand {
 
 class UnaryArithmeticCommand : public Command {
  public:
-  UnaryArithmeticCommand(std::string_view write_command);
-  std::string ToAssembly() const;
+  // `command` names the template of the superoptimizer that `Lower()`
+  // appends, if any.
+  UnaryArithmeticCommand(Computation write_computation,
+                         std::string_view command = "");
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  // The computation of the result from the top of the stack in M.
+  Computation write_computation() const;
+  std::string_view command() const;
 
  private:
-  std::string write_command_;
+  Computation write_computation_;
+  std::string_view command_;
 };
 
 class NegCommand : public UnaryArithmeticCommand {
@@ -64,13 +191,21 @@ class NotCommand : public UnaryArithmeticCommand {
 
 class BinaryComparisonCommand : public Command {
  public:
-  BinaryComparisonCommand(std::string_view jump_condition,
+  BinaryComparisonCommand(Jump jump_condition,
                           std::string_view else_label,
                           std::string_view end_label);
-  std::string ToAssembly() const;
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  // The condition on the difference of the operands under which the result is
+  // false.
+  Jump jump_condition() const;
+  // Labels unique to this command.
+  const std::string &else_label() const;
+  const std::string &end_label() const;
 
  private:
-  std::string jump_condition_;
+  Jump jump_condition_;
   std::string else_label_;
   std::string end_label_;
 };
@@ -90,19 +225,31 @@ class LtCommand : public BinaryComparisonCommand {
   LtCommand(std::string_view label);
 };
 
+// `Lower()` appends the template of the superoptimizer for the segment and
+// index, except for constants that do not fit in an address instruction.
 class PushCommand : public Command {
  public:
   PushCommand(std::unique_ptr<Address> address);
-  std::string ToAssembly() const override;
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  const Address &address() const;
+  std::unique_ptr<Address> TakeAddress();
 
  private:
   std::unique_ptr<Address> address_;
 };
 
+// `Lower()` appends the template of the superoptimizer for the segment and
+// index, unless the instructions of `LowerCached()` are shorter.
 class PopCommand : public Command {
  public:
   PopCommand(std::unique_ptr<Address> address);
-  std::string ToAssembly() const override;
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  const Address &address() const;
+  std::unique_ptr<Address> TakeAddress();
 
  private:
   std::unique_ptr<Address> address_;
@@ -111,7 +258,9 @@ class PopCommand : public Command {
 class LabelCommand : public Command {
  public:
   LabelCommand(std::string_view label);
-  std::string ToAssembly() const override;
+  void Lower(HackProgram *program) const override;
+
+  const std::string &label() const;
 
  private:
   std::string label_;
@@ -120,7 +269,9 @@ class LabelCommand : public Command {
 class GotoCommand : public Command {
  public:
   GotoCommand(std::string_view label);
-  std::string ToAssembly() const override;
+  void Lower(HackProgram *program) const override;
+
+  const std::string &label() const;
 
  private:
   std::string label_;
@@ -129,7 +280,10 @@ class GotoCommand : public Command {
 class IfGotoCommand : public Command {
  public:
   IfGotoCommand(std::string_view label);
-  std::string ToAssembly() const override;
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  const std::string &label() const;
 
  private:
   std::string label_;
@@ -138,28 +292,278 @@ class IfGotoCommand : public Command {
 class CallCommand : public Command {
  public:
   CallCommand(std::string_view function, int argument_count,
-              std::string_view return_label);
-  std::string ToAssembly() const override;
+              std::string_view return_label,
+              FrameLayout frame = FrameLayout::kStandard);
+  void Lower(HackProgram *program) const override;
+
+  const std::string &function() const;
+  int argument_count() const;
+  const std::string &return_label() const;
+  FrameLayout frame() const;
 
  private:
   std::string function_;
   int argument_count_;
   std::string return_label_;
+  FrameLayout frame_;
+};
+
+// How a function sets its local variables to 0 on entry.
+enum class LocalInitialization : uint8_t {
+  // A store per local, 3 instructions each.
+  kUnrolled,
+  // A loop counting the locals down in D, 8 instructions and 6 cycles per
+  // local.
+  kLooped,
+  // A jump into the `$ZERO_LOCALS` shared routine, 4 instructions and 4 cycles
+  // per local. The routine takes 4 instructions per local of the function with
+  // the most locals using it.
+  kShared,
 };
 
 class FunctionCommand : public Command {
  public:
-  FunctionCommand(std::string_view identifier, int variable_count);
-  std::string ToAssembly() const override;
+  // `routines` is only used with `LocalInitialization::kShared`.
+  FunctionCommand(
+      std::string_view identifier, int variable_count,
+      LocalInitialization initialization = LocalInitialization::kUnrolled,
+      SharedRoutines *routines = nullptr);
+  void Lower(HackProgram *program) const override;
+
+  const std::string &identifier() const;
+  int variable_count() const;
+  LocalInitialization initialization() const;
 
  private:
   std::string identifier_;
   int variable_count_;
+  LocalInitialization initialization_;
+  SharedRoutines *routines_;
 };
 
 class ReturnCommand : public Command {
  public:
-  std::string ToAssembly() const override;
+  explicit ReturnCommand(FrameLayout frame = FrameLayout::kStandard);
+  void Lower(HackProgram *program) const override;
+
+  FrameLayout frame() const;
+
+ private:
+  FrameLayout frame_;
+};
+
+// The following commands are not part of the VM language. They are produced by
+// optimization passes, or carry debug information.
+
+// `push source` followed by `pop destination`, without going through the
+// stack.
+class MoveCommand : public Command {
+ public:
+  MoveCommand(std::unique_ptr<Address> source,
+              std::unique_ptr<Address> destination);
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+ private:
+  std::unique_ptr<Address> source_;
+  std::unique_ptr<Address> destination_;
+};
+
+// `push constant` followed by a binary arithmetic command, computing the
+// result in place on the top of the stack.
+class ConstantArithmeticCommand : public Command {
+ public:
+  ConstantArithmeticCommand(Computation write_computation, uint16_t constant);
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+ private:
+  Computation write_computation_;
+  uint16_t constant_;
+};
+
+// A comparison followed by `if-goto label`, jumping on the difference of the
+// operands under `jump_condition` without storing a boolean on the stack.
+class CompareJumpCommand : public Command {
+ public:
+  CompareJumpCommand(Jump jump_condition, std::string_view label);
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  const std::string &label() const;
+
+ private:
+  Jump jump_condition_;
+  std::string label_;
+};
+
+// `push source` followed by `if-goto label`, without going through the stack.
+class LoadJumpCommand : public Command {
+ public:
+  LoadJumpCommand(std::unique_ptr<Address> source, std::string_view label);
+  void Lower(HackProgram *program) const override;
+
+  const std::string &label() const;
+
+ private:
+  std::unique_ptr<Address> source_;
+  std::string label_;
+};
+
+// A binary operation computed by calling one of the `SharedRoutines` with the
+// second operand in R13 and the return address in D, which returns the result
+// in D. Comparisons are smaller but slower than `BinaryComparisonCommand` once
+// the routine is shared by a few sites. If `zero_label` is set, a zero second
+// operand jumps there instead, with only the first operand left on the stack.
+class SharedBinaryCommand : public Command {
+ public:
+  SharedBinaryCommand(SharedRoutines::Routine routine,
+                      std::string_view return_label, SharedRoutines *routines,
+                      std::string_view zero_label = "");
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  SharedRoutines::Routine routine() const;
+  const std::string &return_label() const;
+  SharedRoutines *routines() const;
+  const std::string &zero_label() const;
+
+ private:
+  SharedRoutines::Routine routine_;
+  std::string return_label_;
+  SharedRoutines *routines_;
+  std::string zero_label_;
+};
+
+// `call Memory.peek 1`, replacing the address on the top of the stack with the
+// value stored there.
+class PeekCommand : public Command {
+ public:
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+};
+
+// `call Memory.poke 2`, storing the value on the top of the stack at the
+// address below it and leaving 0 in their place.
+class PokeCommand : public Command {
+ public:
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+};
+
+// `call function argument_count` through the call routine of
+// `SharedRoutines`, passing the function in R13 and the return address in D.
+class SharedCallCommand : public Command {
+ public:
+  SharedCallCommand(std::string_view function, int argument_count,
+                    std::string_view return_label, FrameLayout frame,
+                    SharedRoutines *routines);
+  void Lower(HackProgram *program) const override;
+
+  int argument_count() const;
+
+ private:
+  std::string function_;
+  int argument_count_;
+  std::string return_label_;
+  FrameLayout frame_;
+  SharedRoutines *routines_;
+};
+
+// `return` through the return routine of `SharedRoutines`.
+class SharedReturnCommand : public Command {
+ public:
+  SharedReturnCommand(FrameLayout frame, SharedRoutines *routines);
+  void Lower(HackProgram *program) const override;
+
+ private:
+  FrameLayout frame_;
+  SharedRoutines *routines_;
+};
+
+// The variables, named by assembler symbols, that a function which is never
+// active more than once keeps its frame in instead of the stack.
+struct StaticFrame {
+  std::string return_address;
+  // Where THIS and THAT of the caller are saved if the function changes them,
+  // or empty.
+  std::vector<std::string> saved_pointers;
+  std::vector<std::string> arguments;
+  std::vector<std::string> locals;
+};
+
+// `call function argument_count` of a function with a static frame, which pops
+// the arguments into the frame. The function leaves its result in place of
+// the arguments.
+class StaticCallCommand : public Command {
+ public:
+  StaticCallCommand(std::string_view function, std::string_view return_label,
+                    StaticFrame frame);
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  const StaticFrame &frame() const;
+
+ private:
+  std::string function_;
+  std::string return_label_;
+  StaticFrame frame_;
+};
+
+// `function identifier variable_count` of a function with a static frame.
+class StaticFunctionCommand : public Command {
+ public:
+  StaticFunctionCommand(std::string_view identifier, StaticFrame frame);
+  void Lower(HackProgram *program) const override;
+
+  const std::string &identifier() const;
+
+ private:
+  std::string identifier_;
+  StaticFrame frame_;
+};
+
+// `return` from a function with a static frame, which must leave exactly its
+// result on the stack.
+class StaticReturnCommand : public Command {
+ public:
+  explicit StaticReturnCommand(StaticFrame frame);
+  void Lower(HackProgram *program) const override;
+
+ private:
+  StaticFrame frame_;
+};
+
+// `call function argument_count` followed by `return`, which reuses the frame
+// of the caller: the arguments replace those of the caller, whose saved
+// return address and pointers stay in place, and the stack is reset to LCL
+// before jumping to the function. The caller must have at least
+// `argument_count` arguments, and both functions must use the same frame
+// layout.
+class TailCallCommand : public Command {
+ public:
+  TailCallCommand(std::string_view function, int argument_count);
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  int argument_count() const;
+
+ private:
+  std::string function_;
+  int argument_count_;
+};
+
+// A comment in the assembly output.
+class CommentCommand : public Command {
+ public:
+  CommentCommand(std::string_view comment);
+  void Lower(HackProgram *program) const override;
+  void LowerCached(StackState *stack, HackProgram *program) const override;
+
+  const std::string &comment() const;
+
+ private:
+  std::string comment_;
 };
 
 #endif  // NAND2TETRIS_VMTRANSLATOR_COMMANDS_H_
@@ -1,6 +1,8 @@
 #include "commands.h"
 
+#include <cstdint>
 #include <memory>
+#include <string>
 
 #include "gtest/gtest.h"
 
@@ -127,10 +129,9 @@ TEST(PushCommandTest, ArgumentAddress) {
             "A=D+M\n"
             "D=M\n"
             "@SP\n"
-            "A=M\n"
-            "M=D\n"
-            "@SP\n"
-            "M=M+1\n");
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
 }
 
 TEST(PushCommandTest, LocalAddress) {
@@ -141,10 +142,9 @@ TEST(PushCommandTest, LocalAddress) {
             "A=D+M\n"
             "D=M\n"
             "@SP\n"
-            "A=M\n"
-            "M=D\n"
-            "@SP\n"
-            "M=M+1\n");
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
 }
 
 TEST(PushCommandTest, ThisAddress) {
@@ -155,10 +155,9 @@ TEST(PushCommandTest, ThisAddress) {
             "A=D+M\n"
             "D=M\n"
             "@SP\n"
-            "A=M\n"
-            "M=D\n"
-            "@SP\n"
-            "M=M+1\n");
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
 }
 
 TEST(PushCommandTest, ThatAddress) {
@@ -169,10 +168,9 @@ TEST(PushCommandTest, ThatAddress) {
             "A=D+M\n"
             "D=M\n"
             "@SP\n"
-            "A=M\n"
-            "M=D\n"
-            "@SP\n"
-            "M=M+1\n");
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
 }
 
 TEST(PushCommandTest, StaticAddress) {
@@ -180,10 +178,9 @@ TEST(PushCommandTest, StaticAddress) {
             "@Foo.5\n"
             "D=M\n"
             "@SP\n"
-            "A=M\n"
-            "M=D\n"
-            "@SP\n"
-            "M=M+1\n");
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
 }
 
 TEST(PushCommandTest, ConstantAddress) {
@@ -191,10 +188,9 @@ TEST(PushCommandTest, ConstantAddress) {
             "@5\n"
             "D=A\n"
             "@SP\n"
-            "A=M\n"
-            "M=D\n"
-            "@SP\n"
-            "M=M+1\n");
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
 }
 
 TEST(PushCommandTest, PointerAddress) {
@@ -202,10 +198,9 @@ TEST(PushCommandTest, PointerAddress) {
             "@3\n"
             "D=M\n"
             "@SP\n"
-            "A=M\n"
-            "M=D\n"
-            "@SP\n"
-            "M=M+1\n");
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
 }
 
 TEST(PushCommandTest, TempAddress) {
@@ -213,10 +208,9 @@ TEST(PushCommandTest, TempAddress) {
             "@10\n"
             "D=M\n"
             "@SP\n"
-            "A=M\n"
-            "M=D\n"
-            "@SP\n"
-            "M=M+1\n");
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
 }
 
 TEST(PopCommandTest, ArgumentAddress) {
@@ -225,14 +219,11 @@ TEST(PopCommandTest, ArgumentAddress) {
             "D=A\n"
             "@ARG\n"
             "D=D+M\n"
-            "@R15\n"
-            "M=D\n"
             "@SP\n"
             "AM=M-1\n"
-            "D=M\n"
-            "@R15\n"
-            "A=M\n"
-            "M=D\n");
+            "D=D+M\n"
+            "A=D-M\n"
+            "M=D-A\n");
 }
 
 TEST(PopCommandTest, LocalAddress) {
@@ -241,14 +232,11 @@ TEST(PopCommandTest, LocalAddress) {
             "D=A\n"
             "@LCL\n"
             "D=D+M\n"
-            "@R15\n"
-            "M=D\n"
             "@SP\n"
             "AM=M-1\n"
-            "D=M\n"
-            "@R15\n"
-            "A=M\n"
-            "M=D\n");
+            "D=D+M\n"
+            "A=D-M\n"
+            "M=D-A\n");
 }
 
 TEST(PopCommandTest, ThisAddress) {
@@ -257,14 +245,11 @@ TEST(PopCommandTest, ThisAddress) {
             "D=A\n"
             "@THIS\n"
             "D=D+M\n"
-            "@R15\n"
-            "M=D\n"
             "@SP\n"
             "AM=M-1\n"
-            "D=M\n"
-            "@R15\n"
-            "A=M\n"
-            "M=D\n");
+            "D=D+M\n"
+            "A=D-M\n"
+            "M=D-A\n");
 }
 
 TEST(PopCommandTest, ThatAddress) {
@@ -273,14 +258,11 @@ TEST(PopCommandTest, ThatAddress) {
             "D=A\n"
             "@THAT\n"
             "D=D+M\n"
-            "@R15\n"
-            "M=D\n"
             "@SP\n"
             "AM=M-1\n"
-            "D=M\n"
-            "@R15\n"
-            "A=M\n"
-            "M=D\n");
+            "D=D+M\n"
+            "A=D-M\n"
+            "M=D-A\n");
 }
 
 TEST(PopCommandTest, StaticAddress) {
@@ -319,6 +301,69 @@ TEST(PopCommandTest, TempAddress) {
             "M=D\n");
 }
 
+TEST(PopCommandTest, TemplateOrCountingUp) {
+  // Index 2 has a template of its own, and counting up to index 3 is shorter
+  // than the template for any index.
+  EXPECT_EQ(PopCommand(std::make_unique<LocalAddress>(2)).ToAssembly(),
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "@LCL\n"
+            "A=M+1\n"
+            "A=A+1\n"
+            "M=D\n");
+  EXPECT_EQ(PopCommand(std::make_unique<LocalAddress>(3)).ToAssembly(),
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "@LCL\n"
+            "A=M+1\n"
+            "A=A+1\n"
+            "A=A+1\n"
+            "M=D\n");
+}
+
+TEST(PopCommandTest, PointerAddressedCostModel) {
+  // Small indices count up to the address, larger ones exchange the address
+  // and the value through their sum.
+  struct {
+    uint16_t index;
+    bool top_in_d;
+    std::string assembly;
+  } const cases[] = {
+      {0, false, "@SP\nAM=M-1\nD=M\n@LCL\nA=M\nM=D\n"},
+      {4, false,
+       "@SP\nAM=M-1\nD=M\n@LCL\nA=M+1\nA=A+1\nA=A+1\nA=A+1\nM=D\n"},
+      {5, false, "@5\nD=A\n@LCL\nD=D+M\n@SP\nAM=M-1\nD=D+M\nA=D-M\nM=D-A\n"},
+      {1, true, "@LCL\nA=M+1\nM=D\n"},
+      {8, true,
+       "@LCL\nA=M+1\nA=A+1\nA=A+1\nA=A+1\nA=A+1\nA=A+1\nA=A+1\nA=A+1\n"
+       "M=D\n"},
+      {9, true,
+       "@R13\nM=D\n@9\nD=A\n@LCL\nD=D+M\n@R13\nD=D+M\nA=D-M\nM=D-A\n"},
+  };
+  for (const auto &c : cases) {
+    SCOPED_TRACE(c.index);
+    StackState stack;
+    stack.top_in_d = c.top_in_d;
+    HackProgram program;
+    PopCommand(std::make_unique<LocalAddress>(c.index))
+        .LowerCached(&stack, &program);
+    EXPECT_EQ(program.ToAssembly(), c.assembly);
+    EXPECT_FALSE(stack.top_in_d);
+  }
+}
+
+TEST(PushCommandTest, ImmediateConstants) {
+  EXPECT_EQ(
+      PushCommand(std::make_unique<ConstantAddress>(static_cast<uint16_t>(-1)))
+          .ToAssembly(),
+            "@SP\n"
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=-1\n");
+}
+
 TEST(LabelCommandTest, LabelCommand) {
   EXPECT_EQ(LabelCommand("Foo.f$L1").ToAssembly(), "(Foo.f$L1)\n");
 }
@@ -419,6 +464,40 @@ TEST(CallCommandTest, CallCommand) {
             "(Caller_123$ret)\n");
 }
 
+TEST(CallCommandTest, LightFrame) {
+  EXPECT_EQ(CallCommand("Callee.callee", 1, "Caller_123$ret",
+                        FrameLayout::kLight)
+                .ToAssembly(),
+            "@Caller_123$ret\n"
+            "D=A\n"
+            "@SP\n"
+            "A=M\n"
+            "M=D\n"
+            "@LCL\n"
+            "D=M\n"
+            "@SP\n"
+            "AM=M+1\n"
+            "M=D\n"
+            "@ARG\n"
+            "D=M\n"
+            "@SP\n"
+            "AM=M+1\n"
+            "M=D\n"
+            "@SP\n"
+            "MD=M+1\n"
+            "@4\n"
+            "D=D-A\n"
+            "@ARG\n"
+            "M=D\n"
+            "@SP\n"
+            "D=M\n"
+            "@LCL\n"
+            "M=D\n"
+            "@Callee.callee\n"
+            "0;JMP\n"
+            "(Caller_123$ret)\n");
+}
+
 TEST(FunctionCommandTest, FunctionCommand) {
   EXPECT_EQ(FunctionCommand("Foo.f", 0).ToAssembly(), "(Foo.f)\n");
   EXPECT_EQ(FunctionCommand("Foo.f", 1).ToAssembly(),
@@ -453,6 +532,57 @@ TEST(FunctionCommandTest, FunctionCommand) {
             "M=M+1\n");
 }
 
+TEST(FunctionCommandTest, LoopedLocalInitialization) {
+  EXPECT_EQ(FunctionCommand("Foo.f", 20, LocalInitialization::kLooped)
+                .ToAssembly(),
+            "(Foo.f)\n"
+            "@20\n"
+            "D=A\n"
+            "(Foo.f$$ZERO_LOCALS)\n"
+            "@SP\n"
+            "AM=M+1\n"
+            "A=A-1\n"
+            "M=0\n"
+            "@Foo.f$$ZERO_LOCALS\n"
+            "D=D-1;JGT\n");
+}
+
+TEST(FunctionCommandTest, SharedLocalInitialization) {
+  SharedRoutines routines;
+  EXPECT_EQ(FunctionCommand("Foo.f", 3, LocalInitialization::kShared,
+                            &routines)
+                .ToAssembly(),
+            "(Foo.f)\n"
+            "@Foo.f$$ZERO_LOCALS\n"
+            "D=A\n"
+            "@$ZERO_LOCALS3\n"
+            "0;JMP\n"
+            "(Foo.f$$ZERO_LOCALS)\n");
+  FunctionCommand("Foo.g", 2, LocalInitialization::kShared, &routines)
+      .ToAssembly();
+
+  // Entries for fewer locals fall through the stores of the entries above.
+  HackProgram program;
+  routines.Lower(&program);
+  EXPECT_EQ(program.ToAssembly(),
+            "($ZERO_LOCALS3)\n"
+            "@SP\n"
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=0\n"
+            "($ZERO_LOCALS2)\n"
+            "@SP\n"
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=0\n"
+            "@SP\n"
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=0\n"
+            "A=D\n"
+            "0;JMP\n");
+}
+
 TEST(ReturnCommandTest, ReturnCommand) {
   EXPECT_EQ(ReturnCommand().ToAssembly(),
             "@5\n"
@@ -502,3 +632,398 @@ TEST(ReturnCommandTest, ReturnCommand) {
             "A=M\n"
             "0;JMP\n");
 }
+
+TEST(ReturnCommandTest, LightFrame) {
+  EXPECT_EQ(ReturnCommand(FrameLayout::kLight).ToAssembly(),
+            "@3\n"
+            "D=A\n"
+            "@LCL\n"
+            "A=M-D\n"
+            "D=M\n"
+            "@R15\n"
+            "M=D\n"
+            "@SP\n"
+            "A=M-1\n"
+            "D=M\n"
+            "@ARG\n"
+            "A=M\n"
+            "M=D\n"
+            "@ARG\n"
+            "D=M+1\n"
+            "@SP\n"
+            "M=D\n"
+            "@LCL\n"
+            "A=M-1\n"
+            "D=M\n"
+            "@ARG\n"
+            "M=D\n"
+            "@2\n"
+            "D=A\n"
+            "@LCL\n"
+            "A=M-D\n"
+            "D=M\n"
+            "@LCL\n"
+            "M=D\n"
+            "@R15\n"
+            "A=M\n"
+            "0;JMP\n");
+}
+
+TEST(MoveCommandTest, DirectDestination) {
+  EXPECT_EQ(MoveCommand(std::make_unique<LocalAddress>(5),
+                        std::make_unique<TempAddress>(1))
+                .ToAssembly(),
+            "@5\n"
+            "D=A\n"
+            "@LCL\n"
+            "A=D+M\n"
+            "D=M\n"
+            "@6\n"
+            "M=D\n");
+}
+
+TEST(MoveCommandTest, PointerAddressedDestination) {
+  EXPECT_EQ(MoveCommand(std::make_unique<ConstantAddress>(7),
+                        std::make_unique<ThatAddress>(2))
+                .ToAssembly(),
+            "@7\n"
+            "D=A\n"
+            "@THAT\n"
+            "A=M+1\n"
+            "A=A+1\n"
+            "M=D\n");
+  EXPECT_EQ(MoveCommand(std::make_unique<ConstantAddress>(7),
+                        std::make_unique<ThatAddress>(12))
+                .ToAssembly(),
+            "@12\n"
+            "D=A\n"
+            "@THAT\n"
+            "D=D+M\n"
+            "@R15\n"
+            "M=D\n"
+            "@7\n"
+            "D=A\n"
+            "@R15\n"
+            "A=M\n"
+            "M=D\n");
+  EXPECT_EQ(MoveCommand(std::make_unique<ConstantAddress>(0),
+                        std::make_unique<ThatAddress>(12))
+                .ToAssembly(),
+            "@12\n"
+            "D=A\n"
+            "@THAT\n"
+            "A=D+M\n"
+            "M=0\n");
+}
+
+TEST(ConstantArithmeticCommandTest, ConstantArithmeticCommand) {
+  EXPECT_EQ(ConstantArithmeticCommand(Computation::kMMinusD, 3).ToAssembly(),
+            "@3\n"
+            "D=A\n"
+            "@SP\n"
+            "A=M-1\n"
+            "M=M-D\n");
+}
+
+TEST(CommentCommandTest, CommentCommand) {
+  EXPECT_EQ(CommentCommand("Foo.vm:1: add").ToAssembly(), "// Foo.vm:1: add\n");
+}
+
+TEST(CompareJumpCommandTest, CompareJumpCommand) {
+  EXPECT_EQ(CompareJumpCommand(Jump::kJlt, "Foo.f$LOOP").ToAssembly(),
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "A=A-1\n"
+            "D=M-D\n"
+            "@SP\n"
+            "M=M-1\n"
+            "@Foo.f$LOOP\n"
+            "D;JLT\n");
+}
+
+TEST(LoadJumpCommandTest, LoadJumpCommand) {
+  EXPECT_EQ(LoadJumpCommand(std::make_unique<ArgumentAddress>(0), "Foo.f$LOOP")
+                .ToAssembly(),
+            "@ARG\n"
+            "A=M\n"
+            "D=M\n"
+            "@Foo.f$LOOP\n"
+            "D;JNE\n");
+}
+
+TEST(LowerCommandsTest, CachesTopOfStack) {
+  CommandList commands;
+  commands.push_back(
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)));
+  commands.push_back(
+      std::make_unique<PushCommand>(std::make_unique<StaticAddress>("Foo", 1)));
+  commands.push_back(std::make_unique<AddCommand>());
+  commands.push_back(std::make_unique<NegCommand>());
+  commands.push_back(std::make_unique<IfGotoCommand>("Foo.f$L"));
+  commands.push_back(
+      std::make_unique<PushCommand>(std::make_unique<ConstantAddress>(3)));
+  commands.push_back(std::make_unique<LabelCommand>("Foo.f$L"));
+  HackProgram program;
+  LowerCommands(commands, /*cache_stack=*/true, &program);
+  EXPECT_EQ(program.ToAssembly(),
+            "@ARG\n"
+            "A=M\n"
+            "D=M\n"
+            "@SP\n"
+            "A=M\n"
+            "M=D\n"
+            "@Foo.1\n"
+            "D=M\n"
+            "@SP\n"
+            "A=M\n"
+            "D=D+M\n"
+            "D=-D\n"
+            "@Foo.f$L\n"
+            "D;JNE\n"
+            "@3\n"
+            "D=A\n"
+            "@SP\n"
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n"
+            "(Foo.f$L)\n");
+}
+
+TEST(LowerCommandsTest, AddressesStackRelativeToSp) {
+  CommandList commands;
+  for (uint16_t index = 0; index < 3; ++index) {
+    commands.push_back(
+        std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(index)));
+  }
+  commands.push_back(std::make_unique<AddCommand>());
+  commands.push_back(
+      std::make_unique<PopCommand>(std::make_unique<TempAddress>(0)));
+  HackProgram program;
+  LowerCommands(commands, /*cache_stack=*/true, &program);
+  EXPECT_EQ(program.ToAssembly(),
+            "@ARG\n"
+            "A=M\n"
+            "D=M\n"
+            "@SP\n"
+            "A=M\n"
+            "M=D\n"
+            "@ARG\n"
+            "A=M+1\n"
+            "D=M\n"
+            "@SP\n"
+            "A=M+1\n"
+            "M=D\n"
+            "@ARG\n"
+            "A=M+1\n"
+            "A=A+1\n"
+            "D=M\n"
+            "@SP\n"
+            "A=M+1\n"
+            "D=D+M\n"
+            "@5\n"
+            "M=D\n"
+            "@SP\n"
+            "M=M+1\n");
+}
+
+TEST(LowerCommandsTest, WithoutCaching) {
+  CommandList commands;
+  commands.push_back(std::make_unique<AddCommand>());
+  HackProgram program;
+  LowerCommands(commands, /*cache_stack=*/false, &program);
+  EXPECT_EQ(program.ToAssembly(), AddCommand().ToAssembly());
+}
+
+TEST(SharedBinaryCommandTest, CallsSharedRoutine) {
+  SharedRoutines routines;
+  EXPECT_EQ(SharedBinaryCommand(SharedRoutines::kGt, "Foo_3$gt_end",
+                                    &routines)
+                .ToAssembly(),
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "@R13\n"
+            "M=D\n"
+            "@Foo_3$gt_end\n"
+            "D=A\n"
+            "@$GT\n"
+            "0;JMP\n"
+            "(Foo_3$gt_end)\n"
+            "@SP\n"
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
+
+  HackProgram program;
+  routines.Lower(&program);
+  EXPECT_EQ(program.ToAssembly(),
+            "($GT)\n"
+            "@R15\n"
+            "M=D\n"
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "@R13\n"
+            "D=D-M\n"
+            "@$COMPARE_TRUE\n"
+            "D;JGT\n"
+            "($COMPARE_FALSE)\n"
+            "D=0\n"
+            "@R15\n"
+            "A=M\n"
+            "0;JMP\n"
+            "($COMPARE_TRUE)\n"
+            "D=-1\n"
+            "@R15\n"
+            "A=M\n"
+            "0;JMP\n");
+}
+
+TEST(SharedRoutinesTest, LowersNothingWhenUnused) {
+  HackProgram program;
+  SharedRoutines().Lower(&program);
+  EXPECT_EQ(program.InstructionCount(), 0);
+}
+
+TEST(SharedCallCommandTest, CallsSharedRoutine) {
+  SharedRoutines routines;
+  EXPECT_EQ(SharedCallCommand("Foo.bar", 2, "Foo.f$ret.1",
+                              FrameLayout::kStandard, &routines)
+                .ToAssembly(),
+            "@Foo.bar\n"
+            "D=A\n"
+            "@R13\n"
+            "M=D\n"
+            "@Foo.f$ret.1\n"
+            "D=A\n"
+            "@$CALL2\n"
+            "0;JMP\n"
+            "(Foo.f$ret.1)\n");
+  EXPECT_EQ(SharedReturnCommand(FrameLayout::kStandard, &routines)
+                .ToAssembly(),
+            "@$RETURN\n"
+            "0;JMP\n");
+  SharedCallCommand("Foo.baz", 0, "Foo.f$ret.2", FrameLayout::kStandard,
+                    &routines)
+      .ToAssembly();
+
+  HackProgram program;
+  routines.Lower(&program);
+  HackProgram expected;
+  expected.AppendLabel("$CALL0");
+  expected.AppendAddress("SP");
+  expected.AppendCompute(Destination::kA, Computation::kM);
+  expected.AppendCompute(Destination::kM, Computation::kD);
+  expected.AppendCompute(Destination::kD, Computation::kZero);
+  expected.AppendAddress("R14");
+  expected.AppendCompute(Destination::kM, Computation::kD);
+  expected.AppendAddress("$CALL");
+  expected.AppendCompute(0, Computation::kZero, Jump::kJmp);
+  expected.AppendLabel("$CALL2");
+  expected.AppendAddress("SP");
+  expected.AppendCompute(Destination::kA, Computation::kM);
+  expected.AppendCompute(Destination::kM, Computation::kD);
+  expected.AppendAddress(2);
+  expected.AppendCompute(Destination::kD, Computation::kA);
+  expected.AppendAddress("R14");
+  expected.AppendCompute(Destination::kM, Computation::kD);
+  std::string assembly = program.ToAssembly();
+  // The call routine follows the last entry, then the return routine.
+  std::string call_routine = expected.ToAssembly() + "($CALL)\n";
+  EXPECT_EQ(assembly.substr(0, call_routine.size()), call_routine);
+  std::string return_routine = "($RETURN)\n" + ReturnCommand().ToAssembly();
+  EXPECT_EQ(assembly.substr(assembly.size() - return_routine.size()),
+            return_routine);
+}
+
+TEST(StaticFrameTest, StaticCallCommand) {
+  StaticFrame frame{"$FRAME.0", {}, {"$FRAME.1", "$FRAME.2"}, {}};
+  EXPECT_EQ(StaticCallCommand("Callee.callee", "Caller_123$ret", frame)
+                .ToAssembly(),
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "@$FRAME.2\n"
+            "M=D\n"
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "@$FRAME.1\n"
+            "M=D\n"
+            "@Caller_123$ret\n"
+            "D=A\n"
+            "@$FRAME.0\n"
+            "M=D\n"
+            "@Callee.callee\n"
+            "0;JMP\n"
+            "(Caller_123$ret)\n");
+}
+
+TEST(StaticFrameTest, StaticFunctionAndReturnCommands) {
+  StaticFrame frame{"$FRAME.0", {"$FRAME.1", "$FRAME.2"}, {}, {"$FRAME.3"}};
+  EXPECT_EQ(StaticFunctionCommand("Foo.f", frame).ToAssembly(),
+            "(Foo.f)\n"
+            "@THIS\n"
+            "D=M\n"
+            "@$FRAME.1\n"
+            "M=D\n"
+            "@THAT\n"
+            "D=M\n"
+            "@$FRAME.2\n"
+            "M=D\n"
+            "@$FRAME.3\n"
+            "M=0\n");
+  EXPECT_EQ(StaticReturnCommand(frame).ToAssembly(),
+            "@$FRAME.1\n"
+            "D=M\n"
+            "@THIS\n"
+            "M=D\n"
+            "@$FRAME.2\n"
+            "D=M\n"
+            "@THAT\n"
+            "M=D\n"
+            "@$FRAME.0\n"
+            "A=M\n"
+            "0;JMP\n");
+}
+
+TEST(TailCallCommandTest, ReusesFrame) {
+  EXPECT_EQ(TailCallCommand("Foo.f", 1).ToAssembly(),
+            PopCommand(std::make_unique<ArgumentAddress>(0)).ToAssembly() +
+                "@LCL\n"
+                "D=M\n"
+                "@SP\n"
+                "M=D\n"
+                "@Foo.f\n"
+                "0;JMP\n");
+}
+
+TEST(PeekCommandTest, PeekCommand) {
+  EXPECT_EQ(PeekCommand().ToAssembly(),
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "A=D\n"
+            "D=M\n"
+            "@SP\n"
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
+}
+
+TEST(PokeCommandTest, PokeCommand) {
+  EXPECT_EQ(PokeCommand().ToAssembly(),
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "@SP\n"
+            "AM=M-1\n"
+            "A=M\n"
+            "M=D\n"
+            "D=0\n"
+            "@SP\n"
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
+}
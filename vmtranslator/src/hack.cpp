@@ -0,0 +1,376 @@
+#include "hack.h"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+
+std::string_view ComputationString(Computation computation) {
+  switch (computation) {
+    case Computation::kZero:
+      return "0";
+    case Computation::kOne:
+      return "1";
+    case Computation::kMinusOne:
+      return "-1";
+    case Computation::kD:
+      return "D";
+    case Computation::kA:
+      return "A";
+    case Computation::kNotD:
+      return "!D";
+    case Computation::kNotA:
+      return "!A";
+    case Computation::kNegD:
+      return "-D";
+    case Computation::kNegA:
+      return "-A";
+    case Computation::kDPlusOne:
+      return "D+1";
+    case Computation::kAPlusOne:
+      return "A+1";
+    case Computation::kDMinusOne:
+      return "D-1";
+    case Computation::kAMinusOne:
+      return "A-1";
+    case Computation::kDPlusA:
+      return "D+A";
+    case Computation::kDMinusA:
+      return "D-A";
+    case Computation::kAMinusD:
+      return "A-D";
+    case Computation::kDAndA:
+      return "D&A";
+    case Computation::kDOrA:
+      return "D|A";
+    case Computation::kM:
+      return "M";
+    case Computation::kNotM:
+      return "!M";
+    case Computation::kNegM:
+      return "-M";
+    case Computation::kMPlusOne:
+      return "M+1";
+    case Computation::kMMinusOne:
+      return "M-1";
+    case Computation::kDPlusM:
+      return "D+M";
+    case Computation::kDMinusM:
+      return "D-M";
+    case Computation::kMMinusD:
+      return "M-D";
+    case Computation::kDAndM:
+      return "D&M";
+    case Computation::kDOrM:
+      return "D|M";
+  }
+  LOG(FATAL) << "Invalid computation: " << static_cast<int>(computation);
+  return "";
+}
+
+std::string_view JumpString(Jump jump) {
+  static constexpr std::string_view kJumpStrings[8] = {
+      "", "JGT", "JEQ", "JGE", "JLT", "JNE", "JLE", "JMP"};
+  return kJumpStrings[static_cast<uint8_t>(jump)];
+}
+
+Jump NegateJump(Jump jump) {
+  return static_cast<Jump>(static_cast<uint8_t>(Jump::kJmp) -
+                           static_cast<uint8_t>(jump));
+}
+
+bool ReadsMemory(Computation computation) {
+  return static_cast<uint8_t>(computation) & 0b1000000;
+}
+
+uint16_t Evaluate(Computation computation, uint16_t d, uint16_t a_or_m) {
+  uint8_t bits = static_cast<uint8_t>(computation);
+  uint16_t x = bits & 0b100000 ? 0 : d;
+  if (bits & 0b010000) {
+    x = ~x;
+  }
+  uint16_t y = bits & 0b001000 ? 0 : a_or_m;
+  if (bits & 0b000100) {
+    y = ~y;
+  }
+  uint16_t result = bits & 0b000010 ? x + y : x & y;
+  return bits & 0b000001 ? ~result : result;
+}
+
+bool Instruction::IsReal() const {
+  return kind == kAddress || kind == kSymbol || kind == kCompute;
+}
+
+uint32_t HackProgram::Intern(std::string_view symbol) {
+  auto it = symbol_ids_.find(symbol);
+  if (it != symbol_ids_.end()) {
+    return it->second;
+  }
+  uint32_t id = symbols_.size();
+  symbols_.emplace_back(symbol);
+  symbol_ids_.emplace(symbol, id);
+  return id;
+}
+
+std::string_view HackProgram::symbol(uint32_t id) const {
+  return symbols_[id];
+}
+
+std::string_view HackProgram::comment(uint32_t id) const {
+  return comments_[id];
+}
+
+void HackProgram::AppendAddress(uint16_t value) {
+  CHECK_LT(value, 1 << 15) << "Address out of range: " << value;
+  instructions_.push_back(
+      {Instruction::kAddress, Computation::kZero, 0, Jump::kNull, value});
+}
+
+void HackProgram::AppendAddress(std::string_view symbol) {
+  instructions_.push_back({Instruction::kSymbol, Computation::kZero, 0,
+                           Jump::kNull, Intern(symbol)});
+}
+
+void HackProgram::AppendCompute(uint8_t destination, Computation computation,
+                                Jump jump) {
+  instructions_.push_back(
+      {Instruction::kCompute, computation, destination, jump, 0});
+}
+
+void HackProgram::AppendLabel(std::string_view symbol) {
+  instructions_.push_back({Instruction::kLabel, Computation::kZero, 0,
+                           Jump::kNull, Intern(symbol)});
+}
+
+void HackProgram::AppendComment(std::string_view comment) {
+  instructions_.push_back({Instruction::kComment, Computation::kZero, 0,
+                           Jump::kNull,
+                           static_cast<uint32_t>(comments_.size())});
+  comments_.emplace_back(comment);
+}
+
+void HackProgram::Append(const Instruction &instruction) {
+  instructions_.push_back(instruction);
+}
+
+void HackProgram::Append(const HackProgram &other) {
+  std::vector<uint32_t> symbol_map;
+  symbol_map.reserve(other.symbols_.size());
+  for (const std::string &symbol : other.symbols_) {
+    symbol_map.push_back(Intern(symbol));
+  }
+  uint32_t comment_offset = comments_.size();
+  comments_.insert(comments_.end(), other.comments_.begin(),
+                   other.comments_.end());
+
+  instructions_.reserve(instructions_.size() + other.instructions_.size());
+  for (Instruction instruction : other.instructions_) {
+    if (instruction.kind == Instruction::kSymbol ||
+        instruction.kind == Instruction::kLabel) {
+      instruction.operand = symbol_map[instruction.operand];
+    } else if (instruction.kind == Instruction::kComment) {
+      instruction.operand += comment_offset;
+    }
+    instructions_.push_back(instruction);
+  }
+}
+
+size_t HackProgram::InstructionCount() const {
+  size_t count = 0;
+  for (const Instruction &instruction : instructions_) {
+    count += instruction.IsReal();
+  }
+  return count;
+}
+
+std::vector<Instruction> &HackProgram::instructions() { return instructions_; }
+
+const std::vector<Instruction> &HackProgram::instructions() const {
+  return instructions_;
+}
+
+void HackProgram::WriteAssembly(std::ostream &os) const {
+  static constexpr std::string_view kDestinationStrings[8] = {
+      "", "M=", "D=", "MD=", "A=", "AM=", "AD=", "AMD="};
+  for (const Instruction &instruction : instructions_) {
+    switch (instruction.kind) {
+      case Instruction::kAddress:
+        os << '@' << instruction.operand << '\n';
+        break;
+      case Instruction::kSymbol:
+        os << '@' << symbols_[instruction.operand] << '\n';
+        break;
+      case Instruction::kCompute:
+        os << kDestinationStrings[instruction.destination]
+           << ComputationString(instruction.computation);
+        if (instruction.jump != Jump::kNull) {
+          os << ';' << JumpString(instruction.jump);
+        }
+        os << '\n';
+        break;
+      case Instruction::kLabel:
+        os << '(' << symbols_[instruction.operand] << ")\n";
+        break;
+      case Instruction::kComment:
+        os << "// " << comments_[instruction.operand] << '\n';
+        break;
+    }
+  }
+}
+
+std::string HackProgram::ToAssembly() const {
+  std::ostringstream os;
+  WriteAssembly(os);
+  return os.str();
+}
+
+std::vector<uint16_t> HackProgram::Assemble() const {
+  static constexpr std::pair<std::string_view, uint16_t>
+      kPredefinedSymbols[] = {
+          {"R0", 0},   {"R1", 1},         {"R2", 2},      {"R3", 3},
+          {"R4", 4},   {"R5", 5},         {"R6", 6},      {"R7", 7},
+          {"R8", 8},   {"R9", 9},         {"R10", 10},    {"R11", 11},
+          {"R12", 12}, {"R13", 13},       {"R14", 14},    {"R15", 15},
+          {"SCREEN", 16384}, {"KBD", 24576}, {"SP", 0},   {"LCL", 1},
+          {"ARG", 2},  {"THIS", 3},       {"THAT", 4}};
+  constexpr int32_t kUnresolved = -1;
+
+  std::vector<int32_t> addresses(symbols_.size(), kUnresolved);
+  for (const auto &[symbol, address] : kPredefinedSymbols) {
+    auto it = symbol_ids_.find(symbol);
+    if (it != symbol_ids_.end()) {
+      addresses[it->second] = address;
+    }
+  }
+
+  // First pass: labels.
+  uint16_t instruction_counter = 0;
+  for (const Instruction &instruction : instructions_) {
+    if (instruction.kind == Instruction::kLabel) {
+      addresses[instruction.operand] = instruction_counter;
+    } else if (instruction.IsReal()) {
+      ++instruction_counter;
+    }
+  }
+
+  // Second pass: variables and encoding.
+  std::vector<uint16_t> machine_code;
+  machine_code.reserve(instruction_counter);
+  uint16_t variable_address = 16;
+  for (const Instruction &instruction : instructions_) {
+    switch (instruction.kind) {
+      case Instruction::kAddress:
+        machine_code.push_back(instruction.operand);
+        break;
+      case Instruction::kSymbol:
+        if (addresses[instruction.operand] == kUnresolved) {
+          addresses[instruction.operand] = variable_address++;
+        }
+        machine_code.push_back(addresses[instruction.operand]);
+        break;
+      case Instruction::kCompute:
+        machine_code.push_back(
+            0b111 << 13 | static_cast<uint16_t>(instruction.computation) << 6 |
+            instruction.destination << 3 |
+            static_cast<uint16_t>(instruction.jump));
+        break;
+      case Instruction::kLabel:
+      case Instruction::kComment:
+        break;
+    }
+  }
+  return machine_code;
+}
+
+void HackProgram::WriteMachineCode(std::ostream &os) const {
+  for (uint16_t word : Assemble()) {
+    char line[17];
+    for (int i = 0; i < 16; ++i) {
+      line[i] = '0' + (word >> (15 - i) & 1);
+    }
+    line[16] = '\n';
+    os.write(line, sizeof(line));
+  }
+}
+
+void HackProgram::WriteBinary(std::ostream &os) const {
+  for (uint16_t word : Assemble()) {
+    os.put(static_cast<char>(word >> 8));
+    os.put(static_cast<char>(word & 0xFF));
+  }
+}
+
+void HackPassManager::AddPass(std::unique_ptr<HackPass> pass) {
+  passes_.push_back(std::move(pass));
+  absl::MutexLock lock(&mutex_);
+  removed_counts_.push_back(0);
+}
+
+void HackPassManager::Run(HackProgram *program) const {
+  std::vector<int64_t> removed_counts;
+  removed_counts.reserve(passes_.size());
+  for (const std::unique_ptr<HackPass> &pass : passes_) {
+    int64_t before = program->InstructionCount();
+    pass->Run(program);
+    removed_counts.push_back(before - program->InstructionCount());
+  }
+
+  absl::MutexLock lock(&mutex_);
+  for (size_t i = 0; i < passes_.size(); ++i) {
+    removed_counts_[i] += removed_counts[i];
+  }
+}
+
+void HackPassManager::LogStatistics() const {
+  absl::MutexLock lock(&mutex_);
+  for (size_t i = 0; i < passes_.size(); ++i) {
+    LOG(INFO) << "Pass " << passes_[i]->name() << " removed "
+              << removed_counts_[i] << " instructions";
+  }
+}
+
+std::string_view RedundantAddressPass::name() const {
+  return "redundant-address";
+}
+
+void RedundantAddressPass::Run(HackProgram *program) const {
+  std::vector<Instruction> &instructions = program->instructions();
+  // The address instruction whose value the A register is known to hold.
+  const Instruction *known = nullptr;
+  size_t size = 0;
+  for (size_t i = 0; i < instructions.size(); ++i) {
+    const Instruction &instruction = instructions[i];
+    switch (instruction.kind) {
+      case Instruction::kAddress:
+      case Instruction::kSymbol:
+        if (known && known->kind == instruction.kind &&
+            known->operand == instruction.operand) {
+          continue;
+        }
+        instructions[size] = instruction;
+        known = &instructions[size];
+        ++size;
+        continue;
+      case Instruction::kCompute:
+        if (instruction.destination & Destination::kA) {
+          known = nullptr;
+        }
+        break;
+      case Instruction::kLabel:
+        // Control may reach a label from anywhere.
+        known = nullptr;
+        break;
+      case Instruction::kComment:
+        break;
+    }
+    instructions[size++] = instruction;
+  }
+  instructions.resize(size);
+}
@@ -0,0 +1,174 @@
+#ifndef NAND2TETRIS_VMTRANSLATOR_HACK_H_
+#define NAND2TETRIS_VMTRANSLATOR_HACK_H_
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+
+enum Destination {
+  kA = 4,
+  kD = 2,
+  kM = 1,
+};
+
+// The computation field of a C-instruction. Each enumerator's value is the
+// machine encoding of the `a` bit followed by bits `c1` to `c6`.
+enum class Computation : uint8_t {
+  kZero = 0b0101010,
+  kOne = 0b0111111,
+  kMinusOne = 0b0111010,
+  kD = 0b0001100,
+  kA = 0b0110000,
+  kNotD = 0b0001101,
+  kNotA = 0b0110001,
+  kNegD = 0b0001111,
+  kNegA = 0b0110011,
+  kDPlusOne = 0b0011111,
+  kAPlusOne = 0b0110111,
+  kDMinusOne = 0b0001110,
+  kAMinusOne = 0b0110010,
+  kDPlusA = 0b0000010,
+  kDMinusA = 0b0010011,
+  kAMinusD = 0b0000111,
+  kDAndA = 0b0000000,
+  kDOrA = 0b0010101,
+  kM = 0b1110000,
+  kNotM = 0b1110001,
+  kNegM = 0b1110011,
+  kMPlusOne = 0b1110111,
+  kMMinusOne = 0b1110010,
+  kDPlusM = 0b1000010,
+  kDMinusM = 0b1010011,
+  kMMinusD = 0b1000111,
+  kDAndM = 0b1000000,
+  kDOrM = 0b1010101,
+};
+
+// The jump field of a C-instruction, in machine encoding order.
+enum class Jump : uint8_t {
+  kNull = 0,
+  kJgt = 1,
+  kJeq = 2,
+  kJge = 3,
+  kJlt = 4,
+  kJne = 5,
+  kJle = 6,
+  kJmp = 7,
+};
+
+std::string_view ComputationString(Computation computation);
+std::string_view JumpString(Jump jump);
+
+// The jump taken exactly when `jump` is not, such as `kJle` for `kJgt`.
+Jump NegateJump(Jump jump);
+
+// Whether `computation` reads the M register.
+bool ReadsMemory(Computation computation);
+
+// Computes `computation` the way the Hack ALU does, where `a_or_m` is the value
+// of A or M depending on the computation.
+uint16_t Evaluate(Computation computation, uint16_t d, uint16_t a_or_m);
+
+// A single Hack instruction or pseudo-instruction. Symbols and comments are
+// referred to by ids into the owning `HackProgram`, which keeps instructions
+// small and cheap to compare and rewrite.
+struct Instruction {
+  enum Kind : uint8_t {
+    kAddress,  // @value
+    kSymbol,   // @symbol
+    kCompute,  // dest=comp;jump
+    kLabel,    // (symbol)
+    kComment,  // // comment
+  };
+
+  Kind kind;
+  Computation computation;
+  uint8_t destination;  // Bitmask of `Destination`.
+  Jump jump;
+  // The value of an address instruction, or the id of a symbol or comment.
+  uint32_t operand;
+
+  // Whether this instruction occupies a word of ROM.
+  bool IsReal() const;
+};
+
+class HackProgram {
+ public:
+  // Returns the id of `symbol`, adding it to the symbol table if needed.
+  uint32_t Intern(std::string_view symbol);
+  std::string_view symbol(uint32_t id) const;
+  std::string_view comment(uint32_t id) const;
+
+  void AppendAddress(uint16_t value);
+  void AppendAddress(std::string_view symbol);
+  void AppendCompute(uint8_t destination, Computation computation,
+                     Jump jump = Jump::kNull);
+  void AppendLabel(std::string_view symbol);
+  void AppendComment(std::string_view comment);
+  void Append(const Instruction &instruction);
+  // Appends every instruction of `other`, translating its symbol and comment
+  // ids to ids of this program.
+  void Append(const HackProgram &other);
+
+  // Number of instructions that occupy a word of ROM.
+  size_t InstructionCount() const;
+
+  std::vector<Instruction> &instructions();
+  const std::vector<Instruction> &instructions() const;
+
+  void WriteAssembly(std::ostream &os) const;
+  std::string ToAssembly() const;
+
+  // Resolves labels and variables the same way the Hack assembler does and
+  // returns the machine code of the program.
+  std::vector<uint16_t> Assemble() const;
+  // Writes machine code as text, one 16-digit binary word per line.
+  void WriteMachineCode(std::ostream &os) const;
+  // Writes machine code as packed big-endian 16-bit words.
+  void WriteBinary(std::ostream &os) const;
+
+ private:
+  std::vector<Instruction> instructions_;
+  std::vector<std::string> symbols_;
+  absl::flat_hash_map<std::string, uint32_t> symbol_ids_;
+  std::vector<std::string> comments_;
+};
+
+class HackPass {
+ public:
+  virtual ~HackPass() = default;
+  virtual std::string_view name() const = 0;
+  virtual void Run(HackProgram *program) const = 0;
+};
+
+// Runs passes over programs. `Run()` may be called concurrently from multiple
+// threads, for example on separately translated parts of a program.
+class HackPassManager {
+ public:
+  void AddPass(std::unique_ptr<HackPass> pass);
+  void Run(HackProgram *program) const;
+  // Logs the number of instructions each pass has removed in all runs.
+  void LogStatistics() const;
+
+ private:
+  std::vector<std::unique_ptr<HackPass>> passes_;
+  mutable absl::Mutex mutex_;
+  mutable std::vector<int64_t> removed_counts_ ABSL_GUARDED_BY(mutex_);
+};
+
+// Removes address instructions that load the value already held in the A
+// register, such as the `@SP` following `@SP` `M=M+1`.
+class RedundantAddressPass : public HackPass {
+ public:
+  std::string_view name() const override;
+  void Run(HackProgram *program) const override;
+};
+
+#endif  // NAND2TETRIS_VMTRANSLATOR_HACK_H_
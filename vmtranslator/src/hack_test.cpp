@@ -0,0 +1,157 @@
+#include "hack.h"
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(EvaluateTest, Evaluate) {
+  EXPECT_EQ(Evaluate(Computation::kZero, 3, 5), 0);
+  EXPECT_EQ(Evaluate(Computation::kMinusOne, 3, 5), 0xFFFF);
+  EXPECT_EQ(Evaluate(Computation::kDPlusM, 3, 5), 8);
+  EXPECT_EQ(Evaluate(Computation::kMMinusD, 3, 5), 2);
+  EXPECT_EQ(Evaluate(Computation::kDMinusA, 3, 5), 0xFFFE);
+  EXPECT_EQ(Evaluate(Computation::kDAndM, 3, 5), 1);
+  EXPECT_EQ(Evaluate(Computation::kDOrA, 3, 5), 7);
+  EXPECT_EQ(Evaluate(Computation::kNegM, 3, 5), 0xFFFB);
+  EXPECT_EQ(Evaluate(Computation::kNotD, 3, 5), 0xFFFC);
+  EXPECT_EQ(Evaluate(Computation::kAPlusOne, 3, 0x7FFF), 0x8000);
+}
+
+TEST(NegateJumpTest, NegateJump) {
+  EXPECT_EQ(NegateJump(Jump::kJgt), Jump::kJle);
+  EXPECT_EQ(NegateJump(Jump::kJeq), Jump::kJne);
+  EXPECT_EQ(NegateJump(Jump::kJlt), Jump::kJge);
+  EXPECT_EQ(NegateJump(Jump::kNull), Jump::kJmp);
+}
+
+TEST(HackProgramTest, ToAssembly) {
+  HackProgram program;
+  program.AppendAddress(256);
+  program.AppendCompute(Destination::kD, Computation::kA);
+  program.AppendAddress("SP");
+  program.AppendCompute(Destination::kA | Destination::kM,
+                        Computation::kMMinusOne);
+  program.AppendCompute(Destination::kD | Destination::kM,
+                        Computation::kMPlusOne);
+  program.AppendCompute(Destination::kA | Destination::kD | Destination::kM,
+                        Computation::kDOrM);
+  program.AppendLabel("Foo.f$L1");
+  program.AppendComment("Foo.vm:1: add");
+  program.AppendAddress("Foo.f$L1");
+  program.AppendCompute(0, Computation::kD, Jump::kJne);
+  EXPECT_EQ(program.ToAssembly(),
+            "@256\n"
+            "D=A\n"
+            "@SP\n"
+            "AM=M-1\n"
+            "MD=M+1\n"
+            "AMD=D|M\n"
+            "(Foo.f$L1)\n"
+            "// Foo.vm:1: add\n"
+            "@Foo.f$L1\n"
+            "D;JNE\n");
+  EXPECT_EQ(program.InstructionCount(), 8);
+}
+
+TEST(HackProgramTest, Intern) {
+  HackProgram program;
+  uint32_t sp = program.Intern("SP");
+  EXPECT_EQ(program.Intern("LCL"), sp + 1);
+  EXPECT_EQ(program.Intern("SP"), sp);
+  EXPECT_EQ(program.symbol(sp), "SP");
+}
+
+TEST(HackProgramTest, AppendProgram) {
+  HackProgram first;
+  first.AppendAddress("SP");
+  HackProgram second;
+  second.AppendAddress("LCL");
+  second.AppendComment("comment");
+  second.AppendLabel("SP");
+  first.Append(second);
+  EXPECT_EQ(first.ToAssembly(),
+            "@SP\n"
+            "@LCL\n"
+            "// comment\n"
+            "(SP)\n");
+  EXPECT_EQ(first.instructions()[0].operand, first.instructions()[3].operand);
+}
+
+TEST(HackProgramTest, Assemble) {
+  HackProgram program;
+  program.AppendAddress("Foo.0");
+  program.AppendLabel("LOOP");
+  program.AppendAddress("SP");
+  program.AppendCompute(Destination::kA | Destination::kM,
+                        Computation::kMMinusOne);
+  program.AppendAddress("Foo.1");
+  program.AppendAddress("Foo.0");
+  program.AppendAddress(21);
+  program.AppendAddress("LOOP");
+  program.AppendCompute(0, Computation::kD, Jump::kJne);
+  program.AppendAddress("END");
+  program.AppendLabel("END");
+  EXPECT_EQ(program.Assemble(),
+            std::vector<uint16_t>({16, 0, 0b1111110010101000, 17, 16, 21, 1,
+                                   0b1110001100000101, 9}));
+
+  std::ostringstream machine_code;
+  program.WriteMachineCode(machine_code);
+  EXPECT_EQ(machine_code.str().substr(0, 34),
+            "0000000000010000\n"
+            "0000000000000000\n");
+  std::ostringstream binary;
+  program.WriteBinary(binary);
+  EXPECT_EQ(binary.str().substr(0, 6),
+            std::string("\x00\x10\x00\x00\xFC\xA8", 6));
+}
+
+TEST(RedundantAddressPassTest, RemovesRedundantAddress) {
+  HackProgram program;
+  program.AppendAddress("SP");
+  program.AppendCompute(Destination::kM, Computation::kMPlusOne);
+  program.AppendAddress("SP");
+  program.AppendCompute(Destination::kA | Destination::kM,
+                        Computation::kMMinusOne);
+  program.AppendAddress("SP");
+  program.AppendCompute(Destination::kD, Computation::kA);
+  program.AppendAddress(5);
+  program.AppendAddress(5);
+  RedundantAddressPass().Run(&program);
+  EXPECT_EQ(program.ToAssembly(),
+            "@SP\n"
+            "M=M+1\n"
+            "AM=M-1\n"
+            "@SP\n"
+            "D=A\n"
+            "@5\n");
+}
+
+TEST(RedundantAddressPassTest, KeepsAddressAfterLabel) {
+  HackProgram program;
+  program.AppendAddress("SP");
+  program.AppendLabel("L");
+  program.AppendAddress("SP");
+  program.AppendCompute(0, Computation::kZero, Jump::kJmp);
+  program.AppendAddress("SP");
+  RedundantAddressPass().Run(&program);
+  EXPECT_EQ(program.ToAssembly(),
+            "@SP\n"
+            "(L)\n"
+            "@SP\n"
+            "0;JMP\n");
+}
+
+TEST(HackPassManagerTest, RunsPasses) {
+  HackProgram program;
+  program.AppendAddress(1);
+  program.AppendAddress(1);
+  HackPassManager pass_manager;
+  pass_manager.AddPass(std::make_unique<RedundantAddressPass>());
+  pass_manager.Run(&program);
+  EXPECT_EQ(program.InstructionCount(), 1);
+}
@@ -1,5 +1,14 @@
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "absl/flags/flag.h"
@@ -12,73 +21,308 @@
 #include "absl/strings/strip.h"
 
 #include "commands.h"
+#include "hack.h"
+#include "optimizer.h"
+#include "outlining.h"
+#include "parallel.h"
 #include "parser.h"
+#include "spsc_queue.h"
 
 ABSL_FLAG(bool, v, false, "verbose output, print assembly output to console");
 ABSL_FLAG(bool, d, false,
           "debug mode, write VM source lines as comments in assembly output");
+ABSL_FLAG(std::string, O, "none",
+          "optimization level: none, speed (prefer faster code) or size "
+          "(prefer smaller code)");
+ABSL_FLAG(int, inline_words, 64,
+          "maximum number of instructions of a function body inlined at each "
+          "call site with -O speed");
+ABSL_FLAG(int, unroll_locals, 16,
+          "maximum number of locals a function sets to 0 with unrolled stores, "
+          "or with -O size through a shared routine where that is shorter, "
+          "instead of a loop");
+ABSL_FLAG(std::vector<std::string>, intrinsics, {},
+          "comma-separated OS functions whose calls are replaced with Hack "
+          "code: Math.multiply, Math.divide, Memory.peek and Memory.poke");
+ABSL_FLAG(size_t, rom_budget, 0,
+          "with -O size, stop outlining repeated instruction sequences once "
+          "the program fits in this many words of ROM, 0 to outline all "
+          "that make it smaller");
+ABSL_FLAG(std::string, format, "asm",
+          "output format: asm (assembly code), hack (machine code as text) or "
+          "bin (machine code as packed big-endian 16-bit words)");
+ABSL_FLAG(int, jobs, 0,
+          "number of threads translating VM code concurrently, 0 for one per "
+          "hardware thread");
+ABSL_FLAG(size_t, segment_size, 1 << 16,
+          "minimum size in bytes of the parts, split at function commands, "
+          "that a VM file is divided into for concurrent translation");
+ABSL_FLAG(bool, pipeline, false,
+          "translate in a pipeline of parsing, lowering and writing threads");
+ABSL_FLAG(size_t, queue_size, 16,
+          "number of batches each queue between pipeline stages can hold");
+ABSL_FLAG(size_t, batch_size, 256,
+          "minimum number of VM commands in a batch passed between pipeline "
+          "stages");
+
+// Returns the code that sets up the stack and, for a multi-file program, calls
+// `Sys.init`.
+HackProgram Bootstrap(bool source_is_multi_file) {
+  HackProgram bootstrap;
+  bootstrap.AppendAddress(256);
+  bootstrap.AppendCompute(Destination::kD, Computation::kA);
+  bootstrap.AppendAddress("SP");
+  bootstrap.AppendCompute(Destination::kM, Computation::kD);
+
+  if (source_is_multi_file) {
+    CallCommand("Sys.init", 0, "END").Lower(&bootstrap);
+    // Although `Sys.init` is expected to enter an infinite loop, we still add
+    // an infinite loop in case `Sys.init` returns.
+    bootstrap.AppendAddress("END");
+    bootstrap.AppendLabel("END");
+    bootstrap.AppendCompute(0, Computation::kZero, Jump::kJmp);
+  }
+  return bootstrap;
+}
 
 class AssemblyFile {
  public:
-  AssemblyFile(std::string_view path, bool source_is_multi_file)
-      : file_(path.data()), source_is_multi_file_(source_is_multi_file) {
+  AssemblyFile(std::string_view path, bool source_is_multi_file,
+               std::string_view format)
+      : file_(path.data(), format == "bin"
+                               ? std::ios::out | std::ios::binary
+                               : std::ios::out),
+        source_is_multi_file_(source_is_multi_file),
+        format_(format) {
     QCHECK(file_.is_open()) << "Could not open output file: " << path;
     LOG(INFO) << "Output: " << path;
     LOG(INFO) << "Source is multi-file: " << source_is_multi_file;
+  }
 
-    // Bootstrap code.
-    file_ << "@256\n"
-          << "D=A\n"
-          << "@SP\n"
-          << "M=D\n";
-
-    if (source_is_multi_file_) {
-      file_ << CallCommand("Sys.init", 0, "END").ToAssembly();
-      // Although `Sys.init` is expected to enter an infinite loop, we still add
-      // an infinite loop in case `Sys.init` returns.
-      file_ << "@END\n"
-            << "(END)\n"
-            << "0;JMP\n";
+  ~AssemblyFile() {
+    if (format_ == "hack") {
+      program_.WriteMachineCode(file_);
+    } else if (format_ == "bin") {
+      program_.WriteBinary(file_);
+    } else {
+      program_.WriteAssembly(file_);
     }
+    file_.close();
   }
 
-  ~AssemblyFile() {
+  // Appends `program`, which the passes should already have been run over.
+  // The first program appended starts with the bootstrap code.
+  void Append(const HackProgram &program) { program_.Append(program); }
+
+  // Appends the end of the program: an infinite loop for a single-file program,
+  // which has no `Sys.init` to enter one, followed by `routines`, which are
+  // only entered by calls.
+  void AppendEnd(const HackProgram &routines) {
     if (!source_is_multi_file_) {
-      file_ << "@END\n"
-            << "(END)\n"
-            << "0;JMP\n";
+      program_.AppendAddress("END");
+      program_.AppendLabel("END");
+      program_.AppendCompute(0, Computation::kZero, Jump::kJmp);
     }
-    file_.close();
+    program_.Append(routines);
   }
 
-  template <class T>
-  AssemblyFile &operator<<(const T &value) {
-    file_ << value;
-    return *this;
+  // Runs `passes` over the whole program appended so far.
+  void RunPasses(const HackPassManager &passes) { passes.Run(&program_); }
+
+  // Writes the code appended so far. Machine code needs the address of every
+  // label, so it is only written when the file is closed.
+  void Flush() {
+    if (format_ == "asm") {
+      program_.WriteAssembly(file_);
+      program_ = HackProgram();
+    }
   }
 
  private:
   std::ofstream file_;
   bool source_is_multi_file_ = false;
+  std::string format_;
+  HackProgram program_;
 };
 
-void Translate(VmFile &vm_file, AssemblyFile &asm_file) {
-  while (vm_file.command()) {
-    if (absl::GetFlag(FLAGS_v)) {
-      LOG(INFO) << vm_file.line() << " ->\n" << vm_file.command()->ToAssembly();
+std::string DebugComment(VmFile &vm_file) {
+  return absl::StrCat(vm_file.path(), ":", vm_file.line_number(), ": ",
+                      vm_file.line());
+}
+
+// Moves the current command of `vm_file` to the end of `commands`, preceded by
+// a comment in debug mode, and advances `vm_file`.
+void TakeCommand(VmFile &vm_file, CommandList *commands) {
+  if (absl::GetFlag(FLAGS_v)) {
+    LOG(INFO) << vm_file.line() << " ->\n" << vm_file.command()->ToAssembly();
+  }
+  if (absl::GetFlag(FLAGS_d)) {
+    commands->push_back(std::make_unique<CommentCommand>(DebugComment(vm_file)));
+  }
+  commands->push_back(vm_file.TakeCommand());
+  vm_file.Advance();
+}
+
+// The optimizations applied to each separately translated part of the
+// program.
+struct Optimizations {
+  SharedRoutines routines;
+  VmPassManager vm_passes;
+  bool cache_stack = false;
+  HackPassManager hack_passes;
+  // Passes over the whole program once it has been translated.
+  HackPassManager program_hack_passes;
+};
+
+// Lowers `commands` into `program` and runs the Hack passes over the result.
+void LowerPart(const CommandList &commands, const Optimizations &optimizations,
+               HackProgram *program) {
+  LowerCommands(commands, optimizations.cache_stack, program);
+  optimizations.hack_passes.Run(program);
+}
+
+// Runs the VM passes over `commands`, lowers them into `program` and runs the
+// Hack passes over the result.
+void Translate(CommandList commands, const Optimizations &optimizations,
+               HackProgram *program) {
+  optimizations.vm_passes.Run(&commands);
+  LowerPart(commands, optimizations, program);
+}
+
+// Translates the files at `vm_paths` on a pool of threads.
+void TranslateConcurrently(const std::vector<std::string> &vm_paths,
+                           HackProgram bootstrap,
+                           const Optimizations &optimizations,
+                           AssemblyFile *asm_file) {
+  // Labels are prefixed with the file and function names, so files and the
+  // functions within them can be translated independently into separate
+  // programs and concatenated afterwards.
+  int thread_count = ThreadCount(absl::GetFlag(FLAGS_jobs));
+  std::vector<std::string> contents(vm_paths.size());
+  std::vector<std::vector<VmSegment>> file_segments(vm_paths.size());
+  ParallelFor(vm_paths.size(), thread_count, [&](size_t i) {
+    LOG(INFO) << "Processing VM file: " << vm_paths[i];
+    contents[i] = ReadVmFile(vm_paths[i]);
+    file_segments[i] =
+        SplitAtFunctions(contents[i], absl::GetFlag(FLAGS_segment_size));
+  });
+  std::vector<std::pair<std::string_view, VmSegment>> segments;
+  for (size_t i = 0; i < vm_paths.size(); ++i) {
+    for (const VmSegment &segment : file_segments[i]) {
+      segments.emplace_back(vm_paths[i], segment);
+    }
+  }
+
+  // All segments are parsed before any is translated, so that program passes
+  // can see the whole program.
+  std::vector<CommandList> parts(std::max<size_t>(segments.size(), 1));
+  ParallelFor(segments.size(), thread_count, [&](size_t i) {
+    VmFile vm_file(segments[i].first, segments[i].second);
+    while (vm_file.command()) {
+      TakeCommand(vm_file, &parts[i]);
+    }
+  });
+  optimizations.vm_passes.RunProgramPasses(&parts);
+  ParallelFor(parts.size(), thread_count, [&](size_t i) {
+    optimizations.vm_passes.Run(&parts[i]);
+  });
+  optimizations.vm_passes.RunLateProgramPasses(&parts);
+
+  // The bootstrap code is optimized together with the first segment.
+  std::vector<HackProgram> programs(parts.size());
+  programs[0] = std::move(bootstrap);
+  ParallelFor(parts.size(), thread_count, [&](size_t i) {
+    LowerPart(parts[i], optimizations, &programs[i]);
+  });
+  for (const HackProgram &program : programs) {
+    asm_file->Append(program);
+  }
+}
+
+void LogQueueStats(std::string_view name, const SpscQueueStats &stats) {
+  LOG(INFO) << absl::StrFormat(
+      "Queue %s: capacity %u, %u batches, depth mean %.2f max %u, producer "
+      "stalled %.3f ms, consumer stalled %.3f ms",
+      name, stats.capacity, stats.push_count, stats.mean_depth(),
+      stats.max_depth,
+      std::chrono::duration<double, std::milli>(stats.producer_stall_time)
+          .count(),
+      std::chrono::duration<double, std::milli>(stats.consumer_stall_time)
+          .count());
+}
+
+// Translates the files at `vm_paths` in a pipeline of three threads: one
+// parsing commands, one lowering them and running the passes, and the calling
+// thread writing the output, so that I/O overlaps with code generation.
+void TranslatePipelined(const std::vector<std::string> &vm_paths,
+                        HackProgram bootstrap,
+                        const Optimizations &optimizations,
+                        AssemblyFile *asm_file) {
+  if (optimizations.vm_passes.has_program_passes()) {
+    LOG(WARNING) << "Program passes need the whole program, and are skipped "
+                    "in pipeline mode";
+  }
+
+  // Parsed commands are passed from the parsing stage to the lowering stage in
+  // batches. Batches only end right before labels, where passes forget what
+  // they know about registers and the stack, so that running the passes on
+  // each batch gives the same result as running them on the whole program.
+  SpscQueue<std::unique_ptr<CommandList>> batches(
+      absl::GetFlag(FLAGS_queue_size));
+  SpscQueue<std::unique_ptr<HackProgram>> programs(
+      absl::GetFlag(FLAGS_queue_size));
+
+  std::thread parser([&]() {
+    size_t batch_size = absl::GetFlag(FLAGS_batch_size);
+    auto batch = std::make_unique<CommandList>();
+    for (const std::string &vm_path : vm_paths) {
+      VmFile vm_file(vm_path);
+      while (vm_file.command()) {
+        if (batch->size() >= batch_size &&
+            (dynamic_cast<LabelCommand *>(vm_file.command()) ||
+             dynamic_cast<FunctionCommand *>(vm_file.command()))) {
+          batches.Push(std::move(batch));
+          batch = std::make_unique<CommandList>();
+        }
+        TakeCommand(vm_file, batch.get());
+      }
+    }
+    if (!batch->empty()) {
+      batches.Push(std::move(batch));
+    }
+    batches.Push(nullptr);
+  });
+
+  std::thread lowerer([&]() {
+    // The bootstrap code is optimized together with the first batch.
+    auto program = std::make_unique<HackProgram>(std::move(bootstrap));
+    while (std::unique_ptr<CommandList> batch = batches.Pop()) {
+      Translate(std::move(*batch), optimizations, program.get());
+      programs.Push(std::move(program));
+      program = std::make_unique<HackProgram>();
     }
-    if (absl::GetFlag(FLAGS_d)) {
-      asm_file << "// " << vm_file.path() << ':' << vm_file.line_number()
-               << ": " << vm_file.line() << '\n';
+    if (program->InstructionCount() > 0) {
+      optimizations.hack_passes.Run(program.get());
+      programs.Push(std::move(program));
     }
-    asm_file << vm_file.command()->ToAssembly();
-    vm_file.Advance();
+    programs.Push(nullptr);
+  });
+
+  while (std::unique_ptr<HackProgram> program = programs.Pop()) {
+    asm_file->Append(*program);
+    asm_file->Flush();
   }
+  parser.join();
+  lowerer.join();
+  LogQueueStats("parse -> lower", batches.stats());
+  LogQueueStats("lower -> write", programs.stats());
 }
 
 int main(int argc, char *argv[]) {
-  absl::SetProgramUsageMessage(
-      absl::StrFormat("Usage: %s [-d] [-v] SOURCE", argv[0]));
+  absl::SetProgramUsageMessage(absl::StrFormat(
+      "Usage: %s [-d] [-v] [-O none|speed|size] [--format=asm|hack|bin] "
+      "[--jobs=N] [--pipeline] SOURCE",
+      argv[0]));
   std::vector<char *> positional_args = absl::ParseCommandLine(argc, argv);
   QCHECK_EQ(positional_args.size(), 2) << absl::ProgramUsageMessage();
 
@@ -87,6 +331,11 @@ int main(int argc, char *argv[]) {
                           << positional_args[1];
   LOG(INFO) << "Source: " << source.path().string();
 
+  std::string format = absl::GetFlag(FLAGS_format);
+  QCHECK(format == "asm" || format == "hack" || format == "bin")
+      << "Unknown output format: " << format;
+  std::string extension = absl::StrCat(".", format);
+
   std::string program_name;
   std::filesystem::path asm_path;
   if (source.is_directory()) {
@@ -95,26 +344,72 @@ int main(int argc, char *argv[]) {
     } else {
       program_name = source.path().parent_path().filename().string();
     }
-    asm_path = source.path() / absl::StrCat(program_name, ".asm");
+    asm_path = source.path() / absl::StrCat(program_name, extension);
   } else {
     program_name = source.path().stem().string();
-    asm_path = source.path().parent_path() / absl::StrCat(program_name, ".asm");
+    asm_path =
+        source.path().parent_path() / absl::StrCat(program_name, extension);
   }
   CHECK(!program_name.empty());
   LOG(INFO) << "Program: " << program_name;
 
-  AssemblyFile asm_file(asm_path.string(), source.is_directory());
+  std::vector<std::string> vm_paths;
   if (source.is_directory()) {
+    // Sort the files, as the order of `directory_iterator` is unspecified.
     for (const std::filesystem::directory_entry &entry :
          std::filesystem::directory_iterator(source)) {
       if (entry.path().extension() == ".vm") {
-        VmFile vm_file(entry.path().string());
-        Translate(vm_file, asm_file);
+        vm_paths.push_back(entry.path().string());
       }
     }
+    std::sort(vm_paths.begin(), vm_paths.end());
   } else {
-    VmFile vm_file(positional_args[1]);
-    Translate(vm_file, asm_file);
+    vm_paths.push_back(positional_args[1]);
+  }
+
+  OptimizationLevel level;
+  QCHECK(ParseOptimizationLevel(absl::GetFlag(FLAGS_O), &level))
+      << "Unknown optimization level: " << absl::GetFlag(FLAGS_O);
+  Optimizations optimizations;
+  std::set<std::string> intrinsics;
+  for (const std::string &function : absl::GetFlag(FLAGS_intrinsics)) {
+    QCHECK(IntrinsicPass::IsIntrinsic(function))
+        << "Unknown intrinsic: " << function;
+    intrinsics.insert(function);
+  }
+  AddVmPasses(level, absl::GetFlag(FLAGS_inline_words),
+              absl::GetFlag(FLAGS_unroll_locals), intrinsics,
+              &optimizations.routines, &optimizations.vm_passes);
+  optimizations.cache_stack = level != OptimizationLevel::kNone;
+  if (level != OptimizationLevel::kNone) {
+    optimizations.hack_passes.AddPass(std::make_unique<RedundantAddressPass>());
+  }
+  if (level == OptimizationLevel::kSize) {
+    optimizations.program_hack_passes.AddPass(
+        std::make_unique<OutliningPass>(absl::GetFlag(FLAGS_rom_budget)));
+  }
+
+  AssemblyFile asm_file(asm_path.string(), source.is_directory(), format);
+  HackProgram bootstrap = Bootstrap(source.is_directory());
+  if (absl::GetFlag(FLAGS_pipeline)) {
+    TranslatePipelined(vm_paths, std::move(bootstrap), optimizations,
+                       &asm_file);
+  } else {
+    TranslateConcurrently(vm_paths, std::move(bootstrap), optimizations,
+                          &asm_file);
+  }
+  HackProgram routines;
+  optimizations.routines.Lower(&routines);
+  optimizations.hack_passes.Run(&routines);
+  asm_file.AppendEnd(routines);
+  if (!absl::GetFlag(FLAGS_pipeline)) {
+    asm_file.RunPasses(optimizations.program_hack_passes);
+  } else if (level == OptimizationLevel::kSize) {
+    LOG(WARNING) << "Outlining needs the whole program, and is skipped in "
+                    "pipeline mode";
   }
+  optimizations.vm_passes.LogStatistics();
+  optimizations.hack_passes.LogStatistics();
+  optimizations.program_hack_passes.LogStatistics();
   return 0;
 }
@@ -0,0 +1,2088 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
+
+#include "addressing.h"
+#include "cfg.h"
+#include "commands.h"
+#include "hack.h"
+
+bool ParseOptimizationLevel(std::string_view text, OptimizationLevel *level) {
+  if (text == "none") {
+    *level = OptimizationLevel::kNone;
+  } else if (text == "speed") {
+    *level = OptimizationLevel::kSpeed;
+  } else if (text == "size") {
+    *level = OptimizationLevel::kSize;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void VmPassManager::AddPass(std::unique_ptr<VmPass> pass) {
+  passes_.push_back(std::move(pass));
+  absl::MutexLock lock(&mutex_);
+  removed_counts_.push_back(0);
+}
+
+void VmPassManager::AddProgramPass(std::unique_ptr<ProgramPass> pass) {
+  program_passes_.push_back(std::move(pass));
+  absl::MutexLock lock(&mutex_);
+  program_removed_counts_.push_back(0);
+}
+
+void VmPassManager::AddLateProgramPass(std::unique_ptr<ProgramPass> pass) {
+  late_program_passes_.push_back(std::move(pass));
+  absl::MutexLock lock(&mutex_);
+  late_program_removed_counts_.push_back(0);
+}
+
+void VmPassManager::Run(CommandList *commands) const {
+  std::vector<int64_t> removed_counts;
+  removed_counts.reserve(passes_.size());
+  for (const std::unique_ptr<VmPass> &pass : passes_) {
+    int64_t before = commands->size();
+    pass->Run(commands);
+    removed_counts.push_back(before - commands->size());
+  }
+
+  absl::MutexLock lock(&mutex_);
+  for (size_t i = 0; i < passes_.size(); ++i) {
+    removed_counts_[i] += removed_counts[i];
+  }
+}
+
+bool VmPassManager::has_program_passes() const {
+  return !program_passes_.empty() || !late_program_passes_.empty();
+}
+
+namespace {
+
+int64_t CommandCount(const std::vector<CommandList> &parts) {
+  int64_t count = 0;
+  for (const CommandList &part : parts) {
+    count += part.size();
+  }
+  return count;
+}
+
+}  // namespace
+
+void VmPassManager::RunProgramPasses(std::vector<CommandList> *parts) const {
+  for (size_t i = 0; i < program_passes_.size(); ++i) {
+    int64_t before = CommandCount(*parts);
+    program_passes_[i]->Run(parts);
+    int64_t removed_count = before - CommandCount(*parts);
+    absl::MutexLock lock(&mutex_);
+    program_removed_counts_[i] += removed_count;
+  }
+}
+
+void VmPassManager::RunLateProgramPasses(
+    std::vector<CommandList> *parts) const {
+  for (size_t i = 0; i < late_program_passes_.size(); ++i) {
+    int64_t before = CommandCount(*parts);
+    late_program_passes_[i]->Run(parts);
+    int64_t removed_count = before - CommandCount(*parts);
+    absl::MutexLock lock(&mutex_);
+    late_program_removed_counts_[i] += removed_count;
+  }
+}
+
+void VmPassManager::LogStatistics() const {
+  absl::MutexLock lock(&mutex_);
+  for (size_t i = 0; i < program_passes_.size(); ++i) {
+    LOG(INFO) << "Pass " << program_passes_[i]->name() << " removed "
+              << program_removed_counts_[i] << " commands";
+  }
+  for (size_t i = 0; i < passes_.size(); ++i) {
+    LOG(INFO) << "Pass " << passes_[i]->name() << " removed "
+              << removed_counts_[i] << " commands";
+  }
+  for (size_t i = 0; i < late_program_passes_.size(); ++i) {
+    LOG(INFO) << "Pass " << late_program_passes_[i]->name() << " removed "
+              << late_program_removed_counts_[i] << " commands";
+  }
+}
+
+void AddVmPasses(OptimizationLevel level, int inline_words, int unroll_locals,
+                 const std::set<std::string> &intrinsics,
+                 SharedRoutines *routines, VmPassManager *pass_manager) {
+  if (!intrinsics.empty()) {
+    pass_manager->AddProgramPass(
+        std::make_unique<IntrinsicPass>(intrinsics, routines));
+  }
+  if (level == OptimizationLevel::kNone) {
+    return;
+  }
+  // Inlining functions with more than one call site makes the program larger.
+  pass_manager->AddProgramPass(std::make_unique<InliningPass>(
+      level == OptimizationLevel::kSpeed ? inline_words : 0));
+  pass_manager->AddProgramPass(std::make_unique<DeadFunctionPass>());
+  pass_manager->AddProgramPass(std::make_unique<StaticFramePass>());
+  pass_manager->AddProgramPass(std::make_unique<CallingConventionPass>());
+  pass_manager->AddProgramPass(std::make_unique<TailCallPass>());
+  pass_manager->AddProgramPass(
+      std::make_unique<ControlFlowSimplificationPass>());
+  if (level == OptimizationLevel::kSpeed) {
+    pass_manager->AddProgramPass(
+        std::make_unique<LoopInvariantCodeMotionPass>());
+  }
+  pass_manager->AddProgramPass(std::make_unique<IdenticalCodeFoldingPass>());
+  pass_manager->AddPass(std::make_unique<PeepholePass>());
+  pass_manager->AddPass(std::make_unique<BranchFusionPass>());
+  pass_manager->AddPass(
+      std::make_unique<LocalInitializationPass>(unroll_locals));
+  if (level == OptimizationLevel::kSize) {
+    pass_manager->AddLateProgramPass(
+        std::make_unique<SharedComparisonPass>(routines));
+    pass_manager->AddLateProgramPass(
+        std::make_unique<SharedCallPass>(routines));
+    pass_manager->AddLateProgramPass(
+        std::make_unique<SharedLocalInitializationPass>(routines));
+  }
+}
+
+namespace {
+
+// Returns whether `command` is `push constant`, storing the constant in
+// `value`.
+bool PushesConstant(const Command *command, uint16_t *value) {
+  auto *push = dynamic_cast<const PushCommand *>(command);
+  if (!push) {
+    return false;
+  }
+  auto *constant = dynamic_cast<const ConstantAddress *>(&push->address());
+  if (!constant) {
+    return false;
+  }
+  *value = constant->value();
+  return true;
+}
+
+std::unique_ptr<Command> PushConstant(uint16_t value) {
+  return std::make_unique<PushCommand>(std::make_unique<ConstantAddress>(value));
+}
+
+// Returns the cheapest command applying `write_computation` of a binary
+// arithmetic command to the top of the stack and `constant`, or null if the
+// operation has no effect.
+std::unique_ptr<Command> ApplyConstant(Computation write_computation,
+                                       uint16_t constant) {
+  constexpr uint16_t kMinusOne = 0xFFFF;
+  switch (write_computation) {
+    case Computation::kDPlusM:
+      if (constant == 0) {
+        return nullptr;
+      }
+      if (constant == 1 || constant == kMinusOne) {
+        return std::make_unique<UnaryArithmeticCommand>(
+            constant == 1 ? Computation::kMPlusOne : Computation::kMMinusOne);
+      }
+      break;
+    case Computation::kMMinusD:
+      if (constant == 0) {
+        return nullptr;
+      }
+      if (constant == 1 || constant == kMinusOne) {
+        return std::make_unique<UnaryArithmeticCommand>(
+            constant == 1 ? Computation::kMMinusOne : Computation::kMPlusOne);
+      }
+      break;
+    case Computation::kDAndM:
+      if (constant == kMinusOne) {
+        return nullptr;
+      }
+      if (constant == 0) {
+        return std::make_unique<UnaryArithmeticCommand>(Computation::kZero);
+      }
+      break;
+    case Computation::kDOrM:
+      if (constant == 0) {
+        return nullptr;
+      }
+      if (constant == kMinusOne) {
+        return std::make_unique<UnaryArithmeticCommand>(Computation::kMinusOne);
+      }
+      break;
+    default:
+      break;
+  }
+  return std::make_unique<ConstantArithmeticCommand>(write_computation,
+                                                     constant);
+}
+
+// The commands rewritten so far. Comments stay where they are, and are skipped
+// when matching patterns, so that debug mode does not change the result.
+class Window {
+ public:
+  explicit Window(size_t capacity) { commands_.reserve(capacity); }
+
+  void Push(std::unique_ptr<Command> command) {
+    if (!dynamic_cast<CommentCommand *>(command.get())) {
+      indices_.push_back(commands_.size());
+    }
+    commands_.push_back(std::move(command));
+  }
+
+  // The `back`-th last command that is not a comment, or null.
+  Command *Back(size_t back) const {
+    if (back >= indices_.size()) {
+      return nullptr;
+    }
+    return commands_[indices_[indices_.size() - 1 - back]].get();
+  }
+
+  // Replaces the last `count` commands that are not comments with
+  // `replacement`, which may be null.
+  void Replace(size_t count, std::unique_ptr<Command> replacement) {
+    for (size_t i = 0; i < count; ++i) {
+      commands_[indices_.back()] = nullptr;
+      indices_.pop_back();
+    }
+    if (replacement) {
+      Push(std::move(replacement));
+    }
+  }
+
+  CommandList Release() {
+    commands_.erase(std::remove(commands_.begin(), commands_.end(), nullptr),
+                    commands_.end());
+    return std::move(commands_);
+  }
+
+ private:
+  CommandList commands_;
+  // Indices of the commands that are not comments.
+  std::vector<size_t> indices_;
+};
+
+// Pushes `commands` through a window, applying `rewrite` to the end of the
+// window until it returns false after each command.
+void RewriteCommands(CommandList *commands, bool (*rewrite)(Window *window)) {
+  Window window(commands->size());
+  for (std::unique_ptr<Command> &command : *commands) {
+    window.Push(std::move(command));
+    while (rewrite(&window)) {
+    }
+  }
+  *commands = window.Release();
+}
+
+// Applies one peephole rewrite to the end of `window`. Returns whether
+// anything changed.
+bool RewritePeephole(Window *window) {
+  Command *last = window->Back(0);
+  Command *second = window->Back(1);
+  uint16_t a;
+  uint16_t b;
+
+  if (auto *binary = dynamic_cast<BinaryArithmeticCommand *>(last)) {
+    Computation computation = binary->write_computation();
+    if (PushesConstant(window->Back(2), &a) && PushesConstant(second, &b)) {
+      window->Replace(3, PushConstant(Evaluate(computation, b, a)));
+      return true;
+    }
+    if (PushesConstant(second, &b)) {
+      window->Replace(2, ApplyConstant(computation, b));
+      return true;
+    }
+    return false;
+  }
+
+  if (auto *unary = dynamic_cast<UnaryArithmeticCommand *>(last)) {
+    Computation computation = unary->write_computation();
+    if (PushesConstant(second, &a)) {
+      window->Replace(2, PushConstant(Evaluate(computation, 0, a)));
+      return true;
+    }
+    auto *previous = dynamic_cast<UnaryArithmeticCommand *>(second);
+    if (previous && previous->write_computation() == computation &&
+        (computation == Computation::kNegM ||
+         computation == Computation::kNotM)) {
+      window->Replace(2, nullptr);
+      return true;
+    }
+    return false;
+  }
+
+  if (auto *pop = dynamic_cast<PopCommand *>(last)) {
+    if (auto *push = dynamic_cast<PushCommand *>(second)) {
+      auto move =
+          std::make_unique<MoveCommand>(push->TakeAddress(), pop->TakeAddress());
+      window->Replace(2, std::move(move));
+      return true;
+    }
+  }
+  return false;
+}
+
+// Fuses the commands computing the condition of an `if-goto` at the end of
+// `window` into the jump. Returns whether anything changed.
+bool RewriteBranch(Window *window) {
+  auto *if_goto = dynamic_cast<IfGotoCommand *>(window->Back(0));
+  if (!if_goto) {
+    return false;
+  }
+  std::string label = if_goto->label();
+  Command *condition = window->Back(1);
+
+  auto *negation = dynamic_cast<UnaryArithmeticCommand *>(condition);
+  if (negation && negation->write_computation() == Computation::kNotM) {
+    if (auto *comparison =
+            dynamic_cast<BinaryComparisonCommand *>(window->Back(2))) {
+      window->Replace(3, std::make_unique<CompareJumpCommand>(
+                             comparison->jump_condition(), label));
+      return true;
+    }
+    return false;
+  }
+  if (auto *comparison = dynamic_cast<BinaryComparisonCommand *>(condition)) {
+    window->Replace(2, std::make_unique<CompareJumpCommand>(
+                           NegateJump(comparison->jump_condition()), label));
+    return true;
+  }
+  uint16_t constant;
+  if (PushesConstant(condition, &constant)) {
+    window->Replace(2, constant ? std::make_unique<GotoCommand>(label)
+                                : nullptr);
+    return true;
+  }
+  if (auto *push = dynamic_cast<PushCommand *>(condition)) {
+    window->Replace(
+        2, std::make_unique<LoadJumpCommand>(push->TakeAddress(), label));
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+std::string_view PeepholePass::name() const { return "peephole"; }
+
+void PeepholePass::Run(CommandList *commands) const {
+  RewriteCommands(commands, RewritePeephole);
+}
+
+std::string_view BranchFusionPass::name() const { return "branch-fusion"; }
+
+void BranchFusionPass::Run(CommandList *commands) const {
+  RewriteCommands(commands, RewriteBranch);
+}
+
+namespace {
+
+// Returns the number of instructions of the routines `routines` has recorded.
+size_t RoutineSize(const SharedRoutines &routines) {
+  HackProgram program;
+  routines.Lower(&program);
+  return program.InstructionCount();
+}
+
+// Chooses the groups of sites that call a shared routine instead of inlining
+// their code. `savings` holds the instructions the sites of each group save by
+// calling the routine, and `routine_size` returns the instructions the routine
+// takes to serve a set of groups. Starting from all groups, the group whose
+// removal saves the most is dropped as long as that helps. Returns the groups
+// left if they save more than the routine takes, and none otherwise.
+std::set<int> ChooseSharedGroups(
+    const std::map<int, int64_t> &savings,
+    const std::function<size_t(const std::set<int> &)> &routine_size) {
+  auto net_savings = [&](const std::set<int> &groups) {
+    int64_t net = -static_cast<int64_t>(routine_size(groups));
+    for (int group : groups) {
+      net += savings.at(group);
+    }
+    return net;
+  };
+  std::set<int> groups;
+  for (const auto &[group, saved] : savings) {
+    groups.insert(group);
+  }
+  int64_t best = net_savings(groups);
+  while (!groups.empty()) {
+    std::optional<int> dropped;
+    for (int group : groups) {
+      std::set<int> rest = groups;
+      rest.erase(group);
+      int64_t net = net_savings(rest);
+      if (net > best) {
+        best = net;
+        dropped = group;
+      }
+    }
+    if (!dropped) {
+      break;
+    }
+    groups.erase(*dropped);
+  }
+  if (best <= 0) {
+    return {};
+  }
+  return groups;
+}
+
+SharedRoutines::Routine ComparisonRoutine(Jump jump_condition) {
+  switch (jump_condition) {
+    case Jump::kJne:
+      return SharedRoutines::kEq;
+    case Jump::kJle:
+      return SharedRoutines::kGt;
+    default:
+      return SharedRoutines::kLt;
+  }
+}
+
+// Returns the number of instructions `shared`, which calls a shared routine,
+// saves over `inlined`, which does the same without it.
+int64_t InstructionsSaved(const Command &inlined, const Command &shared) {
+  return static_cast<int64_t>(inlined.InstructionCount()) -
+         static_cast<int64_t>(shared.InstructionCount());
+}
+
+// Returns the number of instructions `command` lowers to with stack caching
+// right after its two operands have been pushed, which is where comparisons
+// usually are.
+size_t InstructionCountAfterOperands(const Command &command) {
+  StackState stack;
+  stack.top_in_d = true;
+  stack.offset = 1;
+  HackProgram program;
+  command.LowerCached(&stack, &program);
+  return program.InstructionCount();
+}
+
+}  // namespace
+
+SharedComparisonPass::SharedComparisonPass(SharedRoutines *routines)
+    : routines_(routines) {}
+
+std::string_view SharedComparisonPass::name() const {
+  return "shared-comparison";
+}
+
+void SharedComparisonPass::Run(std::vector<CommandList> *parts) const {
+  // The routines the commands measured below record, which are never lowered.
+  SharedRoutines measured_routines;
+  std::map<int, std::vector<std::unique_ptr<Command> *>> sites;
+  std::map<int, int64_t> savings;
+  for (CommandList &part : *parts) {
+    for (std::unique_ptr<Command> &command : part) {
+      auto *comparison =
+          dynamic_cast<BinaryComparisonCommand *>(command.get());
+      if (!comparison) {
+        continue;
+      }
+      SharedRoutines::Routine routine =
+          ComparisonRoutine(comparison->jump_condition());
+      SharedBinaryCommand shared(routine, comparison->end_label(),
+                                 &measured_routines);
+      sites[routine].push_back(&command);
+      savings[routine] +=
+          static_cast<int64_t>(InstructionCountAfterOperands(*comparison)) -
+          static_cast<int64_t>(InstructionCountAfterOperands(shared));
+    }
+  }
+
+  std::set<int> shared_routines =
+      ChooseSharedGroups(savings, [](const std::set<int> &routines) {
+        SharedRoutines used_routines;
+        for (int routine : routines) {
+          used_routines.Use(static_cast<SharedRoutines::Routine>(routine));
+        }
+        return RoutineSize(used_routines);
+      });
+  for (int routine : shared_routines) {
+    for (std::unique_ptr<Command> *command : sites[routine]) {
+      auto &comparison = static_cast<BinaryComparisonCommand &>(**command);
+      *command = std::make_unique<SharedBinaryCommand>(
+          static_cast<SharedRoutines::Routine>(routine),
+          comparison.end_label(), routines_);
+    }
+  }
+}
+
+SharedCallPass::SharedCallPass(SharedRoutines *routines)
+    : routines_(routines) {}
+
+std::string_view SharedCallPass::name() const { return "shared-call"; }
+
+void SharedCallPass::Run(std::vector<CommandList> *parts) const {
+  // The sites of calls by frame layout and argument count, and of returns by
+  // frame layout, with the instructions they save by calling the routines.
+  std::map<FrameLayout,
+           std::map<int, std::vector<std::unique_ptr<Command> *>>>
+      call_sites;
+  std::map<FrameLayout, std::map<int, int64_t>> call_savings;
+  std::map<FrameLayout, std::vector<std::unique_ptr<Command> *>> return_sites;
+  std::map<FrameLayout, int64_t> return_savings;
+  for (CommandList &part : *parts) {
+    for (std::unique_ptr<Command> &command : part) {
+      if (auto *call = dynamic_cast<CallCommand *>(command.get())) {
+        SharedCallCommand shared(call->function(), call->argument_count(),
+                                 call->return_label(), call->frame(),
+                                 routines_);
+        call_sites[call->frame()][call->argument_count()].push_back(&command);
+        call_savings[call->frame()][call->argument_count()] +=
+            InstructionsSaved(*call, shared);
+      } else if (auto *ret = dynamic_cast<ReturnCommand *>(command.get())) {
+        SharedReturnCommand shared(ret->frame(), routines_);
+        return_sites[ret->frame()].push_back(&command);
+        return_savings[ret->frame()] += InstructionsSaved(*ret, shared);
+      }
+    }
+  }
+
+  for (auto &[frame, sites] : call_sites) {
+    std::set<int> argument_counts = ChooseSharedGroups(
+        call_savings[frame], [frame = frame](const std::set<int> &counts) {
+          SharedRoutines used_routines;
+          for (int argument_count : counts) {
+            used_routines.UseCall(frame, argument_count);
+          }
+          return RoutineSize(used_routines);
+        });
+    for (int argument_count : argument_counts) {
+      for (std::unique_ptr<Command> *command : sites[argument_count]) {
+        auto &call = static_cast<CallCommand &>(**command);
+        *command = std::make_unique<SharedCallCommand>(
+            call.function(), call.argument_count(), call.return_label(),
+            call.frame(), routines_);
+      }
+    }
+  }
+  for (auto &[frame, sites] : return_sites) {
+    std::set<int> shared = ChooseSharedGroups(
+        {{0, return_savings[frame]}},
+        [frame = frame](const std::set<int> &groups) {
+          SharedRoutines used_routines;
+          if (!groups.empty()) {
+            used_routines.Use(SharedRoutines::ReturnRoutine(frame));
+          }
+          return RoutineSize(used_routines);
+        });
+    if (shared.empty()) {
+      continue;
+    }
+    for (std::unique_ptr<Command> *command : sites) {
+      *command = std::make_unique<SharedReturnCommand>(frame, routines_);
+    }
+  }
+}
+
+LocalInitializationPass::LocalInitializationPass(int unroll_locals)
+    : unroll_locals_(unroll_locals) {}
+
+std::string_view LocalInitializationPass::name() const {
+  return "local-initialization";
+}
+
+void LocalInitializationPass::Run(CommandList *commands) const {
+  for (std::unique_ptr<Command> &command : *commands) {
+    auto *definition = dynamic_cast<FunctionCommand *>(command.get());
+    if (!definition) {
+      continue;
+    }
+    LocalInitialization initialization =
+        definition->variable_count() > unroll_locals_
+            ? LocalInitialization::kLooped
+            : LocalInitialization::kUnrolled;
+    if (initialization != definition->initialization()) {
+      command = std::make_unique<FunctionCommand>(
+          definition->identifier(), definition->variable_count(),
+          initialization);
+    }
+  }
+}
+
+SharedLocalInitializationPass::SharedLocalInitializationPass(
+    SharedRoutines *routines)
+    : routines_(routines) {}
+
+std::string_view SharedLocalInitializationPass::name() const {
+  return "shared-local-initialization";
+}
+
+void SharedLocalInitializationPass::Run(
+    std::vector<CommandList> *parts) const {
+  // The definitions by local count, with the instructions they save by jumping
+  // into the routine.
+  std::map<int, std::vector<std::unique_ptr<Command> *>> sites;
+  std::map<int, int64_t> savings;
+  for (CommandList &part : *parts) {
+    for (std::unique_ptr<Command> &command : part) {
+      auto *definition = dynamic_cast<FunctionCommand *>(command.get());
+      if (!definition || definition->variable_count() == 0 ||
+          definition->initialization() != LocalInitialization::kUnrolled) {
+        continue;
+      }
+      FunctionCommand shared(definition->identifier(),
+                             definition->variable_count(),
+                             LocalInitialization::kShared, routines_);
+      sites[definition->variable_count()].push_back(&command);
+      savings[definition->variable_count()] +=
+          InstructionsSaved(*definition, shared);
+    }
+  }
+
+  std::set<int> variable_counts =
+      ChooseSharedGroups(savings, [](const std::set<int> &counts) {
+        SharedRoutines used_routines;
+        for (int variable_count : counts) {
+          used_routines.UseZeroLocals(variable_count);
+        }
+        return RoutineSize(used_routines);
+      });
+  for (int variable_count : variable_counts) {
+    for (std::unique_ptr<Command> *command : sites[variable_count]) {
+      auto &definition = static_cast<FunctionCommand &>(**command);
+      *command = std::make_unique<FunctionCommand>(
+          definition.identifier(), variable_count,
+          LocalInitialization::kShared, routines_);
+    }
+  }
+}
+
+std::string_view DeadFunctionPass::name() const { return "dead-function"; }
+
+void DeadFunctionPass::Run(std::vector<CommandList> *parts) const {
+  std::unordered_map<std::string, std::vector<std::string>> callees;
+  std::vector<std::string> entry_points;
+  bool has_top_level_code = false;
+  std::string first_function;
+  for (const CommandList &part : *parts) {
+    std::vector<std::string> *function_callees = nullptr;
+    for (const std::unique_ptr<Command> &command : part) {
+      if (auto *definition = dynamic_cast<FunctionCommand *>(command.get())) {
+        function_callees = &callees[definition->identifier()];
+        if (first_function.empty()) {
+          first_function = definition->identifier();
+        }
+      } else if (auto *call = dynamic_cast<CallCommand *>(command.get())) {
+        (function_callees ? *function_callees : entry_points)
+            .push_back(call->function());
+      }
+      if (!function_callees && !dynamic_cast<CommentCommand *>(command.get())) {
+        has_top_level_code = true;
+      }
+    }
+  }
+  if (callees.count("Sys.init")) {
+    entry_points.push_back("Sys.init");
+  } else if (!has_top_level_code && !first_function.empty()) {
+    entry_points.push_back(first_function);
+  }
+
+  std::unordered_set<std::string> reachable;
+  while (!entry_points.empty()) {
+    std::string function = std::move(entry_points.back());
+    entry_points.pop_back();
+    if (!reachable.insert(function).second) {
+      continue;
+    }
+    auto found = callees.find(function);
+    if (found != callees.end()) {
+      entry_points.insert(entry_points.end(), found->second.begin(),
+                          found->second.end());
+    }
+  }
+
+  int removed_functions = 0;
+  size_t removed_words = 0;
+  for (CommandList &part : *parts) {
+    CommandList kept;
+    // Comments preceding a function belong to it.
+    CommandList comments;
+    bool keep = true;
+    for (std::unique_ptr<Command> &command : part) {
+      if (dynamic_cast<CommentCommand *>(command.get())) {
+        comments.push_back(std::move(command));
+        continue;
+      }
+      if (auto *definition = dynamic_cast<FunctionCommand *>(command.get())) {
+        keep = reachable.count(definition->identifier());
+        removed_functions += !keep;
+      }
+      comments.push_back(std::move(command));
+      for (std::unique_ptr<Command> &taken : comments) {
+        if (keep) {
+          kept.push_back(std::move(taken));
+        } else {
+          removed_words += taken->InstructionCount();
+        }
+      }
+      comments.clear();
+    }
+    for (std::unique_ptr<Command> &comment : comments) {
+      kept.push_back(std::move(comment));
+    }
+    part = std::move(kept);
+  }
+  if (removed_functions > 0) {
+    LOG(INFO) << "Removed " << removed_functions
+              << " unreachable functions, which would have used "
+              << removed_words << " words of ROM before "
+              << "optimization";
+  }
+}
+
+namespace {
+
+// The RAM the assembler allocates variables in, between the virtual registers
+// and the stack.
+constexpr int kVariableWords = 256 - 16;
+
+// Returns the identifier of the function `command` starts, or null if it does
+// not start one.
+const std::string *DefinedFunction(const Command *command) {
+  if (auto *definition = dynamic_cast<const FunctionCommand *>(command)) {
+    return &definition->identifier();
+  }
+  if (auto *definition = dynamic_cast<const StaticFunctionCommand *>(command)) {
+    return &definition->identifier();
+  }
+  return nullptr;
+}
+
+// Returns whether the function body in [begin, end) leaves exactly its result
+// on the stack at every `return` and never pops below the stack pointer it was
+// entered with. Labels must be reached with the same stack depth on every
+// path.
+bool LeavesOnlyResult(CommandList::const_iterator begin,
+                      CommandList::const_iterator end) {
+  std::unordered_map<std::string, int> label_depths;
+  auto reach = [&](const std::string &label, int depth) {
+    auto [it, inserted] = label_depths.emplace(label, depth);
+    return inserted || it->second == depth;
+  };
+  // The stack depth, or -1 after an unconditional jump.
+  int depth = 0;
+  for (auto it = begin; it != end; ++it) {
+    const Command *command = it->get();
+    if (auto *label = dynamic_cast<const LabelCommand *>(command)) {
+      if (depth >= 0) {
+        if (!reach(label->label(), depth)) {
+          return false;
+        }
+      } else {
+        auto found = label_depths.find(label->label());
+        if (found == label_depths.end()) {
+          return false;
+        }
+        depth = found->second;
+      }
+      continue;
+    }
+    int pops;
+    int pushes;
+    if (!StackEffect(command, &pops, &pushes)) {
+      return false;
+    }
+    if (depth < 0) {
+      continue;
+    }
+    if (depth < pops) {
+      return false;
+    }
+    depth += pushes - pops;
+    if (auto *jump = dynamic_cast<const IfGotoCommand *>(command)) {
+      if (!reach(jump->label(), depth)) {
+        return false;
+      }
+    } else if (auto *shared = dynamic_cast<const SharedBinaryCommand *>(command);
+               shared && !shared->zero_label().empty()) {
+      if (!reach(shared->zero_label(), depth)) {
+        return false;
+      }
+    } else if (auto *jump = dynamic_cast<const GotoCommand *>(command)) {
+      if (!reach(jump->label(), depth)) {
+        return false;
+      }
+      depth = -1;
+    } else if (dynamic_cast<const ReturnCommand *>(command)) {
+      if (depth != 1) {
+        return false;
+      }
+      depth = -1;
+    }
+  }
+  return depth < 0;
+}
+
+// Returns the static frame slot `address` refers to, or null if it is not a
+// local or an argument.
+const std::string *FrameSlot(const Address &address,
+                             const StaticFrame &frame) {
+  if (auto *argument = dynamic_cast<const ArgumentAddress *>(&address)) {
+    return &frame.arguments[argument->index()];
+  }
+  if (auto *local = dynamic_cast<const LocalAddress *>(&address)) {
+    return &frame.locals[local->index()];
+  }
+  return nullptr;
+}
+
+// What whole-program passes collect about a function definition.
+struct FunctionInfo {
+  int variable_count = 0;
+  // One more than the highest argument index accessed.
+  int argument_count = 0;
+  bool changes_pointers = false;
+  // Whether the function accesses only locals it declares and leaves only its
+  // result on the stack.
+  bool well_formed = true;
+  // Whether the function is part of a cycle in the call graph.
+  bool recursive = false;
+  std::vector<std::string> callees;
+};
+
+struct CallGraph {
+  std::unordered_map<std::string, FunctionInfo> functions;
+  // The definition order, which makes decisions deterministic.
+  std::vector<std::string> order;
+  // The strongly connected components in reverse topological order, so
+  // callees come before their callers.
+  std::vector<std::vector<std::string>> components;
+  // The argument count of all calls of a function, or -1 if they differ.
+  std::unordered_map<std::string, int> call_argument_counts;
+  std::unordered_map<std::string, int> call_site_counts;
+  std::unordered_set<std::string> static_variables;
+};
+
+// Finds the strongly connected components of `graph` with Tarjan's algorithm
+// and marks the functions in cycles as recursive.
+void FindComponents(CallGraph *graph) {
+  std::unordered_map<std::string, int> indices;
+  std::unordered_map<std::string, int> low_links;
+  std::vector<std::string> stack;
+  std::unordered_set<std::string> on_stack;
+  std::function<void(const std::string &)> visit =
+      [&](const std::string &function) {
+        int index = indices.size();
+        indices[function] = index;
+        low_links[function] = index;
+        stack.push_back(function);
+        on_stack.insert(function);
+        for (const std::string &callee : graph->functions[function].callees) {
+          if (!graph->functions.count(callee)) {
+            continue;
+          }
+          if (!indices.count(callee)) {
+            visit(callee);
+            low_links[function] =
+                std::min(low_links[function], low_links[callee]);
+          } else if (on_stack.count(callee)) {
+            low_links[function] =
+                std::min(low_links[function], indices[callee]);
+          }
+        }
+        if (low_links[function] != index) {
+          return;
+        }
+        std::vector<std::string> &component =
+            graph->components.emplace_back();
+        do {
+          component.push_back(stack.back());
+          on_stack.erase(stack.back());
+          stack.pop_back();
+        } while (component.back() != function);
+      };
+  for (const std::string &function : graph->order) {
+    if (!indices.count(function)) {
+      visit(function);
+    }
+  }
+
+  for (const std::vector<std::string> &component : graph->components) {
+    for (const std::string &function : component) {
+      FunctionInfo &info = graph->functions[function];
+      info.recursive =
+          component.size() > 1 ||
+          std::find(info.callees.begin(), info.callees.end(), function) !=
+              info.callees.end();
+    }
+  }
+}
+
+CallGraph BuildCallGraph(const std::vector<CommandList> &parts) {
+  CallGraph graph;
+  for (const CommandList &part : parts) {
+    FunctionInfo *info = nullptr;
+    auto body_begin = part.begin();
+    auto finish_body = [&](CommandList::const_iterator body_end) {
+      if (info && !LeavesOnlyResult(body_begin, body_end)) {
+        info->well_formed = false;
+      }
+    };
+    for (auto it = part.begin(); it != part.end(); ++it) {
+      const Command *command = it->get();
+      if (const std::string *function = DefinedFunction(command)) {
+        finish_body(it);
+        auto [found, inserted] = graph.functions.try_emplace(*function);
+        info = &found->second;
+        if (auto *definition = dynamic_cast<const FunctionCommand *>(command)) {
+          info->variable_count = definition->variable_count();
+        }
+        if (inserted) {
+          graph.order.push_back(*function);
+        } else {
+          info->well_formed = false;
+        }
+        body_begin = std::next(it);
+        continue;
+      }
+      const Address *address = nullptr;
+      if (auto *push = dynamic_cast<const PushCommand *>(command)) {
+        address = &push->address();
+      } else if (auto *pop = dynamic_cast<const PopCommand *>(command)) {
+        address = &pop->address();
+        if (info && dynamic_cast<const PointerAddress *>(address)) {
+          info->changes_pointers = true;
+        }
+      } else if (auto *call = dynamic_cast<const CallCommand *>(command)) {
+        auto [found, inserted] = graph.call_argument_counts.try_emplace(
+            call->function(), call->argument_count());
+        if (found->second != call->argument_count()) {
+          found->second = -1;
+        }
+        ++graph.call_site_counts[call->function()];
+        if (info) {
+          info->callees.push_back(call->function());
+        }
+      }
+      if (auto *symbol = dynamic_cast<const SymbolAddress *>(address)) {
+        graph.static_variables.insert(symbol->symbol());
+      } else if (!info) {
+        continue;
+      } else if (auto *argument =
+                     dynamic_cast<const ArgumentAddress *>(address)) {
+        info->argument_count =
+            std::max<int>(info->argument_count, argument->index() + 1);
+      } else if (auto *local = dynamic_cast<const LocalAddress *>(address)) {
+        if (local->index() >= info->variable_count) {
+          info->well_formed = false;
+        }
+      }
+    }
+    finish_body(part.end());
+  }
+  FindComponents(&graph);
+  return graph;
+}
+
+// A call site a function body is inlined at.
+struct InlineSite {
+  // The return label of the call, which prefixes the labels of the inlined
+  // body and marks its end.
+  std::string end_label;
+  // The locals of the caller that the arguments and locals of the callee
+  // become.
+  int first_argument;
+  int first_local;
+};
+
+// Returns a copy of `address` in a function body inlined at `site`, or null if
+// it cannot be copied.
+std::unique_ptr<Address> InlineAddress(const Address &address,
+                                       const InlineSite &site) {
+  if (auto *argument = dynamic_cast<const ArgumentAddress *>(&address)) {
+    return std::make_unique<LocalAddress>(site.first_argument +
+                                          argument->index());
+  }
+  if (auto *local = dynamic_cast<const LocalAddress *>(&address)) {
+    return std::make_unique<LocalAddress>(site.first_local + local->index());
+  }
+  if (auto *that = dynamic_cast<const ThisAddress *>(&address)) {
+    return std::make_unique<ThisAddress>(that->index());
+  }
+  if (auto *that = dynamic_cast<const ThatAddress *>(&address)) {
+    return std::make_unique<ThatAddress>(that->index());
+  }
+  if (auto *symbol = dynamic_cast<const SymbolAddress *>(&address)) {
+    return std::make_unique<SymbolAddress>(symbol->symbol());
+  }
+  if (auto *constant = dynamic_cast<const ConstantAddress *>(&address)) {
+    return std::make_unique<ConstantAddress>(constant->value());
+  }
+  if (auto *pointer = dynamic_cast<const PointerAddress *>(&address)) {
+    return std::make_unique<PointerAddress>(pointer->index());
+  }
+  if (auto *temp = dynamic_cast<const TempAddress *>(&address)) {
+    return std::make_unique<TempAddress>(temp->index());
+  }
+  return nullptr;
+}
+
+// Returns a copy of `command` in a function body inlined at `site`, or null if
+// it cannot be copied. `return` becomes a jump to the end of the body.
+std::unique_ptr<Command> InlineCommand(const Command &command,
+                                       const InlineSite &site) {
+  auto rename = [&](std::string_view label) {
+    return absl::StrCat(site.end_label, "$", label);
+  };
+  if (auto *push = dynamic_cast<const PushCommand *>(&command)) {
+    std::unique_ptr<Address> address = InlineAddress(push->address(), site);
+    return address ? std::make_unique<PushCommand>(std::move(address))
+                   : nullptr;
+  }
+  if (auto *pop = dynamic_cast<const PopCommand *>(&command)) {
+    std::unique_ptr<Address> address = InlineAddress(pop->address(), site);
+    return address ? std::make_unique<PopCommand>(std::move(address))
+                   : nullptr;
+  }
+  if (auto *binary = dynamic_cast<const BinaryArithmeticCommand *>(&command)) {
+    return std::make_unique<BinaryArithmeticCommand>(
+        binary->write_computation(), binary->command());
+  }
+  if (auto *unary = dynamic_cast<const UnaryArithmeticCommand *>(&command)) {
+    return std::make_unique<UnaryArithmeticCommand>(
+        unary->write_computation(), unary->command());
+  }
+  if (auto *comparison =
+          dynamic_cast<const BinaryComparisonCommand *>(&command)) {
+    return std::make_unique<BinaryComparisonCommand>(
+        comparison->jump_condition(), rename(comparison->else_label()),
+        rename(comparison->end_label()));
+  }
+  if (auto *shared = dynamic_cast<const SharedBinaryCommand *>(&command)) {
+    return std::make_unique<SharedBinaryCommand>(
+        shared->routine(), rename(shared->return_label()), shared->routines(),
+        shared->zero_label().empty() ? "" : rename(shared->zero_label()));
+  }
+  if (dynamic_cast<const PeekCommand *>(&command)) {
+    return std::make_unique<PeekCommand>();
+  }
+  if (dynamic_cast<const PokeCommand *>(&command)) {
+    return std::make_unique<PokeCommand>();
+  }
+  if (auto *label = dynamic_cast<const LabelCommand *>(&command)) {
+    return std::make_unique<LabelCommand>(rename(label->label()));
+  }
+  if (auto *jump = dynamic_cast<const GotoCommand *>(&command)) {
+    return std::make_unique<GotoCommand>(rename(jump->label()));
+  }
+  if (auto *jump = dynamic_cast<const IfGotoCommand *>(&command)) {
+    return std::make_unique<IfGotoCommand>(rename(jump->label()));
+  }
+  if (auto *call = dynamic_cast<const CallCommand *>(&command)) {
+    return std::make_unique<CallCommand>(call->function(),
+                                         call->argument_count(),
+                                         rename(call->return_label()),
+                                         call->frame());
+  }
+  if (dynamic_cast<const ReturnCommand *>(&command)) {
+    return std::make_unique<GotoCommand>(site.end_label);
+  }
+  if (auto *comment = dynamic_cast<const CommentCommand *>(&command)) {
+    return std::make_unique<CommentCommand>(comment->comment());
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+// The OS functions `IntrinsicPass` replaces, with the number of arguments they
+// take.
+constexpr std::pair<std::string_view, int> kIntrinsics[] = {
+    {"Math.multiply", 2},
+    {"Math.divide", 2},
+    {"Memory.peek", 1},
+    {"Memory.poke", 2},
+};
+
+bool IntrinsicPass::IsIntrinsic(std::string_view function) {
+  return std::any_of(std::begin(kIntrinsics), std::end(kIntrinsics),
+                     [&](const auto &intrinsic) {
+                       return intrinsic.first == function;
+                     });
+}
+
+IntrinsicPass::IntrinsicPass(std::set<std::string> functions,
+                             SharedRoutines *routines)
+    : functions_(std::move(functions)), routines_(routines) {}
+
+std::string_view IntrinsicPass::name() const { return "intrinsic"; }
+
+void IntrinsicPass::Run(std::vector<CommandList> *parts) const {
+  for (CommandList &part : *parts) {
+    CommandList rewritten;
+    for (std::unique_ptr<Command> &command : part) {
+      auto *call = dynamic_cast<CallCommand *>(command.get());
+      auto intrinsic = std::find_if(
+          std::begin(kIntrinsics), std::end(kIntrinsics),
+          [&](const auto &intrinsic) {
+            return call && intrinsic.first == call->function() &&
+                   intrinsic.second == call->argument_count();
+          });
+      if (intrinsic == std::end(kIntrinsics) ||
+          !functions_.count(call->function())) {
+        rewritten.push_back(std::move(command));
+      } else if (call->function() == "Math.multiply") {
+        rewritten.push_back(std::make_unique<SharedBinaryCommand>(
+            SharedRoutines::kMultiply, call->return_label(), routines_));
+      } else if (call->function() == "Math.divide") {
+        // Division by zero pushes the zero back and calls the function.
+        std::string zero_label = absl::StrCat(call->return_label(), "$zero");
+        std::string end_label = absl::StrCat(call->return_label(), "$end");
+        rewritten.push_back(std::make_unique<SharedBinaryCommand>(
+            SharedRoutines::kDivide, call->return_label(), routines_,
+            zero_label));
+        rewritten.push_back(std::make_unique<GotoCommand>(end_label));
+        rewritten.push_back(std::make_unique<LabelCommand>(zero_label));
+        rewritten.push_back(PushConstant(0));
+        rewritten.push_back(std::make_unique<CallCommand>(
+            call->function(), call->argument_count(),
+            absl::StrCat(call->return_label(), "$call")));
+        rewritten.push_back(std::make_unique<LabelCommand>(end_label));
+      } else if (call->function() == "Memory.peek") {
+        rewritten.push_back(std::make_unique<PeekCommand>());
+      } else {
+        rewritten.push_back(std::make_unique<PokeCommand>());
+      }
+    }
+    part = std::move(rewritten);
+  }
+}
+
+InliningPass::InliningPass(int max_words) : max_words_(max_words) {}
+
+std::string_view InliningPass::name() const { return "inlining"; }
+
+void InliningPass::Run(std::vector<CommandList> *parts) const {
+  CallGraph graph = BuildCallGraph(*parts);
+  std::unordered_map<std::string, std::vector<const Command *>> bodies;
+  for (const CommandList &part : *parts) {
+    std::vector<const Command *> *body = nullptr;
+    for (const std::unique_ptr<Command> &command : part) {
+      if (auto *definition = dynamic_cast<FunctionCommand *>(command.get())) {
+        body = &bodies[definition->identifier()];
+      } else if (body) {
+        body->push_back(command.get());
+      }
+    }
+  }
+
+  // The bodies of the functions to inline, which are only copied, so they
+  // stay valid while the parts are rewritten.
+  std::unordered_map<std::string, const std::vector<const Command *> *>
+      inlined;
+  for (const std::string &function : graph.order) {
+    auto call_sites = graph.call_site_counts.find(function);
+    if (call_sites == graph.call_site_counts.end()) {
+      continue;
+    }
+    const FunctionInfo &info = graph.functions[function];
+    const std::vector<const Command *> &body = bodies[function];
+    HackProgram lowered;
+    bool copyable = true;
+    for (const Command *command : body) {
+      copyable = copyable && InlineCommand(*command, {"", 0, 0});
+      if (!dynamic_cast<const ReturnCommand *>(command)) {
+        command->Lower(&lowered);
+      }
+    }
+    int words = lowered.InstructionCount();
+    std::string reason;
+    if (function == "Sys.init") {
+      reason = "entered by the bootstrap";
+    } else if (info.recursive) {
+      reason = "recursive";
+    } else if (info.changes_pointers) {
+      reason = "changes THIS or THAT";
+    } else if (!info.well_formed || !copyable) {
+      reason = "does not leave only its result on the stack";
+    } else if (words > max_words_ && call_sites->second > 1) {
+      reason = absl::StrCat(words, " words exceed the limit of ", max_words_);
+    }
+    if (reason.empty()) {
+      LOG(INFO) << "Inlining " << function << " (" << words << " words) at "
+                << call_sites->second << " call sites";
+      inlined[function] = &body;
+    } else {
+      LOG(INFO) << "Not inlining " << function << ": " << reason;
+    }
+  }
+  if (inlined.empty()) {
+    return;
+  }
+
+  std::vector<CommandList> rewritten(parts->size());
+  for (size_t i = 0; i < parts->size(); ++i) {
+    CommandList &commands = rewritten[i];
+    // The definition of the function being rewritten in `commands`, and the
+    // locals added to it.
+    const FunctionCommand *caller = nullptr;
+    size_t caller_index = 0;
+    int added_locals = 0;
+    auto finish_caller = [&] {
+      if (added_locals > 0) {
+        commands[caller_index] = std::make_unique<FunctionCommand>(
+            caller->identifier(), caller->variable_count() + added_locals);
+      }
+      added_locals = 0;
+    };
+    for (std::unique_ptr<Command> &command : (*parts)[i]) {
+      if (auto *definition = dynamic_cast<FunctionCommand *>(command.get())) {
+        finish_caller();
+        caller = definition;
+        caller_index = commands.size();
+      }
+      auto *call = dynamic_cast<CallCommand *>(command.get());
+      auto callee = call ? inlined.find(call->function()) : inlined.end();
+      // `Sys.init` keeps its frame, as it never returns to pop additional
+      // locals and test scripts compare the stack pointer it ends with.
+      if (!caller || caller->identifier() == "Sys.init" ||
+          callee == inlined.end() ||
+          call->argument_count() <
+              graph.functions[call->function()].argument_count) {
+        commands.push_back(std::move(command));
+        continue;
+      }
+
+      int argument_count = call->argument_count();
+      int local_count = graph.functions[call->function()].variable_count;
+      InlineSite site{call->return_label(), caller->variable_count(),
+                      caller->variable_count() + argument_count};
+      added_locals = std::max(added_locals, argument_count + local_count);
+      for (int j = argument_count - 1; j >= 0; --j) {
+        commands.push_back(std::make_unique<PopCommand>(
+            std::make_unique<LocalAddress>(site.first_argument + j)));
+      }
+      for (int j = 0; j < local_count; ++j) {
+        commands.push_back(
+            std::make_unique<PushCommand>(std::make_unique<ConstantAddress>(0)));
+        commands.push_back(std::make_unique<PopCommand>(
+            std::make_unique<LocalAddress>(site.first_local + j)));
+      }
+      const std::vector<const Command *> &body = *callee->second;
+      // The last `return` falls through to the end of the body.
+      auto last = std::find_if(body.rbegin(), body.rend(), [](auto *command) {
+        return !dynamic_cast<const CommentCommand *>(command);
+      });
+      const Command *fall_through =
+          last != body.rend() && dynamic_cast<const ReturnCommand *>(*last)
+              ? *last
+              : nullptr;
+      bool jumps_to_end = false;
+      for (const Command *body_command : body) {
+        if (body_command == fall_through) {
+          continue;
+        }
+        jumps_to_end = jumps_to_end ||
+                       dynamic_cast<const ReturnCommand *>(body_command);
+        commands.push_back(InlineCommand(*body_command, site));
+      }
+      if (jumps_to_end) {
+        commands.push_back(std::make_unique<LabelCommand>(site.end_label));
+      }
+    }
+    finish_caller();
+  }
+  *parts = std::move(rewritten);
+}
+
+std::string_view StaticFramePass::name() const { return "static-frame"; }
+
+void StaticFramePass::Run(std::vector<CommandList> *parts) const {
+  CallGraph graph = BuildCallGraph(*parts);
+  // The first overlay word the frame of each function may use.
+  std::unordered_map<std::string, int> frame_begins;
+
+  // Callers are allocated before their callees, whose frames start after the
+  // end of the frame of any caller.
+  const int budget =
+      kVariableWords - static_cast<int>(graph.static_variables.size());
+  std::unordered_map<std::string, StaticFrame> frames;
+  for (auto component = graph.components.rbegin();
+       component != graph.components.rend(); ++component) {
+    // Members of a cycle are all active while any of them is, so their frames
+    // start after those of the callers of any member.
+    int component_begin = 0;
+    for (const std::string &function : *component) {
+      component_begin = std::max(component_begin, frame_begins[function]);
+    }
+    for (const std::string &function : *component) {
+      frame_begins[function] = component_begin;
+    }
+    for (const std::string &function : *component) {
+      const FunctionInfo &info = graph.functions[function];
+      int frame_end = frame_begins[function];
+      auto argument_count = graph.call_argument_counts.find(function);
+      if (!info.recursive && info.well_formed && function != "Sys.init" &&
+          argument_count != graph.call_argument_counts.end() &&
+          argument_count->second >= info.argument_count) {
+        int size = 1 + (info.changes_pointers ? 2 : 0) +
+                   argument_count->second + info.variable_count;
+        if (frame_end + size <= budget) {
+          auto slot = [&] { return absl::StrCat("$FRAME.", frame_end++); };
+          StaticFrame &frame = frames[function];
+          frame.return_address = slot();
+          if (info.changes_pointers) {
+            frame.saved_pointers = {slot(), slot()};
+          }
+          for (int i = 0; i < argument_count->second; ++i) {
+            frame.arguments.push_back(slot());
+          }
+          for (int i = 0; i < info.variable_count; ++i) {
+            frame.locals.push_back(slot());
+          }
+        }
+      }
+      for (const std::string &callee : info.callees) {
+        if (graph.functions.count(callee)) {
+          frame_begins[callee] = std::max(frame_begins[callee], frame_end);
+        }
+      }
+    }
+  }
+
+  for (CommandList &part : *parts) {
+    const StaticFrame *frame = nullptr;
+    for (std::unique_ptr<Command> &command : part) {
+      if (auto *definition = dynamic_cast<FunctionCommand *>(command.get())) {
+        auto found = frames.find(definition->identifier());
+        frame = found == frames.end() ? nullptr : &found->second;
+        if (frame) {
+          command = std::make_unique<StaticFunctionCommand>(
+              definition->identifier(), *frame);
+        }
+      } else if (auto *call = dynamic_cast<CallCommand *>(command.get())) {
+        auto found = frames.find(call->function());
+        if (found != frames.end()) {
+          command = std::make_unique<StaticCallCommand>(
+              call->function(), call->return_label(), found->second);
+        }
+      } else if (!frame) {
+        continue;
+      } else if (dynamic_cast<ReturnCommand *>(command.get())) {
+        command = std::make_unique<StaticReturnCommand>(*frame);
+      } else if (auto *push = dynamic_cast<PushCommand *>(command.get())) {
+        if (auto *slot = FrameSlot(push->address(), *frame)) {
+          command = std::make_unique<PushCommand>(
+              std::make_unique<SymbolAddress>(*slot));
+        }
+      } else if (auto *pop = dynamic_cast<PopCommand *>(command.get())) {
+        if (auto *slot = FrameSlot(pop->address(), *frame)) {
+          command = std::make_unique<PopCommand>(
+              std::make_unique<SymbolAddress>(*slot));
+        }
+      }
+    }
+  }
+}
+
+std::string_view CallingConventionPass::name() const {
+  return "calling-convention";
+}
+
+void CallingConventionPass::Run(std::vector<CommandList> *parts) const {
+  std::unordered_set<std::string> defined;
+  std::unordered_set<std::string> called;
+  std::unordered_set<std::string> changes_pointers;
+  for (const CommandList &part : *parts) {
+    std::string function;
+    for (const std::unique_ptr<Command> &command : part) {
+      if (const std::string *definition = DefinedFunction(command.get())) {
+        function = *definition;
+        defined.insert(function);
+      } else if (auto *call = dynamic_cast<CallCommand *>(command.get())) {
+        called.insert(call->function());
+      } else if (auto *pop = dynamic_cast<PopCommand *>(command.get())) {
+        if (dynamic_cast<const PointerAddress *>(&pop->address())) {
+          changes_pointers.insert(function);
+        }
+      }
+    }
+  }
+  // The bootstrap calls `Sys.init` with the standard frame.
+  called.erase("Sys.init");
+  auto is_light = [&](const std::string &function) {
+    return defined.count(function) && called.count(function) &&
+           !changes_pointers.count(function);
+  };
+
+  for (CommandList &part : *parts) {
+    std::string function;
+    for (std::unique_ptr<Command> &command : part) {
+      if (const std::string *definition = DefinedFunction(command.get())) {
+        function = *definition;
+      } else if (auto *call = dynamic_cast<CallCommand *>(command.get())) {
+        if (is_light(call->function())) {
+          command = std::make_unique<CallCommand>(
+              call->function(), call->argument_count(), call->return_label(),
+              FrameLayout::kLight);
+        }
+      } else if (dynamic_cast<ReturnCommand *>(command.get())) {
+        if (is_light(function)) {
+          command = std::make_unique<ReturnCommand>(FrameLayout::kLight);
+        }
+      }
+    }
+  }
+}
+
+std::string_view TailCallPass::name() const { return "tail-call"; }
+
+void TailCallPass::Run(std::vector<CommandList> *parts) const {
+  CallGraph graph = BuildCallGraph(*parts);
+  for (CommandList &part : *parts) {
+    std::string function;
+    for (auto it = part.begin(); it != part.end(); ++it) {
+      if (const std::string *definition = DefinedFunction(it->get())) {
+        function = *definition;
+        continue;
+      }
+      auto *call = dynamic_cast<CallCommand *>(it->get());
+      if (!call || function.empty()) {
+        continue;
+      }
+      auto next = std::find_if(
+          std::next(it), part.end(), [](const std::unique_ptr<Command> &next) {
+            return !dynamic_cast<CommentCommand *>(next.get());
+          });
+      auto *ret = next == part.end()
+                      ? nullptr
+                      : dynamic_cast<ReturnCommand *>(next->get());
+      if (!ret || ret->frame() != call->frame()) {
+        continue;
+      }
+      // Without arguments to move, the frame can always be reused.
+      auto caller_argument_count = graph.call_argument_counts.find(function);
+      if (call->argument_count() > 0 &&
+          (caller_argument_count == graph.call_argument_counts.end() ||
+           caller_argument_count->second < call->argument_count())) {
+        continue;
+      }
+      *it = std::make_unique<TailCallCommand>(call->function(),
+                                              call->argument_count());
+      next->reset();
+    }
+    part.erase(std::remove(part.begin(), part.end(), nullptr), part.end());
+  }
+}
+
+std::string_view ControlFlowSimplificationPass::name() const {
+  return "cfg-simplification";
+}
+
+namespace {
+
+// What `SimplifyControlFlow()` changed.
+struct SimplificationStats {
+  int threaded_jumps = 0;
+  int removed_jumps = 0;
+  int removed_labels = 0;
+  int unreachable_commands = 0;
+  // The number of instructions the removed commands took.
+  size_t removed_words = 0;
+};
+
+// Simplifies the function of `graph` once, replacing threaded jumps in
+// `commands` and resetting the commands it removes. Returns whether anything
+// changed.
+bool SimplifyControlFlow(const ControlFlowGraph &graph, CommandList *commands,
+                         SimplificationStats *stats) {
+  // Unreachable code is removed first, so that no jump is redirected to one
+  // of its labels.
+  std::vector<bool> removed(graph.end() - graph.begin());
+  std::vector<bool> reachable(graph.blocks().size());
+  for (int block : graph.ReversePostorder()) {
+    reachable[block] = true;
+  }
+  for (size_t block = 0; block < graph.blocks().size(); ++block) {
+    if (reachable[block]) {
+      continue;
+    }
+    for (size_t i = graph.blocks()[block].begin; i < graph.blocks()[block].end;
+         ++i) {
+      removed[i - graph.begin()] = true;
+      ++stats->unreachable_commands;
+    }
+  }
+
+  // Each reachable label maps to the first of the consecutive labels it
+  // belongs to, and that one to the target of the `goto` right after them, if
+  // any.
+  std::unordered_map<std::string, std::string> canonical_labels;
+  std::unordered_map<std::string, std::string> forwarded_labels;
+  const std::string *run_label = nullptr;
+  for (size_t i = graph.begin(); i < graph.end(); ++i) {
+    const Command *command = (*commands)[i].get();
+    if (removed[i - graph.begin()] ||
+        dynamic_cast<const CommentCommand *>(command)) {
+      continue;
+    }
+    if (auto *label = dynamic_cast<const LabelCommand *>(command)) {
+      if (!run_label) {
+        run_label = &label->label();
+      }
+      canonical_labels.emplace(label->label(), *run_label);
+      continue;
+    }
+    if (auto *jump = dynamic_cast<const GotoCommand *>(command);
+        jump && run_label) {
+      forwarded_labels.emplace(*run_label, jump->label());
+    }
+    run_label = nullptr;
+  }
+  auto canonical = [&](const std::string &label) {
+    auto found = canonical_labels.find(label);
+    return found == canonical_labels.end() ? label : found->second;
+  };
+  auto resolve = [&](const std::string &label) {
+    std::string target = canonical(label);
+    std::unordered_set<std::string> visited = {target};
+    for (auto found = forwarded_labels.find(target);
+         found != forwarded_labels.end();
+         found = forwarded_labels.find(target)) {
+      std::string next = canonical(found->second);
+      if (!visited.insert(next).second) {
+        // A loop of jumps, which must be kept.
+        break;
+      }
+      target = std::move(next);
+    }
+    return target;
+  };
+
+  bool changed = false;
+  for (size_t i = graph.begin(); i < graph.end(); ++i) {
+    if (removed[i - graph.begin()]) {
+      continue;
+    }
+    std::unique_ptr<Command> &command = (*commands)[i];
+    if (auto *jump = dynamic_cast<IfGotoCommand *>(command.get())) {
+      std::string target = resolve(jump->label());
+      if (target != jump->label()) {
+        command = std::make_unique<IfGotoCommand>(target);
+        ++stats->threaded_jumps;
+        changed = true;
+      }
+      continue;
+    }
+    auto *jump = dynamic_cast<GotoCommand *>(command.get());
+    if (!jump) {
+      continue;
+    }
+    std::string target = resolve(jump->label());
+    if (target != jump->label()) {
+      command = std::make_unique<GotoCommand>(target);
+      ++stats->threaded_jumps;
+      changed = true;
+    }
+    for (size_t j = i + 1; j < graph.end(); ++j) {
+      const Command *next = (*commands)[j].get();
+      if (removed[j - graph.begin()] ||
+          dynamic_cast<const CommentCommand *>(next)) {
+        continue;
+      }
+      auto *label = dynamic_cast<const LabelCommand *>(next);
+      if (!label) {
+        break;
+      }
+      if (canonical(label->label()) == target) {
+        removed[i - graph.begin()] = true;
+        ++stats->removed_jumps;
+        break;
+      }
+    }
+  }
+
+  std::unordered_set<std::string> jump_targets;
+  for (size_t i = graph.begin(); i < graph.end(); ++i) {
+    std::string label;
+    if (!removed[i - graph.begin()] &&
+        ControlTransferOf((*commands)[i].get(), &label) !=
+            ControlTransfer::kNone) {
+      jump_targets.insert(std::move(label));
+    }
+  }
+  for (size_t i = graph.begin(); i < graph.end(); ++i) {
+    auto *label = dynamic_cast<const LabelCommand *>((*commands)[i].get());
+    if (label && !removed[i - graph.begin()] &&
+        !jump_targets.count(label->label())) {
+      removed[i - graph.begin()] = true;
+      ++stats->removed_labels;
+    }
+  }
+
+  for (size_t i = graph.begin(); i < graph.end(); ++i) {
+    if (removed[i - graph.begin()]) {
+      stats->removed_words += (*commands)[i]->InstructionCount();
+      (*commands)[i].reset();
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+}  // namespace
+
+void ControlFlowSimplificationPass::Run(std::vector<CommandList> *parts) const {
+  SimplificationStats stats;
+  for (CommandList &part : *parts) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (const ControlFlowGraph &graph : BuildControlFlowGraphs(part)) {
+        changed |= SimplifyControlFlow(graph, &part, &stats);
+      }
+      part.erase(std::remove(part.begin(), part.end(), nullptr), part.end());
+    }
+  }
+  if (stats.threaded_jumps > 0 || stats.removed_words > 0 ||
+      stats.removed_labels > 0) {
+    LOG(INFO) << "Threaded " << stats.threaded_jumps << " jumps, removed "
+              << stats.removed_jumps << " jumps to the next command, "
+              << stats.removed_labels << " labels and "
+              << stats.unreachable_commands
+              << " unreachable commands, which would have used "
+              << stats.removed_words << " words of ROM before "
+              << "optimization";
+  }
+}
+
+std::string_view LoopInvariantCodeMotionPass::name() const {
+  return "loop-invariant-code-motion";
+}
+
+namespace {
+
+// The variables the commands of a loop store to.
+struct LoopWrites {
+  std::set<int> locals;
+  std::set<int> arguments;
+  std::set<int> pointers;
+  std::set<int> temps;
+  std::set<std::string> symbols;
+  // Whether anything is stored through THIS, THAT or `Memory.poke`.
+  bool heap = false;
+
+  void Add(const Address &address) {
+    if (auto *local = dynamic_cast<const LocalAddress *>(&address)) {
+      locals.insert(local->index());
+    } else if (auto *argument =
+                   dynamic_cast<const ArgumentAddress *>(&address)) {
+      arguments.insert(argument->index());
+    } else if (auto *pointer = dynamic_cast<const PointerAddress *>(&address)) {
+      pointers.insert(pointer->index());
+    } else if (auto *temp = dynamic_cast<const TempAddress *>(&address)) {
+      temps.insert(temp->index());
+    } else if (auto *symbol = dynamic_cast<const SymbolAddress *>(&address)) {
+      symbols.insert(symbol->symbol());
+    } else {
+      heap = true;
+    }
+  }
+
+  // Whether the value at `address` is the same in every iteration.
+  bool Invariant(const Address &address) const {
+    if (dynamic_cast<const ConstantAddress *>(&address)) {
+      return true;
+    }
+    if (auto *local = dynamic_cast<const LocalAddress *>(&address)) {
+      return !locals.count(local->index());
+    }
+    if (auto *argument = dynamic_cast<const ArgumentAddress *>(&address)) {
+      return !arguments.count(argument->index());
+    }
+    if (auto *pointer = dynamic_cast<const PointerAddress *>(&address)) {
+      return !pointers.count(pointer->index());
+    }
+    if (auto *temp = dynamic_cast<const TempAddress *>(&address)) {
+      return !temps.count(temp->index());
+    }
+    if (auto *symbol = dynamic_cast<const SymbolAddress *>(&address)) {
+      return !symbols.count(symbol->symbol());
+    }
+    if (dynamic_cast<const ThisAddress *>(&address)) {
+      return !heap && !pointers.count(0);
+    }
+    if (dynamic_cast<const ThatAddress *>(&address)) {
+      return !heap && !pointers.count(1);
+    }
+    return false;
+  }
+};
+
+// Stores in `writes` the variables the commands of `loop` store to. Returns
+// false if the loop contains commands that may store to unknown variables, such
+// as calls.
+bool FindLoopWrites(const ControlFlowGraph &graph, const Loop &loop,
+                    LoopWrites *writes) {
+  for (size_t block = 0; block < graph.blocks().size(); ++block) {
+    if (!loop.blocks[block]) {
+      continue;
+    }
+    for (size_t i = graph.blocks()[block].begin;
+         i < graph.blocks()[block].end; ++i) {
+      const Command *command = graph.commands()[i].get();
+      if (auto *pop = dynamic_cast<const PopCommand *>(command)) {
+        writes->Add(pop->address());
+      } else if (dynamic_cast<const PokeCommand *>(command)) {
+        writes->heap = true;
+      } else if (!dynamic_cast<const PushCommand *>(command) &&
+                 !dynamic_cast<const BinaryArithmeticCommand *>(command) &&
+                 !dynamic_cast<const UnaryArithmeticCommand *>(command) &&
+                 !dynamic_cast<const BinaryComparisonCommand *>(command) &&
+                 !dynamic_cast<const ConstantArithmeticCommand *>(command) &&
+                 !dynamic_cast<const SharedBinaryCommand *>(command) &&
+                 !dynamic_cast<const PeekCommand *>(command) &&
+                 !dynamic_cast<const CompareJumpCommand *>(command) &&
+                 !dynamic_cast<const LabelCommand *>(command) &&
+                 !dynamic_cast<const GotoCommand *>(command) &&
+                 !dynamic_cast<const IfGotoCommand *>(command) &&
+                 !dynamic_cast<const CommentCommand *>(command) &&
+                 !dynamic_cast<const ReturnCommand *>(command) &&
+                 !dynamic_cast<const StaticReturnCommand *>(command) &&
+                 !dynamic_cast<const TailCallCommand *>(command)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// A value on the stack while a block is scanned for invariant expressions.
+struct StackValue {
+  // Whether the commands [begin, end) compute the value from invariant ones.
+  bool invariant = false;
+  size_t begin = 0;
+  size_t end = 0;
+};
+
+// Appends to `expressions` the ranges of commands in the blocks of `loop` that
+// compute a value from variables in no `writes` and constants only, as long as
+// possible.
+void FindInvariantExpressions(const ControlFlowGraph &graph, const Loop &loop,
+                              const LoopWrites &writes,
+                              std::vector<StackValue> *expressions) {
+  for (size_t block = 0; block < graph.blocks().size(); ++block) {
+    if (!loop.blocks[block]) {
+      continue;
+    }
+    std::vector<StackValue> stack;
+    auto pop = [&] {
+      if (!stack.empty()) {
+        if (stack.back().invariant) {
+          expressions->push_back(stack.back());
+        }
+        stack.pop_back();
+      }
+    };
+    for (size_t i = graph.blocks()[block].begin;
+         i < graph.blocks()[block].end; ++i) {
+      const Command *command = graph.commands()[i].get();
+      size_t size = stack.size();
+      if (auto *push = dynamic_cast<const PushCommand *>(command);
+          push && writes.Invariant(push->address())) {
+        stack.push_back({true, i, i + 1});
+        continue;
+      }
+      if ((dynamic_cast<const UnaryArithmeticCommand *>(command) ||
+           dynamic_cast<const ConstantArithmeticCommand *>(command)) &&
+          size >= 1 && stack[size - 1].invariant && stack[size - 1].end == i) {
+        stack[size - 1].end = i + 1;
+        continue;
+      }
+      if (dynamic_cast<const BinaryArithmeticCommand *>(command) &&
+          size >= 2 && stack[size - 2].invariant && stack[size - 1].invariant &&
+          stack[size - 2].end == stack[size - 1].begin &&
+          stack[size - 1].end == i) {
+        stack.pop_back();
+        stack.back().end = i + 1;
+        continue;
+      }
+      int pops;
+      int pushes;
+      if (!StackEffect(command, &pops, &pushes)) {
+        pops = stack.size();
+        pushes = 0;
+      }
+      for (int j = 0; j < pops; ++j) {
+        pop();
+      }
+      stack.resize(stack.size() + pushes);
+    }
+    while (!stack.empty()) {
+      pop();
+    }
+  }
+}
+
+// Returns the number of instructions the commands [begin, end) of `commands`
+// lower to.
+size_t LoweredSize(const CommandList &commands, size_t begin, size_t end) {
+  size_t size = 0;
+  for (size_t i = begin; i < end; ++i) {
+    size += commands[i]->InstructionCount();
+  }
+  return size;
+}
+
+// Moves the invariant expressions of `loop` before its header, storing them in
+// `free_temps` from `*next_temp` on, which is advanced past the temps used.
+// Returns the number of expressions moved.
+int HoistInvariantExpressions(const ControlFlowGraph &graph, const Loop &loop,
+                              const std::vector<int> &free_temps,
+                              size_t *next_temp, CommandList *commands) {
+  // The code before the header must fall through into it, which is the only
+  // way into the loop, so that it can compute the expressions.
+  const BasicBlock &header = graph.blocks()[loop.header];
+  if (loop.header == 0 || loop.blocks[loop.header - 1] ||
+      !dynamic_cast<const LabelCommand *>((*commands)[header.begin].get())) {
+    return 0;
+  }
+  for (int predecessor : header.predecessors) {
+    if (loop.blocks[predecessor]) {
+      continue;
+    }
+    std::string label;
+    ControlTransfer transfer = ControlTransferOf(
+        (*commands)[graph.blocks()[predecessor].end - 1].get(), &label);
+    if (predecessor != loop.header - 1 ||
+        (transfer != ControlTransfer::kNone &&
+         graph.LabelBlock(label) == loop.header)) {
+      return 0;
+    }
+  }
+  LoopWrites writes;
+  if (!FindLoopWrites(graph, loop, &writes)) {
+    return 0;
+  }
+  std::vector<StackValue> expressions;
+  FindInvariantExpressions(graph, loop, writes, &expressions);
+
+  HackProgram load;
+  PushCommand(std::make_unique<TempAddress>(0)).Lower(&load);
+  CommandList preheader;
+  // The temp holding each expression moved, by its assembly code.
+  std::unordered_map<std::string, int> expression_temps;
+  int moved = 0;
+  for (const StackValue &expression : expressions) {
+    if (LoweredSize(*commands, expression.begin, expression.end) <=
+        load.InstructionCount()) {
+      continue;
+    }
+    std::string assembly;
+    for (size_t i = expression.begin; i < expression.end; ++i) {
+      assembly += (*commands)[i]->ToAssembly();
+    }
+    auto found = expression_temps.find(assembly);
+    if (found == expression_temps.end()) {
+      if (*next_temp == free_temps.size()) {
+        continue;
+      }
+      found =
+          expression_temps.emplace(assembly, free_temps[(*next_temp)++]).first;
+      for (size_t i = expression.begin; i < expression.end; ++i) {
+        preheader.push_back(std::move((*commands)[i]));
+      }
+      preheader.push_back(std::make_unique<PopCommand>(
+          std::make_unique<TempAddress>(found->second)));
+      ++moved;
+    }
+    for (size_t i = expression.begin; i < expression.end; ++i) {
+      (*commands)[i].reset();
+    }
+    (*commands)[expression.begin] = std::make_unique<PushCommand>(
+        std::make_unique<TempAddress>(found->second));
+  }
+  commands->insert(commands->begin() + header.begin,
+                   std::make_move_iterator(preheader.begin()),
+                   std::make_move_iterator(preheader.end()));
+  commands->erase(std::remove(commands->begin(), commands->end(), nullptr),
+                  commands->end());
+  return moved;
+}
+
+}  // namespace
+
+void LoopInvariantCodeMotionPass::Run(std::vector<CommandList> *parts) const {
+  // Temps are shared by all functions, so only those no command uses are free.
+  std::vector<bool> used_temps(8);
+  for (const CommandList &part : *parts) {
+    for (const std::unique_ptr<Command> &command : part) {
+      const Address *address = nullptr;
+      if (auto *push = dynamic_cast<const PushCommand *>(command.get())) {
+        address = &push->address();
+      } else if (auto *pop = dynamic_cast<const PopCommand *>(command.get())) {
+        address = &pop->address();
+      }
+      if (auto *temp = dynamic_cast<const TempAddress *>(address);
+          temp && temp->index() < used_temps.size()) {
+        used_temps[temp->index()] = true;
+      }
+    }
+  }
+  std::vector<int> free_temps;
+  for (size_t i = 0; i < used_temps.size(); ++i) {
+    if (!used_temps[i]) {
+      free_temps.push_back(i);
+    }
+  }
+  if (free_temps.empty()) {
+    return;
+  }
+
+  int moved = 0;
+  for (CommandList &part : *parts) {
+    // Loops without calls never run at the same time as loops of other
+    // functions, so each function can use all free temps. Within a function,
+    // each loop uses its own.
+    std::unordered_map<const Command *, size_t> next_temps;
+    std::unordered_set<std::string> visited_headers;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (const ControlFlowGraph &graph : BuildControlFlowGraphs(part)) {
+        for (const Loop &loop : FindLoops(graph)) {
+          auto *label = dynamic_cast<const LabelCommand *>(
+              part[graph.blocks()[loop.header].begin].get());
+          if (!label || !visited_headers.insert(label->label()).second) {
+            continue;
+          }
+          int count = HoistInvariantExpressions(
+              graph, loop, free_temps,
+              &next_temps[part[graph.begin()].get()], &part);
+          if (count > 0) {
+            moved += count;
+            changed = true;
+            break;
+          }
+        }
+        if (changed) {
+          break;
+        }
+      }
+    }
+  }
+  if (moved > 0) {
+    LOG(INFO) << "Moved " << moved << " loop-invariant expressions";
+  }
+}
+
+std::string_view IdenticalCodeFoldingPass::name() const {
+  return "identical-code-folding";
+}
+
+namespace {
+
+// Returns the instructions `commands` lower to as text, with the labels they
+// define, including the name of the function, replaced by their position.
+std::string NormalizedCode(CommandList::const_iterator begin,
+                           CommandList::const_iterator end) {
+  HackProgram program;
+  for (auto command = begin; command != end; ++command) {
+    (*command)->Lower(&program);
+  }
+  std::unordered_map<uint32_t, int> labels;
+  for (const Instruction &instruction : program.instructions()) {
+    if (instruction.kind == Instruction::kLabel) {
+      labels.emplace(instruction.operand, labels.size());
+    }
+  }
+  std::string code;
+  for (const Instruction &instruction : program.instructions()) {
+    switch (instruction.kind) {
+      case Instruction::kAddress:
+        absl::StrAppend(&code, "@", instruction.operand, "\n");
+        break;
+      case Instruction::kSymbol:
+      case Instruction::kLabel: {
+        auto found = labels.find(instruction.operand);
+        std::string symbol =
+            found == labels.end()
+                ? std::string(program.symbol(instruction.operand))
+                : absl::StrCat("$", found->second);
+        absl::StrAppend(&code,
+                        instruction.kind == Instruction::kLabel ? "(" : "@",
+                        symbol, "\n");
+        break;
+      }
+      case Instruction::kCompute:
+        absl::StrAppend(&code, instruction.destination, " ",
+                        ComputationString(instruction.computation), " ",
+                        JumpString(instruction.jump), "\n");
+        break;
+      case Instruction::kComment:
+        break;
+    }
+  }
+  return code;
+}
+
+}  // namespace
+
+void IdenticalCodeFoldingPass::Run(std::vector<CommandList> *parts) const {
+  // The functions with the same code as an earlier one, and the names of those
+  // folded into each kept function.
+  std::unordered_set<std::string> folded;
+  std::unordered_map<std::string, std::vector<std::string>> aliases;
+  std::unordered_map<std::string, std::string> functions_by_code;
+  for (const CommandList &part : *parts) {
+    for (auto begin = part.begin(); begin != part.end();) {
+      const std::string *function = DefinedFunction(begin->get());
+      auto end = std::find_if(begin + 1, part.end(),
+                              [](const std::unique_ptr<Command> &command) {
+                                return DefinedFunction(command.get());
+                              });
+      if (function) {
+        auto [found, inserted] =
+            functions_by_code.emplace(NormalizedCode(begin, end), *function);
+        if (!inserted) {
+          folded.insert(*function);
+          aliases[found->second].push_back(*function);
+        }
+      }
+      begin = end;
+    }
+  }
+  if (folded.empty()) {
+    return;
+  }
+
+  HackProgram removed;
+  for (CommandList &part : *parts) {
+    CommandList kept;
+    bool keep = true;
+    for (std::unique_ptr<Command> &command : part) {
+      if (const std::string *function = DefinedFunction(command.get())) {
+        keep = !folded.count(*function);
+        auto found = aliases.find(*function);
+        if (found != aliases.end()) {
+          for (const std::string &alias : found->second) {
+            kept.push_back(std::make_unique<LabelCommand>(alias));
+          }
+        }
+      }
+      if (keep) {
+        kept.push_back(std::move(command));
+      } else {
+        command->Lower(&removed);
+      }
+    }
+    part = std::move(kept);
+  }
+  LOG(INFO) << "Folded " << folded.size()
+            << " functions identical to others, which would have used "
+            << removed.InstructionCount() << " words of ROM before "
+            << "optimization";
+}
@@ -0,0 +1,274 @@
+#ifndef NAND2TETRIS_VMTRANSLATOR_OPTIMIZER_H_
+#define NAND2TETRIS_VMTRANSLATOR_OPTIMIZER_H_
+
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+#include "commands.h"
+
+enum class OptimizationLevel {
+  kNone,
+  // Prefer faster code.
+  kSpeed,
+  // Prefer smaller code.
+  kSize,
+};
+
+// Parses "none", "speed" or "size". Returns false for anything else.
+bool ParseOptimizationLevel(std::string_view text, OptimizationLevel *level);
+
+// A pass rewriting VM commands before they are lowered to Hack instructions.
+class VmPass {
+ public:
+  virtual ~VmPass() = default;
+  virtual std::string_view name() const = 0;
+  virtual void Run(CommandList *commands) const = 0;
+};
+
+// A pass over all parts of a program at once, for optimizations that need to
+// know about the functions defined or called in other parts. Program passes
+// run before the `VmPass`es of each part, and late program passes after them.
+class ProgramPass {
+ public:
+  virtual ~ProgramPass() = default;
+  virtual std::string_view name() const = 0;
+  virtual void Run(std::vector<CommandList> *parts) const = 0;
+};
+
+// Runs passes over command lists. `Run()` may be called concurrently from
+// multiple threads, for example on separately parsed parts of a program.
+class VmPassManager {
+ public:
+  void AddPass(std::unique_ptr<VmPass> pass);
+  void AddProgramPass(std::unique_ptr<ProgramPass> pass);
+  void AddLateProgramPass(std::unique_ptr<ProgramPass> pass);
+  void Run(CommandList *commands) const;
+  bool has_program_passes() const;
+  void RunProgramPasses(std::vector<CommandList> *parts) const;
+  void RunLateProgramPasses(std::vector<CommandList> *parts) const;
+  // Logs the number of commands each pass has removed in all runs.
+  void LogStatistics() const;
+
+ private:
+  std::vector<std::unique_ptr<VmPass>> passes_;
+  std::vector<std::unique_ptr<ProgramPass>> program_passes_;
+  std::vector<std::unique_ptr<ProgramPass>> late_program_passes_;
+  mutable absl::Mutex mutex_;
+  mutable std::vector<int64_t> removed_counts_ ABSL_GUARDED_BY(mutex_);
+  mutable std::vector<int64_t> program_removed_counts_ ABSL_GUARDED_BY(mutex_);
+  mutable std::vector<int64_t> late_program_removed_counts_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+// Adds the passes of `level` to `pass_manager`. With `OptimizationLevel::kSpeed`,
+// functions whose bodies lower to at most `inline_words` instructions are
+// inlined and loop-invariant expressions are moved out of loops. Functions with
+// at most `unroll_locals` locals set them to 0 with unrolled stores, or with
+// `OptimizationLevel::kSize` through a shared routine where that is shorter,
+// and larger ones use a loop. Calls of the functions in `intrinsics` are
+// replaced by an `IntrinsicPass` at any level. Commands calling shared routines
+// record them in `routines`.
+void AddVmPasses(OptimizationLevel level, int inline_words, int unroll_locals,
+                 const std::set<std::string> &intrinsics,
+                 SharedRoutines *routines, VmPassManager *pass_manager);
+
+// Rewrites short sequences of commands into cheaper equivalents: folds
+// arithmetic on constants, applies arithmetic with a constant operand in place
+// on the stack, and turns `push` followed by `pop` into a direct move.
+class PeepholePass : public VmPass {
+ public:
+  std::string_view name() const override;
+  void Run(CommandList *commands) const override;
+};
+
+// Jumps directly on the operands of `eq`, `gt` and `lt`, optionally followed by
+// `not`, or on a pushed value when followed by `if-goto`, instead of storing a
+// boolean on the stack and popping it again.
+class BranchFusionPass : public VmPass {
+ public:
+  std::string_view name() const override;
+  void Run(CommandList *commands) const override;
+};
+
+// Replaces comparisons that still store a boolean on the stack with calls to
+// shared routines, for each kind of comparison whose sites together save more
+// instructions than its routine takes. It runs as a late program pass, after
+// `BranchFusionPass` has removed the comparisons it can.
+class SharedComparisonPass : public ProgramPass {
+ public:
+  explicit SharedComparisonPass(SharedRoutines *routines);
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+
+ private:
+  SharedRoutines *routines_;
+};
+
+// Replaces calls and returns with jumps to shared routines, which set up and
+// tear down the frame in the standard layout. Each frame layout shares its
+// return routine, and its call routine with an entry per argument count, only
+// for the sites that together save more instructions than the routine takes.
+class SharedCallPass : public ProgramPass {
+ public:
+  explicit SharedCallPass(SharedRoutines *routines);
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+
+ private:
+  SharedRoutines *routines_;
+};
+
+// Chooses how each function sets its locals to 0 by their number: functions
+// with at most `unroll_locals` locals store each of them, and larger ones use a
+// loop.
+class LocalInitializationPass : public VmPass {
+ public:
+  explicit LocalInitializationPass(int unroll_locals);
+  std::string_view name() const override;
+  void Run(CommandList *commands) const override;
+
+ private:
+  int unroll_locals_;
+};
+
+// Makes functions that store each of their locals jump into the shared routine
+// setting them to 0 instead, whose length grows with the largest number of
+// locals it serves. The local counts served are chosen so that the sites
+// together save more instructions than the routine takes.
+class SharedLocalInitializationPass : public ProgramPass {
+ public:
+  explicit SharedLocalInitializationPass(SharedRoutines *routines);
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+
+ private:
+  SharedRoutines *routines_;
+};
+
+// Replaces calls of OS functions with equivalent Hack code: `Math.multiply` and
+// `Math.divide` with shared routines, and `Memory.peek` and `Memory.poke` with
+// direct memory accesses. Division by zero still calls `Math.divide` to report
+// the error. Runs before the other program passes, so that OS functions no
+// longer called can be removed.
+class IntrinsicPass : public ProgramPass {
+ public:
+  // Whether calls of `function` can be replaced.
+  static bool IsIntrinsic(std::string_view function);
+
+  // Replaces the calls of the functions in `functions`, which must all be
+  // intrinsic.
+  IntrinsicPass(std::set<std::string> functions, SharedRoutines *routines);
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+
+ private:
+  std::set<std::string> functions_;
+  SharedRoutines *routines_;
+};
+
+// Substitutes the bodies of functions at their call sites instead of calling
+// them. Functions are inlined if their body lowers to at most `max_words`
+// instructions, or if they are called only once, and they are not part of a
+// cycle in the call graph, never change THIS or THAT and leave exactly their
+// result on the stack. The arguments and locals of an inlined function become
+// additional locals of the caller, and its labels are prefixed with the return
+// label of the call. Nothing is inlined into `Sys.init` or code outside
+// functions. Logs the decision for each called function.
+class InliningPass : public ProgramPass {
+ public:
+  explicit InliningPass(int max_words);
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+
+ private:
+  int max_words_;
+};
+
+// Removes the functions that cannot be reached through calls from the entry
+// point: `Sys.init` if the program defines it, or otherwise the code before
+// the first function or the first function. Calls in code outside any function
+// are entry points as well. Logs the ROM the removed functions would have
+// used before optimization.
+class DeadFunctionPass : public ProgramPass {
+ public:
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+};
+
+// Keeps the frames of functions that are never active more than once in RAM
+// at fixed addresses, which are accessed directly instead of through LCL and
+// ARG. Functions qualify if they are called, are not part of a cycle in the
+// call graph, are always called with the same number of arguments and leave
+// exactly their result on the stack. Frames of functions that cannot be
+// active at the same time overlap; functions whose frame would not fit next to
+// the static variables keep the standard frame.
+class StaticFramePass : public ProgramPass {
+ public:
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+};
+
+// Calls functions that never change THIS or THAT with `FrameLayout::kLight`,
+// which does not save and restore them. Functions that are never called, such
+// as `Sys.init` or those of test programs without a bootstrap, are entered
+// with the standard frame from outside and keep it.
+class CallingConventionPass : public ProgramPass {
+ public:
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+};
+
+// Replaces `call` immediately followed by `return` with a `TailCallCommand`
+// reusing the frame of the caller, so that chains of such calls run in constant
+// stack space. Only applies if the caller is always called with at least as
+// many arguments, and both functions use the same frame layout.
+class TailCallPass : public ProgramPass {
+ public:
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+};
+
+// Simplifies the control flow graph of each function: jumps to a label that
+// is directly followed by `goto` are threaded to the final target, `goto` to
+// the label right after it is removed, consecutive labels are merged into the
+// first one, labels no longer jumped to are removed so that the stack cache is
+// not flushed there, and blocks not reachable from the function entry are
+// deleted. Logs how many words of ROM the removed commands would have taken.
+class ControlFlowSimplificationPass : public ProgramPass {
+ public:
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+};
+
+// Moves expressions computed in a loop from values the loop never changes, such
+// as `push this 0`, `push constant 2`, `add`, before the loop, and loads them
+// from temp slots the program does not use otherwise. Only applies to natural
+// loops without calls, which might change statics, the heap or temp, and only
+// to expressions that lower to more instructions than the load. Runs after the
+// other program passes, so that loads from static frames count as cheap. Logs
+// the number of expressions moved.
+class LoopInvariantCodeMotionPass : public ProgramPass {
+ public:
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+};
+
+// Emits functions whose code is the same apart from the names of the labels
+// they define only once: the later ones are removed, and their names become
+// labels at the start of the first. Runs after the other program passes, which
+// may make functions identical. Logs the ROM the removed functions would have
+// used before optimization.
+class IdenticalCodeFoldingPass : public ProgramPass {
+ public:
+  std::string_view name() const override;
+  void Run(std::vector<CommandList> *parts) const override;
+};
+
+#endif  // NAND2TETRIS_VMTRANSLATOR_OPTIMIZER_H_
@@ -0,0 +1,816 @@
+#include "optimizer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "addressing.h"
+#include "commands.h"
+#include "hack.h"
+
+namespace {
+
+std::unique_ptr<Command> PushConstant(uint16_t value) {
+  return std::make_unique<PushCommand>(std::make_unique<ConstantAddress>(value));
+}
+
+template <class... Commands>
+CommandList MakeCommandList(Commands... commands) {
+  CommandList list;
+  (list.push_back(std::move(commands)), ...);
+  return list;
+}
+
+std::string ToAssembly(const CommandList &commands) {
+  HackProgram program;
+  for (const std::unique_ptr<Command> &command : commands) {
+    command->Lower(&program);
+  }
+  return program.ToAssembly();
+}
+
+}  // namespace
+
+TEST(OptimizationLevelTest, ParseOptimizationLevel) {
+  OptimizationLevel level;
+  EXPECT_TRUE(ParseOptimizationLevel("speed", &level));
+  EXPECT_EQ(level, OptimizationLevel::kSpeed);
+  EXPECT_TRUE(ParseOptimizationLevel("size", &level));
+  EXPECT_EQ(level, OptimizationLevel::kSize);
+  EXPECT_TRUE(ParseOptimizationLevel("none", &level));
+  EXPECT_EQ(level, OptimizationLevel::kNone);
+  EXPECT_FALSE(ParseOptimizationLevel("fast", &level));
+}
+
+TEST(PeepholePassTest, FoldsConstants) {
+  // push constant 7; push constant 8; sub; neg; push constant 3; and
+  CommandList commands = MakeCommandList(
+      PushConstant(7), PushConstant(8), std::make_unique<SubCommand>(),
+      std::make_unique<NegCommand>(), PushConstant(3),
+      std::make_unique<AndCommand>());
+  PeepholePass().Run(&commands);
+  ASSERT_EQ(commands.size(), 1);
+  EXPECT_EQ(ToAssembly(commands), PushConstant(1)->ToAssembly());
+}
+
+TEST(PeepholePassTest, FoldsToNegativeConstant) {
+  CommandList commands = MakeCommandList(PushConstant(3), PushConstant(5),
+                                         std::make_unique<SubCommand>());
+  PeepholePass().Run(&commands);
+  ASSERT_EQ(commands.size(), 1);
+  EXPECT_EQ(ToAssembly(commands), PushConstant(0xFFFE)->ToAssembly());
+}
+
+TEST(PeepholePassTest, AppliesConstantOperandInPlace) {
+  CommandList commands = MakeCommandList(
+      std::make_unique<PushCommand>(std::make_unique<LocalAddress>(0)),
+      PushConstant(5), std::make_unique<AddCommand>());
+  PeepholePass().Run(&commands);
+  ASSERT_EQ(commands.size(), 2);
+  EXPECT_EQ(commands[1]->ToAssembly(),
+            "@5\n"
+            "D=A\n"
+            "@SP\n"
+            "A=M-1\n"
+            "M=D+M\n");
+}
+
+TEST(PeepholePassTest, SimplifiesCheapConstantOperands) {
+  CommandList identity = MakeCommandList(
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      PushConstant(0), std::make_unique<SubCommand>(), PushConstant(0xFFFF),
+      std::make_unique<AndCommand>());
+  PeepholePass().Run(&identity);
+  EXPECT_EQ(identity.size(), 1);
+
+  CommandList increment = MakeCommandList(
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      PushConstant(1), std::make_unique<SubCommand>());
+  PeepholePass().Run(&increment);
+  ASSERT_EQ(increment.size(), 2);
+  EXPECT_EQ(increment[1]->ToAssembly(),
+            "@SP\n"
+            "A=M-1\n"
+            "M=M-1\n");
+}
+
+TEST(PeepholePassTest, FusesPushAndPop) {
+  CommandList commands = MakeCommandList(
+      std::make_unique<PushCommand>(std::make_unique<LocalAddress>(2)),
+      std::make_unique<PopCommand>(std::make_unique<TempAddress>(1)),
+      PushConstant(2), PushConstant(3), std::make_unique<AddCommand>(),
+      std::make_unique<PopCommand>(std::make_unique<StaticAddress>("Foo", 0)));
+  PeepholePass().Run(&commands);
+  ASSERT_EQ(commands.size(), 2);
+  EXPECT_EQ(ToAssembly(commands),
+            "@LCL\n"
+            "A=M+1\n"
+            "A=A+1\n"
+            "D=M\n"
+            "@6\n"
+            "M=D\n"
+            "@5\n"
+            "D=A\n"
+            "@Foo.0\n"
+            "M=D\n");
+}
+
+TEST(PeepholePassTest, SkipsComments) {
+  CommandList commands = MakeCommandList(
+      std::make_unique<CommentCommand>("push constant 1"), PushConstant(1),
+      std::make_unique<CommentCommand>("push constant 2"), PushConstant(2),
+      std::make_unique<CommentCommand>("add"), std::make_unique<AddCommand>());
+  PeepholePass().Run(&commands);
+  EXPECT_EQ(ToAssembly(commands),
+            "// push constant 1\n"
+            "// push constant 2\n"
+            "// add\n"
+            "@3\n"
+            "D=A\n"
+            "@SP\n"
+            "M=M+1\n"
+            "A=M-1\n"
+            "M=D\n");
+}
+
+TEST(PeepholePassTest, KeepsCommandsAcrossLabels) {
+  CommandList commands = MakeCommandList(
+      PushConstant(1), std::make_unique<LabelCommand>("Foo$L"),
+      PushConstant(2), std::make_unique<AddCommand>());
+  PeepholePass().Run(&commands);
+  EXPECT_EQ(commands.size(), 3);
+}
+
+TEST(BranchFusionPassTest, FusesComparisonAndIfGoto) {
+  CommandList commands = MakeCommandList(
+      std::make_unique<LtCommand>("Foo_1"),
+      std::make_unique<IfGotoCommand>("Foo.f$LOOP"),
+      std::make_unique<EqCommand>("Foo_3"), std::make_unique<NotCommand>(),
+      std::make_unique<IfGotoCommand>("Foo.f$END"));
+  BranchFusionPass().Run(&commands);
+  ASSERT_EQ(commands.size(), 2);
+  EXPECT_EQ(commands[0]->ToAssembly(),
+            CompareJumpCommand(Jump::kJlt, "Foo.f$LOOP").ToAssembly());
+  EXPECT_EQ(commands[1]->ToAssembly(),
+            CompareJumpCommand(Jump::kJne, "Foo.f$END").ToAssembly());
+}
+
+TEST(BranchFusionPassTest, FusesPushAndIfGoto) {
+  CommandList commands = MakeCommandList(
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<IfGotoCommand>("Foo.f$LOOP"), PushConstant(0),
+      std::make_unique<IfGotoCommand>("Foo.f$NEVER"), PushConstant(1),
+      std::make_unique<IfGotoCommand>("Foo.f$ALWAYS"));
+  BranchFusionPass().Run(&commands);
+  ASSERT_EQ(commands.size(), 2);
+  EXPECT_EQ(commands[0]->ToAssembly(),
+            "@ARG\n"
+            "A=M\n"
+            "D=M\n"
+            "@Foo.f$LOOP\n"
+            "D;JNE\n");
+  EXPECT_EQ(commands[1]->ToAssembly(),
+            GotoCommand("Foo.f$ALWAYS").ToAssembly());
+}
+
+TEST(SharedComparisonPassTest, CallsSharedRoutinesWhenShorter) {
+  SharedRoutines routines;
+  std::vector<CommandList> parts(2);
+  for (int i = 0; i < 40; ++i) {
+    parts[i % 2].push_back(
+        std::make_unique<EqCommand>("Foo_" + std::to_string(i)));
+  }
+  parts[0].push_back(std::make_unique<LtCommand>("Foo_lt"));
+  SharedComparisonPass(&routines).Run(&parts);
+
+  // The sites of `eq` in both parts together save more than its routine takes,
+  // but the single `lt` does not.
+  EXPECT_EQ(parts[1][0]->ToAssembly(),
+            SharedBinaryCommand(SharedRoutines::kEq, "Foo_1$eq_end",
+                                &routines)
+                .ToAssembly());
+  EXPECT_EQ(parts[0].back()->ToAssembly(),
+            LtCommand("Foo_lt").ToAssembly());
+}
+
+TEST(SharedComparisonPassTest, KeepsFewComparisonsInline) {
+  SharedRoutines routines;
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(std::make_unique<EqCommand>("Foo_1"),
+                                  std::make_unique<EqCommand>("Foo_2")));
+  SharedComparisonPass(&routines).Run(&parts);
+  EXPECT_EQ(ToAssembly(parts[0]),
+            ToAssembly(MakeCommandList(std::make_unique<EqCommand>("Foo_1"),
+                                       std::make_unique<EqCommand>("Foo_2"))));
+}
+
+TEST(SharedCallPassTest, CallsSharedRoutinesWhenShorter) {
+  SharedRoutines routines;
+  std::vector<CommandList> parts(2);
+  for (int i = 0; i < 4; ++i) {
+    parts[i % 2].push_back(std::make_unique<CallCommand>(
+        "Foo.bar", 1, "Foo.f$ret." + std::to_string(i)));
+    parts[i % 2].push_back(std::make_unique<ReturnCommand>());
+  }
+  parts[1].push_back(std::make_unique<CallCommand>(
+      "Foo.bar", 1, "Foo.f$ret.light", FrameLayout::kLight));
+  SharedCallPass(&routines).Run(&parts);
+
+  // The single call with the light frame would not pay for its routine.
+  EXPECT_EQ(parts[1][0]->ToAssembly(),
+            SharedCallCommand("Foo.bar", 1, "Foo.f$ret.1",
+                              FrameLayout::kStandard, &routines)
+                .ToAssembly());
+  EXPECT_EQ(parts[1][1]->ToAssembly(),
+            SharedReturnCommand(FrameLayout::kStandard, &routines)
+                .ToAssembly());
+  EXPECT_EQ(parts[1].back()->ToAssembly(),
+            CallCommand("Foo.bar", 1, "Foo.f$ret.light", FrameLayout::kLight)
+                .ToAssembly());
+}
+
+TEST(LocalInitializationPassTest, ChoosesByLocalCount) {
+  CommandList commands =
+      MakeCommandList(std::make_unique<FunctionCommand>("Foo.a", 1),
+                      std::make_unique<FunctionCommand>("Foo.b", 4),
+                      std::make_unique<FunctionCommand>("Foo.c", 5));
+  LocalInitializationPass(/*unroll_locals=*/4).Run(&commands);
+  std::vector<LocalInitialization> initializations;
+  for (const std::unique_ptr<Command> &command : commands) {
+    initializations.push_back(
+        dynamic_cast<FunctionCommand &>(*command).initialization());
+  }
+  EXPECT_EQ(initializations,
+            (std::vector<LocalInitialization>{LocalInitialization::kUnrolled,
+                                              LocalInitialization::kUnrolled,
+                                              LocalInitialization::kLooped}));
+}
+
+TEST(SharedLocalInitializationPassTest, SharesRoutineWhenShorter) {
+  SharedRoutines routines;
+  std::vector<CommandList> parts(2);
+  for (int i = 0; i < 10; ++i) {
+    parts[i % 2].push_back(
+        std::make_unique<FunctionCommand>("Foo.f" + std::to_string(i), 3));
+  }
+  parts[0].push_back(std::make_unique<FunctionCommand>("Foo.large", 12));
+  SharedLocalInitializationPass(&routines).Run(&parts);
+
+  // Serving the function with 12 locals would make the routine grow by more
+  // than it saves.
+  for (const CommandList &part : parts) {
+    for (const std::unique_ptr<Command> &command : part) {
+      auto &definition = dynamic_cast<FunctionCommand &>(*command);
+      EXPECT_EQ(definition.initialization(),
+                definition.variable_count() == 3
+                    ? LocalInitialization::kShared
+                    : LocalInitialization::kUnrolled)
+          << definition.identifier();
+    }
+  }
+}
+
+TEST(SharedLocalInitializationPassTest, KeepsSingleFunctionUnrolled) {
+  SharedRoutines routines;
+  std::vector<CommandList> parts;
+  parts.push_back(
+      MakeCommandList(std::make_unique<FunctionCommand>("Foo.f", 2)));
+  SharedLocalInitializationPass(&routines).Run(&parts);
+  EXPECT_EQ(dynamic_cast<FunctionCommand &>(*parts[0][0]).initialization(),
+            LocalInitialization::kUnrolled);
+}
+
+TEST(CallingConventionPassTest, UsesLightFrameForFunctionsKeepingPointers) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Sys.init", 0),
+      std::make_unique<CallCommand>("Main.leaf", 0, "Sys.init$ret.1"),
+      std::make_unique<CallCommand>("Main.setter", 0, "Sys.init$ret.2"),
+      std::make_unique<ReturnCommand>()));
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Main.leaf", 0),
+      std::make_unique<PushCommand>(std::make_unique<ThisAddress>(0)),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Main.setter", 0),
+      PushConstant(3000),
+      std::make_unique<PopCommand>(std::make_unique<PointerAddress>(0)),
+      std::make_unique<ReturnCommand>()));
+  CallingConventionPass().Run(&parts);
+
+  auto frame_of = [](const std::unique_ptr<Command> &command) {
+    if (auto *call = dynamic_cast<CallCommand *>(command.get())) {
+      return call->frame();
+    }
+    return dynamic_cast<ReturnCommand &>(*command).frame();
+  };
+  EXPECT_EQ(frame_of(parts[0][1]), FrameLayout::kLight);
+  EXPECT_EQ(frame_of(parts[0][2]), FrameLayout::kStandard);
+  EXPECT_EQ(frame_of(parts[0][3]), FrameLayout::kStandard);
+  EXPECT_EQ(frame_of(parts[1][2]), FrameLayout::kLight);
+  EXPECT_EQ(frame_of(parts[1][6]), FrameLayout::kStandard);
+}
+
+TEST(CallingConventionPassTest, ChargesPointerChangesToStaticFunctions) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Sys.init", 0),
+      std::make_unique<CallCommand>("Main.leaf", 0, "Sys.init$ret.1"),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Main.leaf", 0), PushConstant(1),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<StaticFunctionCommand>(
+          "Main.setter", StaticFrame{"$FRAME.0", {"$FRAME.1"}, {}, {}}),
+      PushConstant(3000),
+      std::make_unique<PopCommand>(std::make_unique<PointerAddress>(0)),
+      std::make_unique<StaticReturnCommand>(
+          StaticFrame{"$FRAME.0", {"$FRAME.1"}, {}, {}})));
+  CallingConventionPass().Run(&parts);
+
+  // The `pop pointer` belongs to Main.setter, not to Main.leaf before it.
+  EXPECT_EQ(dynamic_cast<CallCommand &>(*parts[0][1]).frame(),
+            FrameLayout::kLight);
+  EXPECT_EQ(dynamic_cast<ReturnCommand &>(*parts[0][5]).frame(),
+            FrameLayout::kLight);
+}
+
+TEST(StaticFramePassTest, OverlapsFramesOfNonRecursiveFunctions) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Sys.init", 0),
+      std::make_unique<CallCommand>("Main.outer", 0, "Sys.init$ret.1"),
+      std::make_unique<CallCommand>("Main.fact", 0, "Sys.init$ret.2"),
+      std::make_unique<ReturnCommand>()));
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Main.outer", 1),
+      PushConstant(2),
+      std::make_unique<CallCommand>("Main.inner", 1, "Main.outer$ret.1"),
+      std::make_unique<PopCommand>(std::make_unique<LocalAddress>(0)),
+      std::make_unique<PushCommand>(std::make_unique<LocalAddress>(0)),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Main.inner", 0),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Main.fact", 0),
+      std::make_unique<CallCommand>("Main.fact", 0, "Main.fact$ret.1"),
+      std::make_unique<ReturnCommand>()));
+  StaticFramePass().Run(&parts);
+
+  // Main.outer uses $FRAME.0 and $FRAME.1 for its return address and local,
+  // and Main.inner the two words after them.
+  EXPECT_EQ(ToAssembly(parts[1]),
+            StaticFunctionCommand("Main.outer",
+                                  {"$FRAME.0", {}, {}, {"$FRAME.1"}})
+                    .ToAssembly() +
+                PushConstant(2)->ToAssembly() +
+                StaticCallCommand("Main.inner", "Main.outer$ret.1",
+                                  {"$FRAME.2", {}, {"$FRAME.3"}, {}})
+                    .ToAssembly() +
+                "@SP\n"
+                "AM=M-1\n"
+                "D=M\n"
+                "@$FRAME.1\n"
+                "M=D\n"
+                "@$FRAME.1\n"
+                "D=M\n"
+                "@SP\n"
+                "M=M+1\n"
+                "A=M-1\n"
+                "M=D\n"
+                "@$FRAME.0\n"
+                "A=M\n"
+                "0;JMP\n"
+                "(Main.inner)\n"
+                "@$FRAME.3\n"
+                "D=M\n"
+                "@SP\n"
+                "M=M+1\n"
+                "A=M-1\n"
+                "M=D\n"
+                "@$FRAME.2\n"
+                "A=M\n"
+                "0;JMP\n" +
+                // The recursive Main.fact keeps the standard frame.
+                FunctionCommand("Main.fact", 0).ToAssembly() +
+                CallCommand("Main.fact", 0, "Main.fact$ret.1").ToAssembly() +
+                ReturnCommand().ToAssembly());
+  EXPECT_NE(dynamic_cast<FunctionCommand *>(parts[0][0].get()), nullptr);
+}
+
+TEST(StaticFramePassTest, PlacesCalleesOfCyclesAfterCallersOfAnyMember) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Sys.init", 0), PushConstant(1),
+      std::make_unique<CallCommand>("T.f", 1, "Sys.init$ret.1"),
+      std::make_unique<ReturnCommand>()));
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("T.f", 1),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<CallCommand>("R.two", 1, "T.f$ret.1"),
+      std::make_unique<ReturnCommand>()));
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("R.one", 0),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<CallCommand>("R.two", 1, "R.one$ret.1"),
+      std::make_unique<PopCommand>(std::make_unique<TempAddress>(0)),
+      std::make_unique<CallCommand>("S.s", 0, "R.one$ret.2"),
+      std::make_unique<PopCommand>(std::make_unique<TempAddress>(0)),
+      std::make_unique<CallCommand>("S.s", 0, "R.one$ret.3"),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("R.two", 0),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<CallCommand>("R.one", 1, "R.two$ret.1"),
+      std::make_unique<ReturnCommand>()));
+  parts.push_back(MakeCommandList(std::make_unique<FunctionCommand>("S.s", 0),
+                                  PushConstant(1),
+                                  std::make_unique<ReturnCommand>()));
+  StaticFramePass().Run(&parts);
+
+  // T.f is active while R.one calls S.s, so the frame of S.s starts after the
+  // return address, argument and local of T.f, whichever of R.one and R.two
+  // is allocated first.
+  StaticFrame frame = {"$FRAME.3", {}, {}, {}};
+  EXPECT_EQ(ToAssembly(parts[3]),
+            StaticFunctionCommand("S.s", frame).ToAssembly() +
+                PushConstant(1)->ToAssembly() +
+                StaticReturnCommand(frame).ToAssembly());
+}
+
+TEST(StaticFramePassTest, KeepsStandardFrameForUnbalancedStack) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Sys.init", 0),
+      std::make_unique<CallCommand>("Main.f", 0, "Sys.init$ret.1"),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Main.f", 0), PushConstant(1),
+      PushConstant(2), std::make_unique<ReturnCommand>()));
+  StaticFramePass().Run(&parts);
+  EXPECT_NE(dynamic_cast<CallCommand *>(parts[0][1].get()), nullptr);
+  EXPECT_NE(dynamic_cast<FunctionCommand *>(parts[0][3].get()), nullptr);
+}
+
+TEST(DeadFunctionPassTest, RemovesFunctionsUnreachableFromSysInit) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Main.main", 0),
+      std::make_unique<CallCommand>("Math.abs", 1, "Main.main$ret.1"),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<CommentCommand>("function Main.unused 0"),
+      std::make_unique<FunctionCommand>("Main.unused", 0),
+      std::make_unique<CallCommand>("Math.max", 2, "Main.unused$ret.1"),
+      std::make_unique<ReturnCommand>()));
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Math.abs", 0),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Math.max", 0),
+      std::make_unique<ReturnCommand>()));
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Sys.init", 0),
+      std::make_unique<CallCommand>("Main.main", 0, "Sys.init$ret.1"),
+      std::make_unique<ReturnCommand>()));
+  DeadFunctionPass().Run(&parts);
+  EXPECT_EQ(parts[0].size(), 3);
+  EXPECT_EQ(parts[1].size(), 2);
+  EXPECT_EQ(parts[2].size(), 3);
+}
+
+TEST(DeadFunctionPassTest, DropsRoutinesOfRemovedFunctions) {
+  SharedRoutines routines;
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Sys.init", 0), PushConstant(0),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Sys.dead", 0), PushConstant(6),
+      PushConstant(7),
+      std::make_unique<SharedBinaryCommand>(SharedRoutines::kMultiply,
+                                            "Sys.dead$ret.1", &routines),
+      std::make_unique<ReturnCommand>()));
+  DeadFunctionPass().Run(&parts);
+  EXPECT_EQ(parts[0].size(), 3);
+  HackProgram program;
+  routines.Lower(&program);
+  EXPECT_EQ(program.InstructionCount(), 0);
+}
+
+TEST(DeadFunctionPassTest, KeepsFirstFunctionWithoutSysInit) {
+  std::vector<CommandList> functions;
+  functions.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Foo.entry", 0),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Foo.unused", 0),
+      std::make_unique<ReturnCommand>()));
+  DeadFunctionPass().Run(&functions);
+  EXPECT_EQ(functions[0].size(), 2);
+
+  std::vector<CommandList> top_level_code;
+  top_level_code.push_back(MakeCommandList(
+      PushConstant(1),
+      std::make_unique<CallCommand>("Foo.called", 1, "Foo$ret.1"),
+      std::make_unique<FunctionCommand>("Foo.unused", 0),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Foo.called", 0),
+      std::make_unique<ReturnCommand>()));
+  DeadFunctionPass().Run(&top_level_code);
+  EXPECT_EQ(top_level_code[0].size(), 4);
+}
+
+TEST(InliningPassTest, InlinesSmallFunctions) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Main.main", 1), PushConstant(5),
+      std::make_unique<CallCommand>("Main.abs", 1, "Main.main$ret.1"),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Main.abs", 0),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<IfGotoCommand>("Main.abs$NEG"),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<LabelCommand>("Main.abs$NEG"),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<NegCommand>(), std::make_unique<ReturnCommand>()));
+  InliningPass(100).Run(&parts);
+
+  CommandList expected = MakeCommandList(
+      std::make_unique<FunctionCommand>("Main.main", 2), PushConstant(5),
+      std::make_unique<PopCommand>(std::make_unique<LocalAddress>(1)),
+      std::make_unique<PushCommand>(std::make_unique<LocalAddress>(1)),
+      std::make_unique<IfGotoCommand>("Main.main$ret.1$Main.abs$NEG"),
+      std::make_unique<PushCommand>(std::make_unique<LocalAddress>(1)),
+      std::make_unique<GotoCommand>("Main.main$ret.1"),
+      std::make_unique<LabelCommand>("Main.main$ret.1$Main.abs$NEG"),
+      std::make_unique<PushCommand>(std::make_unique<LocalAddress>(1)),
+      std::make_unique<NegCommand>(),
+      std::make_unique<LabelCommand>("Main.main$ret.1"),
+      std::make_unique<ReturnCommand>());
+  EXPECT_EQ(ToAssembly(CommandList(
+                std::make_move_iterator(parts[0].begin()),
+                std::make_move_iterator(parts[0].begin() + expected.size()))),
+            ToAssembly(expected));
+}
+
+TEST(InliningPassTest, KeepsLargeFunctionsCalledMoreThanOnce) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Main.main", 0),
+      std::make_unique<CallCommand>("Main.f", 0, "Main.main$ret.1"),
+      std::make_unique<CallCommand>("Main.f", 0, "Main.main$ret.2"),
+      std::make_unique<AddCommand>(), std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Main.f", 0), PushConstant(1),
+      std::make_unique<ReturnCommand>()));
+  InliningPass(0).Run(&parts);
+  EXPECT_EQ(parts[0].size(), 8);
+
+  // Each call is replaced with the `push constant 1` of the body.
+  InliningPass(100).Run(&parts);
+  ASSERT_EQ(parts[0].size(), 8);
+  EXPECT_EQ(parts[0][1]->ToAssembly(), PushConstant(1)->ToAssembly());
+  EXPECT_EQ(parts[0][2]->ToAssembly(), PushConstant(1)->ToAssembly());
+}
+
+TEST(TailCallPassTest, ReusesFrameOfCaller) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Sys.init", 0), PushConstant(1),
+      std::make_unique<CallCommand>("Main.loop", 1, "Sys.init$ret.1"),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Main.loop", 0),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<CallCommand>("Main.pair", 2, "Main.loop$ret.1"),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<FunctionCommand>("Main.pair", 0),
+      std::make_unique<CommentCommand>("tail call"),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(1)),
+      std::make_unique<CallCommand>("Main.loop", 1, "Main.pair$ret.1"),
+      std::make_unique<CommentCommand>("return"),
+      std::make_unique<ReturnCommand>()));
+  TailCallPass().Run(&parts);
+
+  // Sys.init has no arguments to pass Main.loop's in, and Main.loop only
+  // one for the two of Main.pair.
+  ASSERT_EQ(parts[0].size(), 14);
+  EXPECT_NE(dynamic_cast<CallCommand *>(parts[0][2].get()), nullptr);
+  EXPECT_NE(dynamic_cast<CallCommand *>(parts[0][7].get()), nullptr);
+  EXPECT_EQ(parts[0][12]->ToAssembly(),
+            TailCallCommand("Main.loop", 1).ToAssembly());
+  EXPECT_NE(dynamic_cast<CommentCommand *>(parts[0][13].get()), nullptr);
+}
+
+TEST(ControlFlowSimplificationPassTest, ThreadsJumpsAndRemovesDeadCode) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Foo.f", 0),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<IfGotoCommand>("Foo.f$A"),
+      std::make_unique<GotoCommand>("Foo.f$B"), PushConstant(7),
+      std::make_unique<LabelCommand>("Foo.f$A"),
+      std::make_unique<LabelCommand>("Foo.f$A2"),
+      std::make_unique<GotoCommand>("Foo.f$C"),
+      std::make_unique<LabelCommand>("Foo.f$B"), PushConstant(1),
+      std::make_unique<GotoCommand>("Foo.f$C"),
+      std::make_unique<LabelCommand>("Foo.f$C"), PushConstant(2),
+      std::make_unique<ReturnCommand>(),
+      std::make_unique<LabelCommand>("Foo.f$DEAD"), PushConstant(3),
+      std::make_unique<ReturnCommand>()));
+  ControlFlowSimplificationPass().Run(&parts);
+
+  // `if-goto A` jumps on to C, which leaves the code at A unreachable, and
+  // both `goto B` and `goto C` jump to the next command.
+  EXPECT_EQ(ToAssembly(parts[0]),
+            ToAssembly(MakeCommandList(
+                std::make_unique<FunctionCommand>("Foo.f", 0),
+                std::make_unique<PushCommand>(
+                    std::make_unique<ArgumentAddress>(0)),
+                std::make_unique<IfGotoCommand>("Foo.f$C"), PushConstant(1),
+                std::make_unique<LabelCommand>("Foo.f$C"), PushConstant(2),
+                std::make_unique<ReturnCommand>())));
+}
+
+TEST(ControlFlowSimplificationPassTest, DropsRoutinesOfUnreachableCode) {
+  SharedRoutines routines;
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Foo.f", 0),
+      std::make_unique<GotoCommand>("Foo.f$L"), PushConstant(6),
+      PushConstant(7),
+      std::make_unique<SharedBinaryCommand>(SharedRoutines::kMultiply,
+                                            "Foo.f$ret.1", &routines),
+      std::make_unique<LabelCommand>("Foo.f$L"), PushConstant(0),
+      std::make_unique<ReturnCommand>()));
+  ControlFlowSimplificationPass().Run(&parts);
+  EXPECT_EQ(parts[0].size(), 3);
+  HackProgram program;
+  routines.Lower(&program);
+  EXPECT_EQ(program.InstructionCount(), 0);
+}
+
+TEST(ControlFlowSimplificationPassTest, MergesConsecutiveLabels) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Foo.g", 0),
+      std::make_unique<LabelCommand>("Foo.g$X"),
+      std::make_unique<CommentCommand>("loop"),
+      std::make_unique<LabelCommand>("Foo.g$Y"),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<IfGotoCommand>("Foo.g$Y"),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(1)),
+      std::make_unique<IfGotoCommand>("Foo.g$X"), PushConstant(0),
+      std::make_unique<ReturnCommand>()));
+  // An endless loop is kept.
+  parts.push_back(MakeCommandList(std::make_unique<LabelCommand>("Foo$HALT"),
+                                  std::make_unique<GotoCommand>("Foo$HALT")));
+  ControlFlowSimplificationPass().Run(&parts);
+
+  ASSERT_EQ(parts[0].size(), 9);
+  EXPECT_EQ(ToAssembly(parts[0]),
+            ToAssembly(MakeCommandList(
+                std::make_unique<FunctionCommand>("Foo.g", 0),
+                std::make_unique<LabelCommand>("Foo.g$X"),
+                std::make_unique<CommentCommand>("loop"),
+                std::make_unique<PushCommand>(
+                    std::make_unique<ArgumentAddress>(0)),
+                std::make_unique<IfGotoCommand>("Foo.g$X"),
+                std::make_unique<PushCommand>(
+                    std::make_unique<ArgumentAddress>(1)),
+                std::make_unique<IfGotoCommand>("Foo.g$X"), PushConstant(0),
+                std::make_unique<ReturnCommand>())));
+  EXPECT_EQ(parts[1].size(), 2);
+}
+
+TEST(ControlFlowSimplificationPassTest, KeepsTargetsOfMergedLabelsDefined) {
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Foo.f", 0),
+      std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+      std::make_unique<IfGotoCommand>("Foo.f$C"),
+      std::make_unique<GotoCommand>("Foo.f$C"), PushConstant(7),
+      std::make_unique<LabelCommand>("Foo.f$B"),
+      std::make_unique<LabelCommand>("Foo.f$C"), PushConstant(2),
+      std::make_unique<ReturnCommand>()));
+  ControlFlowSimplificationPass().Run(&parts);
+
+  // B is only reached from the dead code, so the jumps keep targeting C.
+  EXPECT_EQ(ToAssembly(parts[0]),
+            ToAssembly(MakeCommandList(
+                std::make_unique<FunctionCommand>("Foo.f", 0),
+                std::make_unique<PushCommand>(
+                    std::make_unique<ArgumentAddress>(0)),
+                std::make_unique<IfGotoCommand>("Foo.f$C"),
+                std::make_unique<LabelCommand>("Foo.f$C"), PushConstant(2),
+                std::make_unique<ReturnCommand>())));
+}
+
+TEST(LoopInvariantCodeMotionPassTest, MovesExpressionsBeforeLoop) {
+  auto push_this = [] {
+    return std::make_unique<PushCommand>(std::make_unique<ThisAddress>(0));
+  };
+  auto push_local = [] {
+    return std::make_unique<PushCommand>(std::make_unique<LocalAddress>(0));
+  };
+  auto temp = [](uint16_t index) {
+    return std::make_unique<TempAddress>(index);
+  };
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Foo.f", 1),
+      std::make_unique<LabelCommand>("Foo.f$LOOP"), push_local(), push_this(),
+      PushConstant(2), std::make_unique<AddCommand>(),
+      std::make_unique<AddCommand>(),
+      std::make_unique<PopCommand>(std::make_unique<LocalAddress>(0)),
+      push_this(), PushConstant(2), std::make_unique<AddCommand>(),
+      std::make_unique<IfGotoCommand>("Foo.f$LOOP"), push_local(),
+      std::make_unique<ReturnCommand>()));
+  // The call might change THIS 0.
+  parts.push_back(MakeCommandList(
+      std::make_unique<FunctionCommand>("Foo.g", 0),
+      std::make_unique<LabelCommand>("Foo.g$LOOP"), push_this(),
+      PushConstant(2), std::make_unique<AddCommand>(),
+      std::make_unique<CallCommand>("Foo.f", 1, "Foo.g$ret.1"),
+      std::make_unique<IfGotoCommand>("Foo.g$LOOP"), PushConstant(0),
+      std::make_unique<ReturnCommand>()));
+  // Temp 0 is used by the program.
+  parts.push_back(MakeCommandList(std::make_unique<PushCommand>(temp(0))));
+  LoopInvariantCodeMotionPass().Run(&parts);
+
+  // Both occurrences of the expression load it from temp 1.
+  EXPECT_EQ(ToAssembly(parts[0]),
+            ToAssembly(MakeCommandList(
+                std::make_unique<FunctionCommand>("Foo.f", 1), push_this(),
+                PushConstant(2), std::make_unique<AddCommand>(),
+                std::make_unique<PopCommand>(temp(1)),
+                std::make_unique<LabelCommand>("Foo.f$LOOP"), push_local(),
+                std::make_unique<PushCommand>(temp(1)),
+                std::make_unique<AddCommand>(),
+                std::make_unique<PopCommand>(
+                    std::make_unique<LocalAddress>(0)),
+                std::make_unique<PushCommand>(temp(1)),
+                std::make_unique<IfGotoCommand>("Foo.f$LOOP"), push_local(),
+                std::make_unique<ReturnCommand>())));
+  EXPECT_EQ(parts[1].size(), 9);
+}
+
+TEST(IdenticalCodeFoldingPassTest, FoldsFunctionsDifferingInLabels) {
+  auto loop = [](std::string_view function) {
+    std::string label = std::string(function) + "$LOOP";
+    return MakeCommandList(
+        std::make_unique<FunctionCommand>(function, 0),
+        std::make_unique<LabelCommand>(label),
+        std::make_unique<PushCommand>(std::make_unique<ArgumentAddress>(0)),
+        std::make_unique<IfGotoCommand>(label), PushConstant(1),
+        std::make_unique<ReturnCommand>());
+  };
+  std::vector<CommandList> parts;
+  parts.push_back(loop("Foo.f"));
+  parts.push_back(loop("Bar.f"));
+  parts[1].push_back(std::make_unique<FunctionCommand>("Bar.g", 0));
+  parts[1].push_back(PushConstant(2));
+  parts[1].push_back(std::make_unique<ReturnCommand>());
+  IdenticalCodeFoldingPass().Run(&parts);
+
+  // Calls of Bar.f jump to the code of Foo.f.
+  ASSERT_EQ(parts[0].size(), 7);
+  EXPECT_EQ(parts[0][0]->ToAssembly(), "(Bar.f)\n");
+  EXPECT_EQ(parts[0][1]->ToAssembly(),
+            FunctionCommand("Foo.f", 0).ToAssembly());
+  ASSERT_EQ(parts[1].size(), 3);
+  EXPECT_EQ(parts[1][0]->ToAssembly(),
+            FunctionCommand("Bar.g", 0).ToAssembly());
+}
+
+TEST(IntrinsicPassTest, ReplacesEnabledCalls) {
+  SharedRoutines routines;
+  std::vector<CommandList> parts;
+  parts.push_back(MakeCommandList(
+      std::make_unique<CallCommand>("Math.multiply", 2, "Foo$ret.1"),
+      std::make_unique<CallCommand>("Memory.peek", 1, "Foo$ret.2"),
+      std::make_unique<CallCommand>("Memory.poke", 2, "Foo$ret.3"),
+      std::make_unique<CallCommand>("Math.divide", 2, "Foo$ret.4"),
+      std::make_unique<CallCommand>("Memory.peek", 2, "Foo$ret.5")));
+  IntrinsicPass({"Math.multiply", "Math.divide", "Memory.peek"}, &routines)
+      .Run(&parts);
+
+  ASSERT_EQ(parts[0].size(), 10);
+  EXPECT_EQ(parts[0][0]->ToAssembly(),
+            SharedBinaryCommand(SharedRoutines::kMultiply, "Foo$ret.1",
+                                &routines)
+                .ToAssembly());
+  EXPECT_NE(dynamic_cast<PeekCommand *>(parts[0][1].get()), nullptr);
+  // Memory.poke is not enabled.
+  EXPECT_NE(dynamic_cast<CallCommand *>(parts[0][2].get()), nullptr);
+  EXPECT_EQ(ToAssembly(CommandList(
+                std::make_move_iterator(parts[0].begin() + 3),
+                std::make_move_iterator(parts[0].begin() + 9))),
+            SharedBinaryCommand(SharedRoutines::kDivide, "Foo$ret.4",
+                                &routines, "Foo$ret.4$zero")
+                    .ToAssembly() +
+                GotoCommand("Foo$ret.4$end").ToAssembly() +
+                "(Foo$ret.4$zero)\n" + PushConstant(0)->ToAssembly() +
+                CallCommand("Math.divide", 2, "Foo$ret.4$call").ToAssembly() +
+                "(Foo$ret.4$end)\n");
+  // Memory.peek takes one argument.
+  EXPECT_NE(dynamic_cast<CallCommand *>(parts[0][9].get()), nullptr);
+}
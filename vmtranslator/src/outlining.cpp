@@ -0,0 +1,315 @@
+#include "outlining.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
+
+#include "hack.h"
+
+std::vector<int> SuffixArray(const std::vector<int> &tokens) {
+  int n = tokens.size();
+  std::vector<int> suffixes(n);
+  std::iota(suffixes.begin(), suffixes.end(), 0);
+  // Suffixes are sorted by their first `length` tokens, then by twice as many
+  // using the ranks of the halves, until all ranks differ.
+  std::vector<int> ranks = tokens;
+  std::vector<int> next_ranks(n);
+  for (int length = 1; n > 0; length *= 2) {
+    auto key = [&](int suffix) {
+      return std::make_pair(
+          ranks[suffix], suffix + length < n ? ranks[suffix + length] : -1);
+    };
+    std::sort(suffixes.begin(), suffixes.end(),
+              [&](int a, int b) { return key(a) < key(b); });
+    next_ranks[suffixes[0]] = 0;
+    for (int i = 1; i < n; ++i) {
+      next_ranks[suffixes[i]] = next_ranks[suffixes[i - 1]] +
+                                (key(suffixes[i - 1]) < key(suffixes[i]));
+    }
+    ranks.swap(next_ranks);
+    if (ranks[suffixes[n - 1]] == n - 1) {
+      break;
+    }
+  }
+  return suffixes;
+}
+
+std::vector<int> LongestCommonPrefixes(const std::vector<int> &tokens,
+                                       const std::vector<int> &suffix_array) {
+  int n = tokens.size();
+  std::vector<int> ranks(n);
+  for (int i = 0; i < n; ++i) {
+    ranks[suffix_array[i]] = i;
+  }
+  // The common prefix of a suffix and its predecessor is at most one token
+  // shorter than that of the suffix starting one token earlier.
+  std::vector<int> prefixes(n);
+  int length = 0;
+  for (int suffix = 0; suffix < n; ++suffix) {
+    if (ranks[suffix] == 0) {
+      length = 0;
+      continue;
+    }
+    int previous = suffix_array[ranks[suffix] - 1];
+    while (suffix + length < n && previous + length < n &&
+           tokens[suffix + length] == tokens[previous + length]) {
+      ++length;
+    }
+    prefixes[ranks[suffix]] = length;
+    length = std::max(length - 1, 0);
+  }
+  return prefixes;
+}
+
+namespace {
+
+// `@return`, `D=A`, `@routine`, `0;JMP`.
+constexpr int kCallCost = 4;
+// `@slot`, `M=D` before the sequence, `@slot`, `A=M`, `0;JMP` after it.
+constexpr int kRoutineCost = 5;
+// Longer sequences are rare, and are outlined by their prefixes.
+constexpr int kMaxLength = 64;
+
+bool IsAddress(const Instruction &instruction) {
+  return instruction.kind == Instruction::kAddress ||
+         instruction.kind == Instruction::kSymbol;
+}
+
+bool ReadsD(const Instruction &instruction) {
+  return instruction.kind == Instruction::kCompute &&
+         ComputationString(instruction.computation).find('D') !=
+             std::string_view::npos;
+}
+
+bool WritesD(const Instruction &instruction) {
+  return instruction.kind == Instruction::kCompute &&
+         (instruction.destination & Destination::kD);
+}
+
+// Returns the address of a temp word the program never reads or writes, or 0
+// if there is none.
+uint16_t FreeTempWord(const HackProgram &program) {
+  const std::vector<Instruction> &instructions = program.instructions();
+  std::vector<std::string> symbols;
+  for (int word = 5; word < 13; ++word) {
+    symbols.push_back(absl::StrCat("R", word));
+  }
+  std::vector<bool> used(8);
+  for (size_t i = 0; i < instructions.size(); ++i) {
+    const Instruction &instruction = instructions[i];
+    if (instruction.kind == Instruction::kSymbol) {
+      auto found = std::find(symbols.begin(), symbols.end(),
+                             program.symbol(instruction.operand));
+      if (found != symbols.end()) {
+        used[found - symbols.begin()] = true;
+      }
+    }
+    if (instruction.kind != Instruction::kAddress || instruction.operand < 5 ||
+        instruction.operand >= 13 || i + 1 == instructions.size()) {
+      continue;
+    }
+    // Other uses of the address are constants.
+    const Instruction &next = instructions[i + 1];
+    if (next.kind == Instruction::kCompute &&
+        (ReadsMemory(next.computation) ||
+         (next.destination & Destination::kM))) {
+      used[instruction.operand - 5] = true;
+    }
+  }
+  for (int word = 5; word < 13; ++word) {
+    if (!used[word - 5]) {
+      return word;
+    }
+  }
+  return 0;
+}
+
+// Returns the instructions as tokens, with equal instructions mapped to equal
+// tokens. Labels, jumps and comments are mapped to unique tokens, so that no
+// repeated sequence contains them.
+std::vector<int> Tokenize(const std::vector<Instruction> &instructions) {
+  std::map<std::tuple<int, int, int, uint32_t>, int> ids;
+  std::vector<int> tokens;
+  tokens.reserve(instructions.size());
+  int separators = 0;
+  for (const Instruction &instruction : instructions) {
+    if (instruction.kind == Instruction::kLabel ||
+        instruction.kind == Instruction::kComment ||
+        instruction.jump != Jump::kNull) {
+      tokens.push_back(2 * separators++ + 1);
+      continue;
+    }
+    auto key = std::make_tuple(
+        static_cast<int>(instruction.kind),
+        static_cast<int>(instruction.computation),
+        static_cast<int>(instruction.destination), instruction.operand);
+    auto [found, inserted] = ids.emplace(key, ids.size());
+    tokens.push_back(2 * found->second);
+  }
+  return tokens;
+}
+
+// Returns the sites among `sites`, in ascending order, where the `length`
+// instructions starting there can be replaced by a call: they do not overlap
+// an earlier site, and the next instruction does not depend on A.
+std::vector<int> CallSites(const std::vector<Instruction> &instructions,
+                           const std::vector<int> &sites, int length) {
+  std::vector<int> calls;
+  for (int site : sites) {
+    size_t next = site + length;
+    if ((!calls.empty() && site < calls.back() + length) ||
+        next == instructions.size() ||
+        (!IsAddress(instructions[next]) &&
+         instructions[next].kind != Instruction::kLabel)) {
+      continue;
+    }
+    calls.push_back(site);
+  }
+  return calls;
+}
+
+// A repeated sequence and where it starts.
+struct Sequence {
+  int length = 0;
+  std::vector<int> sites;
+  int saved = 0;
+};
+
+// Updates `best` with the sequence saving the most instructions among the
+// prefixes of the `common` instructions repeated at `sites`, which are sorted.
+void EvaluatePrefixes(const std::vector<Instruction> &instructions,
+                      const std::vector<int> &sites, int common,
+                      Sequence *best) {
+  if (!IsAddress(instructions[sites[0]])) {
+    return;
+  }
+  bool writes_d = false;
+  for (int length = 1; length <= std::min(common, kMaxLength); ++length) {
+    const Instruction &last = instructions[sites[0] + length - 1];
+    if (!writes_d && ReadsD(last)) {
+      // D holds the return address on entry.
+      return;
+    }
+    writes_d = writes_d || WritesD(last);
+    if (!writes_d) {
+      // D might be read after the sequence.
+      continue;
+    }
+    int calls = CallSites(instructions, sites, length).size();
+    int saved = calls * (length - kCallCost) - length - kRoutineCost;
+    if (saved > best->saved) {
+      *best = {length, sites, saved};
+    }
+  }
+}
+
+// Returns the repeated sequence saving the most instructions, with `saved` 0
+// if there is none.
+Sequence FindBestSequence(const std::vector<Instruction> &instructions) {
+  std::vector<int> tokens = Tokenize(instructions);
+  std::vector<int> suffix_array = SuffixArray(tokens);
+  std::vector<int> prefixes = LongestCommonPrefixes(tokens, suffix_array);
+  Sequence best;
+  // Each run of adjacent suffixes sharing at least `length` tokens is a
+  // sequence repeated at their starts. The stack holds the runs still open,
+  // with their length and first suffix.
+  std::vector<std::pair<int, int>> open = {{0, 0}};
+  int n = tokens.size();
+  for (int i = 1; i <= n; ++i) {
+    int prefix = i < n ? prefixes[i] : 0;
+    int first = i - 1;
+    while (open.back().first > prefix) {
+      auto [length, begin] = open.back();
+      open.pop_back();
+      std::vector<int> sites(suffix_array.begin() + begin,
+                             suffix_array.begin() + i);
+      std::sort(sites.begin(), sites.end());
+      EvaluatePrefixes(instructions, sites, length, &best);
+      first = begin;
+    }
+    if (open.back().first < prefix) {
+      open.push_back({prefix, first});
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+OutliningPass::OutliningPass(size_t rom_budget) : rom_budget_(rom_budget) {}
+
+std::string_view OutliningPass::name() const { return "outlining"; }
+
+void OutliningPass::Run(HackProgram *program) const {
+  size_t size_before = program->InstructionCount();
+  uint16_t slot = FreeTempWord(*program);
+  if (slot == 0) {
+    LOG(INFO) << "No temp word is free to outline instructions";
+    return;
+  }
+  HackProgram routines;
+  int routine_count = 0;
+  while (program->InstructionCount() + routines.InstructionCount() >
+         rom_budget_) {
+    Sequence sequence = FindBestSequence(program->instructions());
+    if (sequence.saved <= 0) {
+      break;
+    }
+    std::string routine = absl::StrCat("$OUTLINED.", routine_count++);
+    routines.AppendLabel(routine);
+    routines.AppendAddress(slot);
+    routines.AppendCompute(Destination::kM, Computation::kD);
+    for (int i = 0; i < sequence.length; ++i) {
+      const Instruction &instruction =
+          program->instructions()[sequence.sites[0] + i];
+      if (instruction.kind == Instruction::kSymbol) {
+        routines.AppendAddress(program->symbol(instruction.operand));
+      } else {
+        routines.Append(instruction);
+      }
+    }
+    routines.AppendAddress(slot);
+    routines.AppendCompute(Destination::kA, Computation::kM);
+    routines.AppendCompute(0, Computation::kZero, Jump::kJmp);
+
+    std::vector<Instruction> instructions =
+        std::move(program->instructions());
+    program->instructions().clear();
+    std::vector<int> calls =
+        CallSites(instructions, sequence.sites, sequence.length);
+    auto call = calls.begin();
+    for (size_t i = 0; i < instructions.size();) {
+      if (call == calls.end() || static_cast<size_t>(*call) != i) {
+        program->Append(instructions[i++]);
+        continue;
+      }
+      std::string return_label =
+          absl::StrCat(routine, "$", call - calls.begin());
+      program->AppendAddress(return_label);
+      program->AppendCompute(Destination::kD, Computation::kA);
+      program->AppendAddress(routine);
+      program->AppendCompute(0, Computation::kZero, Jump::kJmp);
+      program->AppendLabel(return_label);
+      i += sequence.length;
+      ++call;
+    }
+  }
+  program->Append(routines);
+  LOG(INFO) << "Outlined " << routine_count << " instruction sequences: "
+            << size_before << " words of ROM before, "
+            << program->InstructionCount() << " after";
+  if (program->InstructionCount() > rom_budget_ && rom_budget_ > 0) {
+    LOG(WARNING) << "Program uses " << program->InstructionCount()
+                 << " words of ROM, above the budget of " << rom_budget_;
+  }
+}
@@ -0,0 +1,83 @@
+#include "outlining.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "hack.h"
+
+namespace {
+
+// Appends `@SP`, `AM=M-1`, `D=M`, `A=A-1`, `M=D+M`, `@LCL`, `A=M`, `M=D`.
+void AppendSequence(HackProgram *program) {
+  program->AppendAddress("SP");
+  program->AppendCompute(Destination::kA | Destination::kM,
+                         Computation::kMMinusOne);
+  program->AppendCompute(Destination::kD, Computation::kM);
+  program->AppendCompute(Destination::kA, Computation::kAMinusOne);
+  program->AppendCompute(Destination::kM, Computation::kDPlusM);
+  program->AppendAddress("LCL");
+  program->AppendCompute(Destination::kA, Computation::kM);
+  program->AppendCompute(Destination::kM, Computation::kD);
+}
+
+}  // namespace
+
+TEST(SuffixArrayTest, Banana) {
+  // "banana" with a = 0, b = 1 and n = 2.
+  std::vector<int> tokens = {1, 0, 2, 0, 2, 0};
+  std::vector<int> suffix_array = SuffixArray(tokens);
+  EXPECT_EQ(suffix_array, (std::vector<int>{5, 3, 1, 0, 4, 2}));
+  EXPECT_EQ(LongestCommonPrefixes(tokens, suffix_array),
+            (std::vector<int>{0, 1, 3, 0, 0, 2}));
+}
+
+TEST(OutliningPassTest, OutlinesRepeatedSequence) {
+  HackProgram program;
+  // Temp 0 is used by the program.
+  program.AppendAddress(5);
+  program.AppendCompute(Destination::kM, Computation::kZero);
+  for (int i = 0; i < 4; ++i) {
+    AppendSequence(&program);
+    program.AppendLabel("L" + std::to_string(i));
+  }
+  OutliningPass(0).Run(&program);
+
+  std::string expected = "@5\nM=0\n";
+  for (int i = 0; i < 4; ++i) {
+    std::string return_label = "$OUTLINED.0$" + std::to_string(i);
+    expected += "@" + return_label + "\nD=A\n@$OUTLINED.0\n0;JMP\n(" +
+                return_label + ")\n(L" + std::to_string(i) + ")\n";
+  }
+  HackProgram sequence;
+  AppendSequence(&sequence);
+  expected += "($OUTLINED.0)\n@6\nM=D\n" + sequence.ToAssembly() +
+              "@6\nA=M\n0;JMP\n";
+  EXPECT_EQ(program.ToAssembly(), expected);
+  EXPECT_EQ(program.InstructionCount(), 2 + 4 * 4 + 13);
+}
+
+TEST(OutliningPassTest, KeepsProgramWithinBudget) {
+  HackProgram program;
+  for (int i = 0; i < 4; ++i) {
+    AppendSequence(&program);
+    program.AppendLabel("L" + std::to_string(i));
+  }
+  std::string assembly = program.ToAssembly();
+  OutliningPass(program.InstructionCount()).Run(&program);
+  EXPECT_EQ(program.ToAssembly(), assembly);
+}
+
+TEST(OutliningPassTest, KeepsSequenceFollowedByUseOfA) {
+  HackProgram program;
+  for (int i = 0; i < 4; ++i) {
+    AppendSequence(&program);
+    // Jumps to the address the sequence leaves in A.
+    program.AppendCompute(0, Computation::kZero, Jump::kJmp);
+    program.AppendLabel("L" + std::to_string(i));
+  }
+  std::string assembly = program.ToAssembly();
+  OutliningPass(0).Run(&program);
+  EXPECT_EQ(program.ToAssembly(), assembly);
+}
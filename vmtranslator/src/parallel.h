@@ -0,0 +1,17 @@
+#ifndef NAND2TETRIS_VMTRANSLATOR_PARALLEL_H_
+#define NAND2TETRIS_VMTRANSLATOR_PARALLEL_H_
+
+#include <cstddef>
+#include <functional>
+
+// Number of worker threads to use when `requested` threads are asked for. If
+// `requested` is not positive, one thread per hardware thread is used.
+int ThreadCount(int requested);
+
+// Calls `task(i)` for each `i` in [0, `count`) on up to `thread_count` threads.
+// Tasks are handed out in increasing order of `i`, and the function returns
+// once all of them have finished.
+void ParallelFor(size_t count, int thread_count,
+                 const std::function<void(size_t)> &task);
+
+#endif  // NAND2TETRIS_VMTRANSLATOR_PARALLEL_H_
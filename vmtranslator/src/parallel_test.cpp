@@ -0,0 +1,28 @@
+#include "parallel.h"
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(ParallelTest, ThreadCount) {
+  EXPECT_EQ(ThreadCount(3), 3);
+  EXPECT_GE(ThreadCount(0), 1);
+}
+
+TEST(ParallelTest, ParallelFor) {
+  for (int thread_count : {1, 4}) {
+    std::vector<int> calls(100);
+    ParallelFor(calls.size(), thread_count, [&](size_t i) { ++calls[i]; });
+    EXPECT_EQ(calls, std::vector<int>(100, 1));
+  }
+}
+
+TEST(ParallelTest, MoreThreadsThanTasks) {
+  std::atomic<int> calls = 0;
+  ParallelFor(2, 8, [&](size_t) { ++calls; });
+  EXPECT_EQ(calls, 2);
+  ParallelFor(0, 8, [&](size_t) { ++calls; });
+  EXPECT_EQ(calls, 2);
+}
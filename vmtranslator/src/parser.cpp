@@ -1,14 +1,18 @@
 #include "parser.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <filesystem>
+#include <fstream>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <vector>
 
 #include "absl/log/check.h"
 #include "absl/log/log.h"
+#include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_split.h"
@@ -16,21 +20,60 @@
 #include "addressing.h"
 #include "commands.h"
 
+std::string ReadVmFile(std::string_view path) {
+  std::ifstream file(path.data(), std::ios::in | std::ios::binary);
+  QCHECK(file.is_open()) << "Could not open file: " << path;
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+std::vector<VmSegment> SplitAtFunctions(std::string_view source,
+                                        size_t min_segment_size) {
+  std::vector<VmSegment> segments = {{source, 0}};
+  size_t segment_begin = 0;
+  size_t line_number = 0;
+  for (size_t line_begin = 0; line_begin < source.size(); ++line_number) {
+    size_t line_end = source.find('\n', line_begin);
+    if (line_end == std::string_view::npos) {
+      line_end = source.size();
+    }
+    std::string_view line = source.substr(line_begin, line_end - line_begin);
+    line.remove_prefix(std::min(line.find_first_not_of(" \t"), line.size()));
+    if (line_begin - segment_begin >= min_segment_size &&
+        absl::StartsWith(line, "function") && line.size() > 8 &&
+        (line[8] == ' ' || line[8] == '\t')) {
+      segments.back().source =
+          source.substr(segment_begin, line_begin - segment_begin);
+      segments.push_back({source.substr(line_begin), line_number});
+      segment_begin = line_begin;
+    }
+    line_begin = line_end + 1;
+  }
+  return segments;
+}
+
 VmFile::VmFile(std::string_view path)
-    : file_(path.data()),
+    : contents_(ReadVmFile(path)),
+      source_(contents_),
       path_(path),
       filename_(std::filesystem::path(path_).stem().string()),
       function_(absl::StrCat(filename_, ".GLOBAL")) {
-  QCHECK(file_.is_open()) << "Could not open file: " << path;
   LOG(INFO) << "Processing VM file: " << path;
   Advance();
 }
 
-VmFile::~VmFile() {
-  file_.close();
-  delete command_;
+VmFile::VmFile(std::string_view path, const VmSegment &segment)
+    : source_(segment.source),
+      path_(path),
+      filename_(std::filesystem::path(path_).stem().string()),
+      line_number_(segment.line_number),
+      function_(absl::StrCat(filename_, ".GLOBAL")) {
+  Advance();
 }
 
+VmFile::~VmFile() { delete command_; }
+
 std::unique_ptr<Address> VmFile::ParseAddress(std::string_view segment,
                                               std::string_view index_str) {
   uint16_t index = std::stoi(index_str.data());
@@ -70,7 +113,10 @@ void VmFile::Advance() {
   }
 
   std::vector<std::string_view> tokens;
-  while (tokens.empty() && std::getline(file_, line_)) {
+  while (tokens.empty() && !source_.empty()) {
+    size_t line_end = std::min(source_.find('\n'), source_.size());
+    line_ = source_.substr(0, line_end);
+    source_.remove_prefix(std::min(line_end + 1, source_.size()));
     std::string_view line_view = line_;
     ++line_number_;
     line_view = line_view.substr(0, line_view.find("//"));
@@ -129,6 +175,7 @@ void VmFile::Advance() {
   } else if (tokens[0] == "function") {
     QCHECK_EQ(tokens.size(), 3) << filename_ << ':' << line_number_
                                 << ": Invalid function command: " << line_;
+    function_ = tokens[1];
     command_ = new FunctionCommand(tokens[1], std::stoi(tokens[2].data()));
   } else if (tokens[0] == "return") {
     QCHECK_EQ(tokens.size(), 1) << filename_ << ':' << line_number_
@@ -144,3 +191,9 @@ std::string VmFile::path() { return path_; }
 std::string VmFile::line() { return line_; }
 size_t VmFile::line_number() { return line_number_; }
 Command *VmFile::command() { return command_; }
+
+std::unique_ptr<Command> VmFile::TakeCommand() {
+  std::unique_ptr<Command> command(command_);
+  command_ = nullptr;
+  return command;
+}
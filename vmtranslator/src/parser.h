@@ -1,14 +1,36 @@
 #ifndef NAND2TETRIS_VMTRANSLATOR_PARSER_H_
 #define NAND2TETRIS_VMTRANSLATOR_PARSER_H_
 
-#include <fstream>
+#include <cstddef>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include "commands.h"
 
+// Returns the contents of the file at `path`.
+std::string ReadVmFile(std::string_view path);
+
+// A part of a VM file, starting after line `line_number`.
+struct VmSegment {
+  std::string_view source;
+  size_t line_number;
+};
+
+// Splits `source` into segments at `function` commands, so that each segment
+// can be translated independently. Consecutive functions are kept in the same
+// segment until it is at least `min_segment_size` bytes long.
+std::vector<VmSegment> SplitAtFunctions(std::string_view source,
+                                        size_t min_segment_size);
+
 class VmFile {
  public:
   VmFile(std::string_view path);
+  // Parses `segment` of the VM file at `path`, whose contents must outlive the
+  // `VmFile`. Label and function names are the same as when the whole file is
+  // parsed.
+  VmFile(std::string_view path, const VmSegment &segment);
   ~VmFile();
 
   void Advance();
@@ -17,12 +39,15 @@ class VmFile {
   std::string line();
   size_t line_number();
   Command *command();
+  // Transfers ownership of the current command to the caller.
+  std::unique_ptr<Command> TakeCommand();
 
  private:
   std::unique_ptr<Address> ParseAddress(std::string_view segment,
                                         std::string_view index_str);
 
-  std::ifstream file_;
+  std::string contents_;
+  std::string_view source_;
   std::string path_;
   std::string filename_;
 
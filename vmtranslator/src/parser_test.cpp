@@ -0,0 +1,67 @@
+#include "parser.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+constexpr std::string_view kSource =
+    "// Foo.vm\n"
+    "push constant 1\n"
+    "function Foo.f 1\n"
+    "  label LOOP\n"
+    "  push local 0\n"
+    "  push constant 0\n"
+    "  eq\n"
+    "  if-goto LOOP\n"
+    "  return\n"
+    "\tfunction Foo.g 0\n"
+    "  label LOOP\n"
+    "  call Foo.f 0\n"
+    "  goto LOOP\n";
+
+std::string TranslateSegment(const VmSegment &segment) {
+  std::string assembly;
+  VmFile vm_file("dir/Foo.vm", segment);
+  while (vm_file.command()) {
+    assembly += vm_file.command()->ToAssembly();
+    vm_file.Advance();
+  }
+  return assembly;
+}
+
+}  // namespace
+
+TEST(SplitAtFunctionsTest, SplitsAtFunctions) {
+  std::vector<VmSegment> segments = SplitAtFunctions(kSource, 1);
+  ASSERT_EQ(segments.size(), 3);
+  EXPECT_EQ(segments[0].source, "// Foo.vm\npush constant 1\n");
+  EXPECT_EQ(segments[0].line_number, 0);
+  EXPECT_EQ(segments[1].source.substr(0, 17), "function Foo.f 1\n");
+  EXPECT_EQ(segments[1].line_number, 2);
+  EXPECT_EQ(segments[2].source.substr(0, 17), "\tfunction Foo.g 0");
+  EXPECT_EQ(segments[2].line_number, 9);
+}
+
+TEST(SplitAtFunctionsTest, KeepsSmallSegmentsTogether) {
+  std::vector<VmSegment> segments = SplitAtFunctions(kSource, 100);
+  ASSERT_EQ(segments.size(), 2);
+  EXPECT_EQ(segments[1].source.substr(0, 17), "\tfunction Foo.g 0");
+  EXPECT_EQ(SplitAtFunctions(kSource, 1000).size(), 1);
+}
+
+TEST(VmFileTest, SegmentsTranslateLikeWholeFile) {
+  std::string segmented;
+  for (const VmSegment &segment : SplitAtFunctions(kSource, 1)) {
+    segmented += TranslateSegment(segment);
+  }
+  std::string whole = TranslateSegment({kSource, 0});
+  EXPECT_EQ(segmented, whole);
+  EXPECT_NE(whole.find("(Foo.f$LOOP)\n"), std::string::npos);
+  EXPECT_NE(whole.find("(Foo.g$LOOP)\n"), std::string::npos);
+  EXPECT_NE(whole.find("(Foo_7$eq_end)\n"), std::string::npos);
+  EXPECT_NE(whole.find("(Foo_12$ret)\n"), std::string::npos);
+}
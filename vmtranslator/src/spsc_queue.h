@@ -0,0 +1,113 @@
+#ifndef NAND2TETRIS_VMTRANSLATOR_SPSC_QUEUE_H_
+#define NAND2TETRIS_VMTRANSLATOR_SPSC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Statistics of a `SpscQueue`, meant to be read after both threads are done.
+struct SpscQueueStats {
+  size_t capacity = 0;
+  size_t push_count = 0;
+  size_t max_depth = 0;
+  // Sum of the queue depth seen by each push, for computing the mean depth.
+  size_t total_depth = 0;
+  // Time the producer spent waiting for a free slot.
+  std::chrono::nanoseconds producer_stall_time{0};
+  // Time the consumer spent waiting for an element.
+  std::chrono::nanoseconds consumer_stall_time{0};
+
+  double mean_depth() const {
+    return push_count ? static_cast<double>(total_depth) / push_count : 0;
+  }
+};
+
+// A bounded lock-free queue for exactly one producer thread and one consumer
+// thread, implemented as a ring buffer. `Push()` and `Pop()` spin, yielding the
+// processor, while the queue is full or empty.
+template <class T>
+class SpscQueue {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit SpscQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < std::max<size_t>(capacity, 1)) {
+      size <<= 1;
+    }
+    slots_.resize(size);
+    mask_ = size - 1;
+    stats_.capacity = size;
+  }
+
+  bool TryPush(T &value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t depth = tail - head_.load(std::memory_order_acquire);
+    if (depth > mask_) {
+      return false;
+    }
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+
+    ++stats_.push_count;
+    stats_.total_depth += depth + 1;
+    stats_.max_depth = std::max(stats_.max_depth, depth + 1);
+    return true;
+  }
+
+  bool TryPop(T *value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *value = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  void Push(T value) {
+    if (TryPush(value)) {
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (!TryPush(value)) {
+      std::this_thread::yield();
+    }
+    stats_.producer_stall_time += std::chrono::steady_clock::now() - start;
+  }
+
+  T Pop() {
+    T value;
+    if (TryPop(&value)) {
+      return value;
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (!TryPop(&value)) {
+      std::this_thread::yield();
+    }
+    consumer_stall_time_ += std::chrono::steady_clock::now() - start;
+    return value;
+  }
+
+  SpscQueueStats stats() const {
+    SpscQueueStats stats = stats_;
+    stats.consumer_stall_time = consumer_stall_time_;
+    return stats;
+  }
+
+ private:
+  std::vector<T> slots_;
+  size_t mask_;
+  // Keep the indices written by different threads on separate cache lines.
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  // Written only by the producer.
+  alignas(64) SpscQueueStats stats_;
+  // Written only by the consumer.
+  alignas(64) std::chrono::nanoseconds consumer_stall_time_{0};
+};
+
+#endif  // NAND2TETRIS_VMTRANSLATOR_SPSC_QUEUE_H_
@@ -0,0 +1,48 @@
+#include "spsc_queue.h"
+
+#include <memory>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+TEST(SpscQueueTest, RoundsCapacityUpToPowerOfTwo) {
+  EXPECT_EQ(SpscQueue<int>(5).stats().capacity, 8);
+  EXPECT_EQ(SpscQueue<int>(0).stats().capacity, 1);
+}
+
+TEST(SpscQueueTest, TryPushFailsWhenFull) {
+  SpscQueue<int> queue(2);
+  int value = 1;
+  EXPECT_TRUE(queue.TryPush(value));
+  EXPECT_TRUE(queue.TryPush(value));
+  EXPECT_FALSE(queue.TryPush(value));
+  int popped = 0;
+  EXPECT_TRUE(queue.TryPop(&popped));
+  EXPECT_EQ(popped, 1);
+  EXPECT_TRUE(queue.TryPush(value));
+
+  SpscQueueStats stats = queue.stats();
+  EXPECT_EQ(stats.push_count, 3);
+  EXPECT_EQ(stats.max_depth, 2);
+}
+
+TEST(SpscQueueTest, PassesElementsInOrderBetweenThreads) {
+  constexpr int kCount = 100000;
+  SpscQueue<std::unique_ptr<int>> queue(4);
+  std::thread producer([&]() {
+    for (int i = 0; i < kCount; ++i) {
+      queue.Push(std::make_unique<int>(i));
+    }
+  });
+  for (int i = 0; i < kCount; ++i) {
+    std::unique_ptr<int> value = queue.Pop();
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(*value, i);
+  }
+  producer.join();
+
+  SpscQueueStats stats = queue.stats();
+  EXPECT_EQ(stats.push_count, kCount);
+  EXPECT_LE(stats.max_depth, 4);
+  EXPECT_GE(stats.mean_depth(), 1);
+}
@@ -0,0 +1,983 @@
+#include "superoptimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+
+#include "addressing.h"
+#include "command_templates.h"
+#include "hack.h"
+
+namespace {
+
+// Registers in the order of their addresses.
+constexpr std::string_view kRegisters[] = {"SP", "LCL", "ARG", "THIS",
+                                           "THAT"};
+
+// Every computation of the Hack ALU, with the name of its enumerator.
+constexpr std::pair<Computation, std::string_view> kComputations[] = {
+    {Computation::kZero, "kZero"},
+    {Computation::kOne, "kOne"},
+    {Computation::kMinusOne, "kMinusOne"},
+    {Computation::kD, "kD"},
+    {Computation::kA, "kA"},
+    {Computation::kNotD, "kNotD"},
+    {Computation::kNotA, "kNotA"},
+    {Computation::kNegD, "kNegD"},
+    {Computation::kNegA, "kNegA"},
+    {Computation::kDPlusOne, "kDPlusOne"},
+    {Computation::kAPlusOne, "kAPlusOne"},
+    {Computation::kDMinusOne, "kDMinusOne"},
+    {Computation::kAMinusOne, "kAMinusOne"},
+    {Computation::kDPlusA, "kDPlusA"},
+    {Computation::kDMinusA, "kDMinusA"},
+    {Computation::kAMinusD, "kAMinusD"},
+    {Computation::kDAndA, "kDAndA"},
+    {Computation::kDOrA, "kDOrA"},
+    {Computation::kM, "kM"},
+    {Computation::kNotM, "kNotM"},
+    {Computation::kNegM, "kNegM"},
+    {Computation::kMPlusOne, "kMPlusOne"},
+    {Computation::kMMinusOne, "kMMinusOne"},
+    {Computation::kDPlusM, "kDPlusM"},
+    {Computation::kDMinusM, "kDMinusM"},
+    {Computation::kMMinusD, "kMMinusD"},
+    {Computation::kDAndM, "kDAndM"},
+    {Computation::kDOrM, "kDOrM"},
+};
+
+struct Arithmetic {
+  std::string_view command;
+  Computation computation;
+  bool binary;
+};
+
+// The computation of the result of each arithmetic command, from the second
+// operand in M and the top of the stack in D.
+constexpr Arithmetic kArithmetic[] = {
+    {"add", Computation::kDPlusM, true},  {"sub", Computation::kMMinusD, true},
+    {"and", Computation::kDAndM, true},   {"or", Computation::kDOrM, true},
+    {"neg", Computation::kNegM, false},   {"not", Computation::kNotM, false},
+};
+
+constexpr std::string_view kPointerSegments[][2] = {
+    {"local", "LCL"},
+    {"argument", "ARG"},
+    {"this", "THIS"},
+    {"that", "THAT"},
+};
+
+constexpr std::string_view kDirectSegments[] = {"static", "temp", "pointer"};
+
+// The number of memory words a command writes, at most.
+constexpr int kMaxWords = 2;
+// The number of random machine states candidates are compared on while
+// searching, and tested on once they give the right result on those.
+constexpr int kSearchTests = 3;
+constexpr int kCheckTests = 64;
+// The number of words a command reads or writes, at most.
+constexpr int kMaxReadable = 8;
+// The number of states remembered by the search, which bounds its memory.
+constexpr size_t kMaxVisited = 1 << 24;
+
+const Arithmetic *FindArithmetic(std::string_view command) {
+  for (const Arithmetic &arithmetic : kArithmetic) {
+    if (arithmetic.command == command) {
+      return &arithmetic;
+    }
+  }
+  return nullptr;
+}
+
+// Returns the pointer register of a pointer-addressed segment, or an empty
+// string for other segments.
+std::string_view PointerRegister(std::string_view segment) {
+  for (const auto &[name, pointer] : kPointerSegments) {
+    if (name == segment) {
+      return pointer;
+    }
+  }
+  return {};
+}
+
+uint16_t RegisterAddress(std::string_view symbol) {
+  auto found = std::find(std::begin(kRegisters), std::end(kRegisters), symbol);
+  CHECK(found != std::end(kRegisters)) << "Unknown register: " << symbol;
+  return found - std::begin(kRegisters);
+}
+
+int IndexOf(IndexClass index_class) {
+  switch (index_class) {
+    case IndexClass::kOne:
+      return 1;
+    case IndexClass::kTwo:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+// Whether candidates may load the parameter, which is otherwise a constant
+// that is 0 or the address of SP or LCL.
+bool HasParameter(const CommandTemplate &key) {
+  return key.index_class == IndexClass::kAny ||
+         key.index_class == IndexClass::kTwo;
+}
+
+template <typename Machine>
+typename Machine::Value Parameter(const CommandTemplate &key,
+                                  Machine *machine) {
+  if (key.index_class == IndexClass::kAny) {
+    return machine->Parameter();
+  }
+  return machine->Constant(IndexOf(key.index_class));
+}
+
+// Applies the effect of the command to the memory of `machine`.
+template <typename Machine>
+void ApplyCommand(const CommandTemplate &key, Machine *machine) {
+  using Value = typename Machine::Value;
+  Value zero = machine->Constant(0);
+  Value sp = machine->Read(zero);
+  Value top = machine->Compute(Computation::kAMinusOne, zero, sp);
+  if (const Arithmetic *arithmetic = FindArithmetic(key.command)) {
+    if (!arithmetic->binary) {
+      machine->Write(top, machine->Compute(arithmetic->computation, zero,
+                                           machine->Read(top)));
+      return;
+    }
+    Value second = machine->Compute(Computation::kAMinusOne, zero, top);
+    machine->Write(second,
+                   machine->Compute(arithmetic->computation, machine->Read(top),
+                                    machine->Read(second)));
+    machine->Write(zero, top);
+    return;
+  }
+  Value parameter = Parameter(key, machine);
+  Value address = parameter;
+  std::string_view pointer = PointerRegister(key.segment);
+  if (!pointer.empty()) {
+    address = machine->Compute(
+        Computation::kDPlusA, parameter,
+        machine->Read(machine->Constant(RegisterAddress(pointer))));
+  }
+  if (key.command == "push") {
+    machine->Write(sp, key.segment == "constant" ? parameter
+                                                 : machine->Read(address));
+    machine->Write(zero, machine->Compute(Computation::kAPlusOne, zero, sp));
+    return;
+  }
+  machine->Write(address, machine->Read(top));
+  machine->Write(zero, top);
+}
+
+// Executes the instructions of the template on `machine`.
+template <typename Machine>
+void Execute(const CommandTemplate &command_template, Machine *machine) {
+  using Value = typename Machine::Value;
+  Value a = machine->InitialA();
+  Value d = machine->InitialD();
+  for (const TemplateInstruction &instruction :
+       command_template.instructions) {
+    switch (instruction.kind) {
+      case TemplateInstruction::kRegister:
+        a = machine->Constant(RegisterAddress(instruction.symbol));
+        break;
+      case TemplateInstruction::kParameter:
+        a = Parameter(command_template, machine);
+        break;
+      case TemplateInstruction::kCompute: {
+        Value operand = ReadsMemory(instruction.computation)
+                            ? machine->Read(a)
+                            : a;
+        Value result = machine->Compute(instruction.computation, d, operand);
+        if (instruction.destination & Destination::kM) {
+          machine->Write(a, result);
+        }
+        if (instruction.destination & Destination::kA) {
+          a = result;
+        }
+        if (instruction.destination & Destination::kD) {
+          d = result;
+        }
+        break;
+      }
+    }
+  }
+}
+
+// A random machine state satisfying the assumptions of the translator: the
+// stack, the segments and the registers do not overlap.
+struct TestCase {
+  std::vector<uint16_t> ram;
+  uint16_t a;
+  uint16_t d;
+  uint16_t parameter;
+};
+
+TestCase RandomTestCase(const CommandTemplate &key, std::mt19937 *random) {
+  auto uniform = [&](int min, int max) -> uint16_t {
+    return std::uniform_int_distribution<int>(min, max)(*random);
+  };
+  TestCase test;
+  test.ram.resize(1 << 16);
+  for (uint16_t &word : test.ram) {
+    word = uniform(0, 0xFFFF);
+  }
+  test.ram[0] = uniform(1024, 2000);
+  test.ram[1] = uniform(300, 900);
+  test.ram[2] = uniform(300, 900);
+  test.ram[3] = uniform(2048, 16000);
+  test.ram[4] = uniform(2048, 16000);
+  test.a = uniform(0, 0xFFFF);
+  test.d = uniform(0, 0xFFFF);
+  test.parameter = IndexOf(key.index_class);
+  if (key.index_class != IndexClass::kAny) {
+    return test;
+  }
+  if (key.segment == "constant") {
+    test.parameter = uniform(2, 0x7FFF);
+  } else if (key.segment == "static") {
+    test.parameter = uniform(16, 255);
+  } else if (key.segment == "temp") {
+    test.parameter = uniform(5, 12);
+  } else if (key.segment == "pointer") {
+    test.parameter = uniform(3, 4);
+  } else {
+    test.parameter = uniform(3, 100);
+  }
+  return test;
+}
+
+class ConcreteMachine {
+ public:
+  using Value = uint16_t;
+
+  explicit ConcreteMachine(const TestCase *test) : test_(test) {}
+
+  Value Constant(uint16_t value) const { return value; }
+  Value Parameter() const { return test_->parameter; }
+  Value InitialA() const { return test_->a; }
+  Value InitialD() const { return test_->d; }
+
+  Value Read(Value address) {
+    reads_.insert(address);
+    auto found = writes_.find(address);
+    return found != writes_.end() ? found->second : test_->ram[address];
+  }
+
+  void Write(Value address, Value value) { writes_[address] = value; }
+
+  Value Compute(Computation computation, Value d, Value a_or_m) const {
+    return Evaluate(computation, d, a_or_m);
+  }
+
+  // Returns the addresses of the words read.
+  const std::set<uint16_t> &reads() const { return reads_; }
+  // Returns the words written, including those left unchanged.
+  const std::map<uint16_t, uint16_t> &writes() const { return writes_; }
+
+  // Returns the words that differ from the initial memory.
+  std::map<uint16_t, uint16_t> Changes() const {
+    std::map<uint16_t, uint16_t> changes;
+    for (auto [address, value] : writes_) {
+      if (value != test_->ram[address]) {
+        changes.emplace(address, value);
+      }
+    }
+    return changes;
+  }
+
+ private:
+  const TestCase *test_;
+  std::set<uint16_t> reads_;
+  std::map<uint16_t, uint16_t> writes_;
+};
+
+bool Matches(const CommandTemplate &command_template, const TestCase &test) {
+  ConcreteMachine expected(&test);
+  ApplyCommand(command_template, &expected);
+  ConcreteMachine actual(&test);
+  Execute(command_template, &actual);
+  return expected.Changes() == actual.Changes();
+}
+
+// A value as a sum of multiples of atoms and a constant modulo 2^16. Atoms are
+// named by text, such as "RAM[1]" for the initial value of LCL.
+struct SymbolicValue {
+  uint16_t constant = 0;
+  // The multiple of each atom, never 0.
+  std::map<std::string, uint16_t> multiples;
+
+  bool operator==(const SymbolicValue &other) const {
+    return constant == other.constant && multiples == other.multiples;
+  }
+
+  bool IsConstant(uint16_t value) const {
+    return multiples.empty() && constant == value;
+  }
+
+  std::string ToString() const {
+    std::string text;
+    for (const auto &[atom, multiple] : multiples) {
+      absl::StrAppend(&text, multiple, "*", atom, "+");
+    }
+    absl::StrAppend(&text, constant);
+    return text;
+  }
+};
+
+SymbolicValue Atom(std::string atom) {
+  SymbolicValue value;
+  value.multiples.emplace(std::move(atom), 1);
+  return value;
+}
+
+SymbolicValue Sum(const SymbolicValue &x, const SymbolicValue &y) {
+  SymbolicValue sum = x;
+  sum.constant += y.constant;
+  for (const auto &[atom, multiple] : y.multiples) {
+    uint16_t &sum_multiple = sum.multiples[atom];
+    sum_multiple += multiple;
+    if (sum_multiple == 0) {
+      sum.multiples.erase(atom);
+    }
+  }
+  return sum;
+}
+
+// Returns ~x, which is -x - 1.
+SymbolicValue Complement(const SymbolicValue &x) {
+  SymbolicValue complement;
+  complement.constant = -x.constant - 1;
+  for (const auto &[atom, multiple] : x.multiples) {
+    complement.multiples.emplace(atom, -multiple);
+  }
+  return complement;
+}
+
+SymbolicValue And(const SymbolicValue &x, const SymbolicValue &y) {
+  if (x.IsConstant(0) || y.IsConstant(0xFFFF) || x == y) {
+    return x;
+  }
+  if (y.IsConstant(0) || x.IsConstant(0xFFFF)) {
+    return y;
+  }
+  if (x.multiples.empty() && y.multiples.empty()) {
+    SymbolicValue value;
+    value.constant = x.constant & y.constant;
+    return value;
+  }
+  std::string first = x.ToString();
+  std::string second = y.ToString();
+  if (second < first) {
+    std::swap(first, second);
+  }
+  return Atom(absl::StrCat("(", first, "&", second, ")"));
+}
+
+class SymbolicMachine {
+ public:
+  using Value = SymbolicValue;
+
+  Value Constant(uint16_t value) const {
+    SymbolicValue constant;
+    constant.constant = value;
+    return constant;
+  }
+  Value Parameter() const { return Atom("n"); }
+  Value InitialA() const { return Atom("A"); }
+  Value InitialD() const { return Atom("D"); }
+
+  Value Read(const Value &address) const {
+    std::string key = address.ToString();
+    auto found = writes_.find(key);
+    return found != writes_.end() ? found->second : Initial(key);
+  }
+
+  void Write(const Value &address, Value value) {
+    writes_[address.ToString()] = std::move(value);
+  }
+
+  // Follows the Hack ALU: `x` is D, `y` is A or M, either may be zeroed and
+  // then complemented, and the result, which is their sum or bitwise and, may
+  // be complemented.
+  Value Compute(Computation computation, const Value &d,
+                const Value &a_or_m) const {
+    uint8_t bits = static_cast<uint8_t>(computation);
+    Value x = bits & 0b100000 ? Constant(0) : d;
+    if (bits & 0b010000) {
+      x = Complement(x);
+    }
+    Value y = bits & 0b001000 ? Constant(0) : a_or_m;
+    if (bits & 0b000100) {
+      y = Complement(y);
+    }
+    Value result = bits & 0b000010 ? Sum(x, y) : And(x, y);
+    return bits & 0b000001 ? Complement(result) : result;
+  }
+
+  // Returns the words that differ from the initial memory, by address.
+  std::map<std::string, std::string> Changes() const {
+    std::map<std::string, std::string> changes;
+    for (const auto &[address, value] : writes_) {
+      if (!(value == Initial(address))) {
+        changes.emplace(address, value.ToString());
+      }
+    }
+    return changes;
+  }
+
+ private:
+  static Value Initial(const std::string &address) {
+    return Atom(absl::StrCat("RAM[", address, "]"));
+  }
+
+  std::map<std::string, Value> writes_;
+};
+
+// The values a candidate computes on one test case, where memory is the
+// initial one except for the words the command writes.
+struct State {
+  uint16_t a;
+  uint16_t d;
+  std::array<uint16_t, kMaxWords> words;
+
+  bool operator==(const State &other) const {
+    return a == other.a && d == other.d && words == other.words;
+  }
+};
+
+using States = std::array<State, kSearchTests>;
+
+// Which registers hold a value the candidate computed, and whether that value
+// is yet to be read.
+struct Liveness {
+  bool a_defined = false;
+  bool d_defined = false;
+  bool a_unread = false;
+  bool d_unread = false;
+};
+
+// An instruction candidates are made of, with the registers it reads and
+// writes as `Destination` bitmasks, where reading M also reads A.
+struct Letter {
+  TemplateInstruction instruction;
+  uint8_t reads = 0;
+  uint8_t writes = 0;
+};
+
+// The words a command reads or writes on a test case, and the values it
+// writes.
+struct Words {
+  std::array<uint16_t, kMaxWords> addresses = {};
+  std::array<uint16_t, kMaxWords> targets = {};
+  std::array<uint16_t, kMaxReadable> readable = {};
+  int readable_count = 0;
+};
+
+// A depth-first search of candidates of a fixed length, which remembers the
+// states from which no candidate with as many instructions left was found.
+class Search {
+ public:
+  explicit Search(CommandTemplate *key) : key_(key) {
+    std::mt19937 random(0);
+    for (int i = 0; i < kSearchTests + kCheckTests; ++i) {
+      tests_.push_back(RandomTestCase(*key, &random));
+    }
+    for (int i = 0; i < kSearchTests; ++i) {
+      ConcreteMachine expected(&tests_[i]);
+      ApplyCommand(*key, &expected);
+      CHECK_LE(expected.writes().size(), kMaxWords);
+      word_count_ = expected.writes().size();
+      std::set<uint16_t> readable = expected.reads();
+      int word = 0;
+      for (auto [address, value] : expected.writes()) {
+        words_[i].addresses[word] = address;
+        words_[i].targets[word] = value;
+        initial_[i].words[word] = tests_[i].ram[address];
+        readable.insert(address);
+        ++word;
+      }
+      CHECK_LE(readable.size(), kMaxReadable);
+      std::copy(readable.begin(), readable.end(), words_[i].readable.begin());
+      words_[i].readable_count = readable.size();
+      initial_[i].a = tests_[i].a;
+      initial_[i].d = tests_[i].d;
+    }
+
+    // Address instructions come first, so that the search prefers them to
+    // computing the same constant into A.
+    alphabet_.push_back(
+        {{TemplateInstruction::kRegister, "SP", Computation::kZero, 0},
+         0,
+         Destination::kA});
+    std::string_view pointer = PointerRegister(key->segment);
+    if (!pointer.empty()) {
+      alphabet_.push_back(
+          {{TemplateInstruction::kRegister, pointer, Computation::kZero, 0},
+           0,
+           Destination::kA});
+    }
+    if (HasParameter(*key)) {
+      alphabet_.push_back(
+          {{TemplateInstruction::kParameter, {}, Computation::kZero, 0},
+           0,
+           Destination::kA});
+    }
+    for (auto [computation, name] : kComputations) {
+      uint8_t bits = static_cast<uint8_t>(computation);
+      uint8_t reads = 0;
+      if (!(bits & 0b100000)) {
+        reads |= Destination::kD;
+      }
+      if (!(bits & 0b001000)) {
+        reads |= ReadsMemory(computation) ? Destination::kA | Destination::kM
+                                          : Destination::kA;
+      }
+      for (uint8_t destination = 1; destination < 8; ++destination) {
+        alphabet_.push_back(
+            {{TemplateInstruction::kCompute, {}, computation, destination},
+             static_cast<uint8_t>(destination & Destination::kM
+                                      ? reads | Destination::kA
+                                      : reads),
+             destination});
+      }
+    }
+  }
+
+  bool Run(int length) { return Visit(length, initial_, Liveness(), -1); }
+
+  int64_t candidates() const { return candidates_; }
+
+ private:
+  // Returns the index of the word at `address` that the command writes on test
+  // `test`, or -1.
+  int WordAt(int test, uint16_t address) const {
+    for (int word = 0; word < word_count_; ++word) {
+      if (words_[test].addresses[word] == address) {
+        return word;
+      }
+    }
+    return -1;
+  }
+
+  bool Readable(int test, uint16_t address) const {
+    const Words &words = words_[test];
+    return std::find(words.readable.begin(),
+                     words.readable.begin() + words.readable_count,
+                     address) != words.readable.begin() + words.readable_count;
+  }
+
+  uint16_t Read(int test, const State &state, uint16_t address) const {
+    int word = WordAt(test, address);
+    return word >= 0 ? state.words[word] : tests_[test].ram[address];
+  }
+
+  static uint64_t Hash(const States &states, const Liveness &liveness,
+                       int previous) {
+    uint64_t hash = previous;
+    auto mix = [&](uint64_t value) {
+      hash = (hash ^ value) * 0x100000001B3ull;
+      hash ^= hash >> 29;
+    };
+    for (const State &state : states) {
+      mix(state.a);
+      mix(state.d);
+      for (uint16_t word : state.words) {
+        mix(word);
+      }
+    }
+    mix(liveness.a_defined | liveness.d_defined << 1 |
+        liveness.a_unread << 2 | liveness.d_unread << 3);
+    return hash;
+  }
+
+  // Whether the letters `first` and `second` give the same result in either
+  // order.
+  bool Independent(int first, int second) const {
+    const Letter &a = alphabet_[first];
+    const Letter &b = alphabet_[second];
+    return !(a.writes & (b.reads | b.writes)) && !(b.writes & a.reads);
+  }
+
+  // Whether the candidate in `path_` gives the right result on every test and
+  // is proved equivalent. Candidates for a pointer-addressed segment must be
+  // proved for the others too, with their pointer, so that they are found once.
+  bool Accept() {
+    key_->instructions = path_;
+    for (const TestCase &test : tests_) {
+      if (!Matches(*key_, test)) {
+        return false;
+      }
+    }
+    if (PointerRegister(key_->segment).empty()) {
+      return ProveEquivalent(*key_);
+    }
+    for (const auto &[segment, pointer] : kPointerSegments) {
+      if (!ProveEquivalent(WithPointerSegment(*key_, segment))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Executes the letter on `states`, storing the result in `next`. Returns
+  // false if it uses memory the command does not, which holds values
+  // unrelated to the command.
+  bool Step(const Letter &letter, const States &states, States *next) const {
+    const TemplateInstruction &instruction = letter.instruction;
+    if (instruction.kind != TemplateInstruction::kCompute) {
+      for (int test = 0; test < kSearchTests; ++test) {
+        (*next)[test] = states[test];
+        (*next)[test].a = instruction.kind == TemplateInstruction::kRegister
+                              ? RegisterAddress(instruction.symbol)
+                              : tests_[test].parameter;
+      }
+      return true;
+    }
+    int written_word = -1;
+    for (int test = 0; test < kSearchTests; ++test) {
+      const State &state = states[test];
+      State &result = (*next)[test];
+      result = state;
+      uint16_t operand = state.a;
+      if (letter.reads & Destination::kM) {
+        if (!Readable(test, state.a)) {
+          return false;
+        }
+        operand = Read(test, state, state.a);
+      }
+      uint16_t value = Evaluate(instruction.computation, state.d, operand);
+      if (letter.writes & Destination::kM) {
+        int word = WordAt(test, state.a);
+        if (word < 0 || (test > 0 && word != written_word)) {
+          return false;
+        }
+        written_word = word;
+        result.words[word] = value;
+      }
+      if (letter.writes & Destination::kA) {
+        result.a = value;
+      }
+      if (letter.writes & Destination::kD) {
+        result.d = value;
+      }
+    }
+    return true;
+  }
+
+  // Visits the candidates starting with `path_`, which gives `states` and
+  // `liveness` and ends with the letter `previous`.
+  bool Visit(int remaining, const States &states, const Liveness &liveness,
+             int previous) {
+    ++candidates_;
+    int wrong_words = 0;
+    for (int word = 0; word < word_count_; ++word) {
+      for (int test = 0; test < kSearchTests; ++test) {
+        if (states[test].words[word] != words_[test].targets[word]) {
+          ++wrong_words;
+          break;
+        }
+      }
+    }
+    if (remaining == 0) {
+      if (wrong_words > 0 || liveness.a_unread || liveness.d_unread) {
+        return false;
+      }
+      if (Accept()) {
+        return true;
+      }
+      ++rejected_;
+      return false;
+    }
+    // Each instruction writes at most one word.
+    if (wrong_words > remaining) {
+      return false;
+    }
+    // Near the end of candidates, states are rarely reached twice.
+    bool remember = remaining >= 3;
+    uint64_t hash = 0;
+    if (remember) {
+      hash = Hash(states, liveness, previous);
+      auto visited = visited_.find(hash);
+      if (visited != visited_.end() && visited->second >= remaining) {
+        return false;
+      }
+    }
+    // Candidates that are rejected after reaching the right states depend on
+    // the instructions before, so states are only remembered without them.
+    int64_t rejected = rejected_;
+
+    States next;
+    for (int i = 0; i < static_cast<int>(alphabet_.size()); ++i) {
+      const Letter &letter = alphabet_[i];
+      bool reads_a = letter.reads & Destination::kA;
+      bool reads_d = letter.reads & Destination::kD;
+      bool writes_a = letter.writes & Destination::kA;
+      bool writes_d = letter.writes & Destination::kD;
+      // Of two independent instructions, only the order in the alphabet is
+      // searched. Registers are never read before they are written, or
+      // written again before they are read, and when as many instructions are
+      // left as words are wrong, each must write one.
+      if ((previous > i && Independent(previous, i)) ||
+          (reads_a && !liveness.a_defined) ||
+          (reads_d && !liveness.d_defined) ||
+          (writes_a && liveness.a_unread && !reads_a) ||
+          (writes_d && liveness.d_unread && !reads_d) ||
+          (remaining == 1 && letter.writes != Destination::kM) ||
+          (remaining == wrong_words && !(letter.writes & Destination::kM))) {
+        continue;
+      }
+      if (!Step(letter, states, &next)) {
+        continue;
+      }
+      Liveness next_liveness = liveness;
+      if (reads_a) {
+        next_liveness.a_unread = false;
+      }
+      if (reads_d) {
+        next_liveness.d_unread = false;
+      }
+      if (writes_a) {
+        next_liveness.a_defined = true;
+        next_liveness.a_unread = true;
+      }
+      if (writes_d) {
+        next_liveness.d_defined = true;
+        next_liveness.d_unread = true;
+      }
+      if (next == states && next_liveness.a_defined == liveness.a_defined &&
+          next_liveness.d_defined == liveness.d_defined) {
+        // The instruction changes nothing.
+        continue;
+      }
+      path_.push_back(letter.instruction);
+      if (Visit(remaining - 1, next, next_liveness, i)) {
+        return true;
+      }
+      path_.pop_back();
+    }
+    if (remember && rejected_ == rejected &&
+        (visited_.size() < kMaxVisited || visited_.contains(hash))) {
+      visited_[hash] = remaining;
+    }
+    return false;
+  }
+
+  CommandTemplate *key_;
+  std::vector<TestCase> tests_;
+  int word_count_ = 0;
+  std::array<Words, kSearchTests> words_;
+  States initial_ = {};
+  std::vector<Letter> alphabet_;
+  std::vector<TemplateInstruction> path_;
+  absl::flat_hash_map<uint64_t, uint8_t> visited_;
+  int64_t candidates_ = 0;
+  int64_t rejected_ = 0;
+};
+
+std::string IndexClassName(IndexClass index_class) {
+  switch (index_class) {
+    case IndexClass::kNone:
+      return "kNone";
+    case IndexClass::kZero:
+      return "kZero";
+    case IndexClass::kOne:
+      return "kOne";
+    case IndexClass::kTwo:
+      return "kTwo";
+    case IndexClass::kAny:
+      return "kAny";
+  }
+  return "";
+}
+
+std::string_view ComputationName(Computation computation) {
+  for (auto [candidate, name] : kComputations) {
+    if (candidate == computation) {
+      return name;
+    }
+  }
+  return "";
+}
+
+std::string DestinationExpression(uint8_t destination) {
+  std::vector<std::string> registers;
+  for (char name : DestinationString(destination)) {
+    registers.push_back(absl::StrCat("Destination::k", std::string(1, name)));
+  }
+  return absl::StrJoin(registers, " | ");
+}
+
+}  // namespace
+
+std::vector<CommandTemplate> TemplateKeys() {
+  std::vector<CommandTemplate> keys;
+  for (const Arithmetic &arithmetic : kArithmetic) {
+    keys.push_back({arithmetic.command, "", IndexClass::kNone, {}});
+  }
+  for (IndexClass index_class :
+       {IndexClass::kZero, IndexClass::kOne, IndexClass::kAny}) {
+    keys.push_back({"push", "constant", index_class, {}});
+  }
+  for (const auto &[segment, pointer] : kPointerSegments) {
+    for (std::string_view command : {"push", "pop"}) {
+      for (IndexClass index_class : {IndexClass::kZero, IndexClass::kOne,
+                                     IndexClass::kTwo, IndexClass::kAny}) {
+        keys.push_back({command, segment, index_class, {}});
+      }
+    }
+  }
+  for (std::string_view segment : kDirectSegments) {
+    for (std::string_view command : {"push", "pop"}) {
+      keys.push_back({command, segment, IndexClass::kAny, {}});
+    }
+  }
+  return keys;
+}
+
+std::string TemplateName(const CommandTemplate &command_template) {
+  if (command_template.index_class == IndexClass::kNone) {
+    return std::string(command_template.command);
+  }
+  std::string index = command_template.index_class == IndexClass::kAny
+                          ? "n"
+                          : absl::StrCat(IndexOf(command_template.index_class));
+  return absl::StrCat(command_template.command, " ", command_template.segment,
+                      " ", index);
+}
+
+std::string TemplateAssembly(const CommandTemplate &command_template) {
+  std::vector<std::string> lines;
+  for (const TemplateInstruction &instruction :
+       command_template.instructions) {
+    switch (instruction.kind) {
+      case TemplateInstruction::kRegister:
+        lines.push_back(absl::StrCat("@", instruction.symbol));
+        break;
+      case TemplateInstruction::kParameter:
+        lines.push_back("@n");
+        break;
+      case TemplateInstruction::kCompute:
+        lines.push_back(
+            absl::StrCat(DestinationString(instruction.destination), "=",
+                         ComputationString(instruction.computation)));
+        break;
+    }
+  }
+  return absl::StrJoin(lines, " ");
+}
+
+bool Superoptimize(int max_length, CommandTemplate *key, int64_t *candidates) {
+  Search search(key);
+  for (int length = 1; length <= max_length; ++length) {
+    if (search.Run(length)) {
+      if (candidates) {
+        *candidates = search.candidates();
+      }
+      return true;
+    }
+  }
+  if (candidates) {
+    *candidates = search.candidates();
+  }
+  key->instructions.clear();
+  return false;
+}
+
+CommandTemplate WithPointerSegment(const CommandTemplate &command_template,
+                                   std::string_view segment) {
+  std::string_view from = PointerRegister(command_template.segment);
+  std::string_view to = PointerRegister(segment);
+  CHECK(!from.empty() && !to.empty())
+      << "Not pointer-addressed: " << command_template.segment << ", "
+      << segment;
+  CommandTemplate result = command_template;
+  result.segment = segment;
+  for (TemplateInstruction &instruction : result.instructions) {
+    if (instruction.kind == TemplateInstruction::kRegister &&
+        instruction.symbol == from) {
+      instruction.symbol = to;
+    }
+  }
+  return result;
+}
+
+bool ProveEquivalent(const CommandTemplate &command_template) {
+  SymbolicMachine expected;
+  ApplyCommand(command_template, &expected);
+  SymbolicMachine actual;
+  Execute(command_template, &actual);
+  return expected.Changes() == actual.Changes();
+}
+
+void WriteTemplateTable(const std::vector<CommandTemplate> &templates,
+                        std::ostream &os) {
+  os << "// Generated by the superoptimizer from the semantics of each VM "
+        "command.\n"
+        "// Do not edit; run `superoptimizer --output=src/"
+        "command_templates.cpp`\n"
+        "// instead.\n"
+        "\n"
+        "#include \"command_templates.h\"\n"
+        "\n"
+        "#include <vector>\n"
+        "\n"
+        "#include \"hack.h\"\n"
+        "\n"
+        "const std::vector<CommandTemplate> &CommandTemplates() {\n"
+        "  static const auto *templates = new std::vector<CommandTemplate>{\n";
+  for (const CommandTemplate &command_template : templates) {
+    os << "      // " << TemplateName(command_template) << ": "
+       << TemplateAssembly(command_template) << "\n"
+       << "      {\"" << command_template.command << "\", \""
+       << command_template.segment << "\", IndexClass::"
+       << IndexClassName(command_template.index_class) << ",\n"
+       << "       {\n";
+    for (const TemplateInstruction &instruction :
+         command_template.instructions) {
+      switch (instruction.kind) {
+        case TemplateInstruction::kRegister:
+          os << "           {TemplateInstruction::kRegister, \""
+             << instruction.symbol << "\", Computation::kZero, 0},\n";
+          break;
+        case TemplateInstruction::kParameter:
+          os << "           {TemplateInstruction::kParameter, {}, "
+                "Computation::kZero, 0},\n";
+          break;
+        case TemplateInstruction::kCompute: {
+          std::string line = absl::StrCat(
+              "           {TemplateInstruction::kCompute, {}, Computation::",
+              ComputationName(instruction.computation), ",");
+          std::string destination =
+              DestinationExpression(instruction.destination);
+          if (line.size() + 1 + destination.size() + 3 <= 80) {
+            os << line << " " << destination << "},\n";
+          } else {
+            os << line << "\n            " << destination << "},\n";
+          }
+          break;
+        }
+      }
+    }
+    os << "       }},\n";
+  }
+  os << "  };\n"
+        "  return *templates;\n"
+        "}\n";
+}
@@ -0,0 +1,55 @@
+#ifndef NAND2TETRIS_VMTRANSLATOR_SUPEROPTIMIZER_H_
+#define NAND2TETRIS_VMTRANSLATOR_SUPEROPTIMIZER_H_
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "command_templates.h"
+
+// Returns the commands, segments and index classes that have templates, in the
+// order of the table, without instructions.
+std::vector<CommandTemplate> TemplateKeys();
+
+// Returns the name of the template, such as "push local n".
+std::string TemplateName(const CommandTemplate &command_template);
+
+// Returns the instructions of the template as assembly code on one line, such
+// as "@SP AM=M-1 D=M A=A-1 M=D+M".
+std::string TemplateAssembly(const CommandTemplate &command_template);
+
+// Searches the instructions equivalent to the template `key` by increasing
+// length, up to `max_length`, and stores the first one found in `key`. Returns
+// false if there is none.
+//
+// Candidates load SP, the pointer of the segment and the parameter into A, and
+// compute anything without jumping. They are pruned when they read a register
+// before writing it, overwrite a register before reading it or write memory
+// the command does not, and when they reach the same values as a shorter
+// candidate on a few random machine states. Candidates that give the same
+// result on those states are tested on more, then proved equivalent; for a
+// pointer-addressed segment, with the pointer of each of them.
+bool Superoptimize(int max_length, CommandTemplate *key,
+                   int64_t *candidates = nullptr);
+
+// Returns the template for `segment` instead, loading its pointer register in
+// place of that of the template. Both segments must be pointer-addressed.
+// Templates found by `Superoptimize()` stay equivalent.
+CommandTemplate WithPointerSegment(const CommandTemplate &command_template,
+                                   std::string_view segment);
+
+// Whether the instructions of the template have the same effect on memory as
+// the command, by evaluating both symbolically. Values are sums of multiples of
+// the parameter, the initial A and D, the initial values of memory words and
+// the bitwise and of other values, modulo 2^16, which are equal if they have
+// the same multiples. Words whose addresses differ are assumed not to alias,
+// as in programs that keep the stack, the segments and the registers apart.
+bool ProveEquivalent(const CommandTemplate &command_template);
+
+// Writes the C++ source defining `CommandTemplates()` with `templates`.
+void WriteTemplateTable(const std::vector<CommandTemplate> &templates,
+                        std::ostream &os);
+
+#endif  // NAND2TETRIS_VMTRANSLATOR_SUPEROPTIMIZER_H_
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/strings/str_format.h"
+
+#include "command_templates.h"
+#include "superoptimizer.h"
+
+ABSL_FLAG(int, max_length, 8,
+          "number of instructions of the longest candidates searched, below "
+          "those of the templates the tool is built with");
+ABSL_FLAG(std::string, output, "",
+          "file to write the table of templates to, standard output if empty");
+ABSL_FLAG(bool, verify, false,
+          "instead of searching, prove the templates of the table the "
+          "translator is built with equivalent to their commands");
+
+namespace {
+
+bool IsPointerSegment(std::string_view segment) {
+  return segment == "local" || segment == "argument" || segment == "this" ||
+         segment == "that";
+}
+
+bool SameKey(const CommandTemplate &a, const CommandTemplate &b) {
+  return a.command == b.command && a.segment == b.segment &&
+         a.index_class == b.index_class;
+}
+
+// Returns the template of the table the tool is built with that has the key of
+// `key`, or null.
+const CommandTemplate *FindTemplate(const CommandTemplate &key) {
+  for (const CommandTemplate &command_template : CommandTemplates()) {
+    if (SameKey(command_template, key)) {
+      return &command_template;
+    }
+  }
+  return nullptr;
+}
+
+// Proves each template of the table, and checks that there is one for each
+// key. Returns false if any check fails.
+bool VerifyTable() {
+  std::vector<CommandTemplate> keys = TemplateKeys();
+  const std::vector<CommandTemplate> &templates = CommandTemplates();
+  bool verified = true;
+  if (templates.size() != keys.size()) {
+    LOG(ERROR) << "The table has " << templates.size() << " templates, "
+               << keys.size() << " expected";
+    verified = false;
+  }
+  for (size_t i = 0; i < templates.size(); ++i) {
+    const CommandTemplate &command_template = templates[i];
+    if (i < keys.size() && !SameKey(command_template, keys[i])) {
+      LOG(ERROR) << "Unexpected template " << TemplateName(command_template)
+                 << ", " << TemplateName(keys[i]) << " expected";
+      verified = false;
+    }
+    if (!ProveEquivalent(command_template)) {
+      LOG(ERROR) << "Not equivalent: " << TemplateName(command_template)
+                 << ": " << TemplateAssembly(command_template);
+      verified = false;
+      continue;
+    }
+    std::cout << "Proved " << TemplateName(command_template) << ": "
+              << TemplateAssembly(command_template) << std::endl;
+  }
+  return verified;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::SetProgramUsageMessage(absl::StrFormat(
+      "Usage: %s [--max_length=N] [--output=FILE] | --verify", argv[0]));
+  std::vector<char *> positional_args = absl::ParseCommandLine(argc, argv);
+  QCHECK_EQ(positional_args.size(), 1) << absl::ProgramUsageMessage();
+
+  if (absl::GetFlag(FLAGS_verify)) {
+    return VerifyTable() ? 0 : 1;
+  }
+
+  int max_length = absl::GetFlag(FLAGS_max_length);
+  std::vector<CommandTemplate> templates = TemplateKeys();
+  for (size_t i = 0; i < templates.size(); ++i) {
+    CommandTemplate &command_template = templates[i];
+    // The search finds instructions for pointer-addressed segments that serve
+    // all of them, so it runs once, for the first of them.
+    auto same_shape = std::find_if(
+        templates.begin(), templates.begin() + i,
+        [&](const CommandTemplate &other) {
+          return other.command == command_template.command &&
+                 other.index_class == command_template.index_class &&
+                 IsPointerSegment(other.segment) &&
+                 IsPointerSegment(command_template.segment);
+        });
+    if (same_shape != templates.begin() + i) {
+      command_template =
+          WithPointerSegment(*same_shape, command_template.segment);
+      QCHECK(ProveEquivalent(command_template))
+          << "Not equivalent: " << TemplateName(command_template) << ": "
+          << TemplateAssembly(command_template);
+      std::cerr << TemplateName(command_template) << ": "
+                << TemplateAssembly(command_template) << " (as "
+                << TemplateName(*same_shape) << ")" << std::endl;
+      continue;
+    }
+    // Long templates take hours to search, so the table the tool is built with
+    // bounds the search, and its template is kept unless a shorter one exists.
+    const CommandTemplate *current = FindTemplate(command_template);
+    int length = max_length;
+    if (current != nullptr && ProveEquivalent(*current)) {
+      length = std::min<int>(length, current->instructions.size() - 1);
+    } else {
+      current = nullptr;
+    }
+    int64_t candidates;
+    if (!Superoptimize(length, &command_template, &candidates)) {
+      QCHECK(current != nullptr)
+          << "No instructions equivalent to " << TemplateName(command_template)
+          << " within " << max_length << " instructions";
+      command_template = *current;
+      std::cerr << TemplateName(command_template) << ": "
+                << TemplateAssembly(command_template)
+                << " (kept, none shorter within " << length
+                << " instructions, " << candidates << " candidates)"
+                << std::endl;
+      continue;
+    }
+    std::cerr << TemplateName(command_template) << ": "
+              << TemplateAssembly(command_template) << " ("
+              << command_template.instructions.size() << " instructions, "
+              << candidates << " candidates)" << std::endl;
+  }
+
+  std::string output = absl::GetFlag(FLAGS_output);
+  if (output.empty()) {
+    WriteTemplateTable(templates, std::cout);
+    return 0;
+  }
+  std::ofstream file(output);
+  QCHECK(file) << "Cannot write " << output;
+  WriteTemplateTable(templates, file);
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include "superoptimizer.h"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "gtest/gtest.h"
+
+#include "command_templates.h"
+#include "hack.h"
+
+namespace {
+
+TemplateInstruction Register(std::string_view symbol) {
+  return {TemplateInstruction::kRegister, symbol, Computation::kZero, 0};
+}
+
+TemplateInstruction Parameter() {
+  return {TemplateInstruction::kParameter, {}, Computation::kZero, 0};
+}
+
+TemplateInstruction Compute(uint8_t destination, Computation computation) {
+  return {TemplateInstruction::kCompute, {}, computation, destination};
+}
+
+}  // namespace
+
+TEST(SuperoptimizerTest, FindsShortestTemplate) {
+  CommandTemplate key = {"neg", "", IndexClass::kNone, {}};
+  ASSERT_TRUE(Superoptimize(3, &key));
+  EXPECT_EQ(TemplateAssembly(key), "@SP A=M-1 M=-M");
+}
+
+TEST(SuperoptimizerTest, FailsBeyondMaxLength) {
+  CommandTemplate key = {"add", "", IndexClass::kNone, {}};
+  EXPECT_FALSE(Superoptimize(4, &key));
+  EXPECT_TRUE(key.instructions.empty());
+}
+
+TEST(ProveEquivalentTest, ProvesPop) {
+  CommandTemplate pop = {
+      "pop",
+      "temp",
+      IndexClass::kAny,
+      {Register("SP"), Compute(Destination::kA | Destination::kM,
+                               Computation::kMMinusOne),
+       Compute(Destination::kD, Computation::kM), Parameter(),
+       Compute(Destination::kM, Computation::kD)}};
+  EXPECT_EQ(TemplateName(pop), "pop temp n");
+  EXPECT_TRUE(ProveEquivalent(pop));
+}
+
+TEST(ProveEquivalentTest, RejectsWrongOperandOrder) {
+  CommandTemplate sub = {
+      "sub",
+      "",
+      IndexClass::kNone,
+      {Register("SP"), Compute(Destination::kA | Destination::kM,
+                               Computation::kMMinusOne),
+       Compute(Destination::kD, Computation::kM),
+       Compute(Destination::kA, Computation::kAMinusOne),
+       Compute(Destination::kM, Computation::kDMinusM)}};
+  EXPECT_FALSE(ProveEquivalent(sub));
+}
+
+TEST(ProveEquivalentTest, RejectsUnrelatedWrite) {
+  CommandTemplate neg = {
+      "neg",
+      "",
+      IndexClass::kNone,
+      {Register("SP"), Compute(Destination::kA, Computation::kMMinusOne),
+       Compute(Destination::kM, Computation::kNegM), Register("LCL"),
+       Compute(Destination::kM, Computation::kZero)}};
+  EXPECT_FALSE(ProveEquivalent(neg));
+}
+
+TEST(WithPointerSegmentTest, ReplacesPointer) {
+  CommandTemplate push = {
+      "push",
+      "local",
+      IndexClass::kZero,
+      {Register("LCL"), Compute(Destination::kA, Computation::kM),
+       Compute(Destination::kD, Computation::kM), Register("SP"),
+       Compute(Destination::kM, Computation::kMPlusOne),
+       Compute(Destination::kA, Computation::kMMinusOne),
+       Compute(Destination::kM, Computation::kD)}};
+  CommandTemplate that = WithPointerSegment(push, "that");
+  EXPECT_EQ(TemplateAssembly(that), "@THAT A=M D=M @SP M=M+1 A=M-1 M=D");
+  EXPECT_TRUE(ProveEquivalent(that));
+}
+
+TEST(WriteTemplateTableTest, WritesTable) {
+  CommandTemplate key = {"not", "", IndexClass::kNone, {}};
+  ASSERT_TRUE(Superoptimize(3, &key));
+  std::ostringstream table;
+  WriteTemplateTable({key}, table);
+  EXPECT_NE(table.str().find("// not: @SP A=M-1 M=!M"), std::string::npos);
+  EXPECT_NE(table.str().find("CommandTemplates()"), std::string::npos);
+}
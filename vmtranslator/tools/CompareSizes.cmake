@@ -0,0 +1,13 @@
+# Fails if the machine code file SMALLER has more instructions than the machine
+# code file LARGER.
+file(STRINGS ${SMALLER} smaller_instructions)
+file(STRINGS ${LARGER} larger_instructions)
+list(LENGTH smaller_instructions smaller_count)
+list(LENGTH larger_instructions larger_count)
+if(smaller_count GREATER larger_count)
+  message(
+    FATAL_ERROR
+    "${SMALLER} has ${smaller_count} instructions, more than the "
+    "${larger_count} of ${LARGER}"
+  )
+endif()